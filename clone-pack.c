@@ -5,13 +5,15 @@
 static const char clone_pack_usage[] =
 "git-clone-pack [--exec=<git-upload-pack>] [<host>:]<directory> [<heads>]*";
 static const char *exec = "git-upload-pack";
+static int use_sideband;
 
 static void clone_handshake(int fd[2], struct ref *ref)
 {
 	unsigned char sha1[20];
 
 	while (ref) {
-		packet_write(fd[1], "want %s\n", sha1_to_hex(ref->old_sha1));
+		packet_write(fd[1], "want %s%s\n", sha1_to_hex(ref->old_sha1),
+			     use_sideband ? " side-band" : "");
 		ref = ref->next;
 	}
 	packet_flush(fd[1]);
@@ -115,15 +117,21 @@ static int clone_pack(int fd[2], int nr_match, char **match)
 {
 	struct ref *refs;
 	int status;
+	pid_t sideband = 0;
 
 	get_remote_heads(fd[0], &refs, nr_match, match, 1);
 	if (!refs) {
 		packet_flush(fd[1]);
 		die("no matching remote head");
 	}
+	use_sideband = server_supports("side-band");
 	clone_handshake(fd, refs);
 
+	if (use_sideband)
+		sideband = setup_sideband(fd, "git-clone-pack", 0);
 	status = receive_keep_pack(fd, "git-clone-pack");
+	if (sideband && finish_sideband(sideband, "git-clone-pack"))
+		status = -1;
 
 	if (!status) {
 		if (nr_match == 0)
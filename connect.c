@@ -30,6 +30,9 @@ struct ref **get_remote_heads(int in, struct ref **list,
 		if (buffer[len-1] == '\n')
 			buffer[--len] = 0;
 
+		if (!strncmp(buffer, "ERR ", 4))
+			die("remote error: %s", buffer + 4);
+
 		if (len < 42 || get_sha1_hex(buffer, old_sha1) || buffer[40] != ' ')
 			die("protocol error: expected sha/ref, got '%s'", buffer);
 		name = buffer + 41;
@@ -374,6 +377,7 @@ static int git_tcp_connect(int fd[2], const char *prog, char *host, char *path)
 	fd[0] = sockfd;
 	fd[1] = sockfd;
 	packet_write(sockfd, "%s %s\n", prog, path);
+	packet_send(sockfd);
 	return 0;
 }
 
@@ -443,6 +447,7 @@ static int git_tcp_connect(int fd[2], const char *prog, char *host, char *path)
 	fd[0] = sockfd;
 	fd[1] = sockfd;
 	packet_write(sockfd, "%s %s\n", prog, path);
+	packet_send(sockfd);
 	return 0;
 }
 
@@ -551,6 +556,7 @@ static int git_proxy_connect(int fd[2], const char *prog, char *host, char *path
 	close(pipefd[0][1]);
 	close(pipefd[1][0]);
 	packet_write(fd[1], "%s %s\n", prog, path);
+	packet_send(fd[1]);
 	return pid;
 }
 
@@ -1,7 +1,50 @@
+#ifdef USE_COPY_FILE_RANGE
+#define _GNU_SOURCE /* copy_file_range() */
+#endif
 #include "cache.h"
+#ifdef USE_COPY_FILE_RANGE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#ifdef USE_COPY_FILE_RANGE
+/*
+ * Have the filesystem do the copy from one regular file to another:
+ * share the blocks outright (FICLONE) when both ends are whole files
+ * on a filesystem that can, or else copy them without bringing them
+ * up here.  When it cannot be done, the caller reads and writes
+ * whatever has not been copied yet.
+ */
+static int copy_fd_in_kernel(int ifd, int ofd)
+{
+	struct stat st;
+
+	if (fstat(ifd, &st) || !S_ISREG(st.st_mode))
+		return -1;
+#ifdef FICLONE
+	if (!lseek(ifd, 0, SEEK_CUR) && !lseek(ofd, 0, SEEK_END) &&
+	    !ioctl(ofd, FICLONE, ifd))
+		return 0;
+#endif
+	for (;;) {
+		ssize_t len = copy_file_range(ifd, NULL, ofd, NULL,
+					      1 << 30, 0);
+		if (!len)
+			return 0;
+		if (len < 0 && errno != EINTR)
+			return -1;
+	}
+}
+#endif
 
 int copy_fd(int ifd, int ofd)
 {
+#ifdef USE_COPY_FILE_RANGE
+	if (!copy_fd_in_kernel(ifd, ofd)) {
+		close(ifd);
+		return 0;
+	}
+#endif
 	while (1) {
 		int len;
 		char buffer[8192];
@@ -32,4 +75,3 @@ int copy_fd(int ifd, int ofd)
 	close(ifd);
 	return 0;
 }
-
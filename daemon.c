@@ -7,6 +7,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <syslog.h>
+#include <sys/uio.h>
 #include "pkt-line.h"
 #include "cache.h"
 
@@ -15,7 +16,8 @@ static int verbose;
 
 static const char daemon_usage[] =
 "git-daemon [--verbose] [--syslog] [--inetd | --port=n] [--export-all]\n"
-"           [--timeout=n] [--init-timeout=n] [--strict-paths] [directory...]";
+"           [--timeout=n] [--init-timeout=n] [--strict-paths]\n"
+"           [--max-connections=n] [--prefork=n] [--max-queue=n] [directory...]";
 
 /* List of acceptable pathname prefixes */
 static char **ok_paths = NULL;
@@ -237,172 +239,381 @@ static int execute(void)
 
 
 /*
- * We count spawned/reaped separately, just to avoid any
- * races when updating them from signals. The SIGCHLD handler
- * will only update children_reaped, and the fork logic will
- * only update children_spawned.
+ * Connections are accepted by the main loop and handed over a
+ * socketpair to a worker, a process forked ahead of time that serves
+ * one connection (it ends up exec'ing git-upload-pack) and exits.
  *
- * MAX_CHILDREN should be a power-of-two to make the modulus
- * operation cheap. It should also be at least twice
- * the maximum number of connections we will ever allow.
+ * At most max_connections workers serve connections at a time, and
+ * up to prefork more wait idle for the next one.  Connections that
+ * come in while all are busy wait in a queue of at most max_queue,
+ * and are served one from the host with the fewest connections being
+ * served first.  When the queue is full, a newcomer from a host with
+ * fewer connections waiting than the host with the most pushes the
+ * latest one of the latter out.  A connection that cannot be served
+ * is told so with an "ERR" packet instead of being killed later.
+ *
+ * The SIGCHLD handler only records dead children in dead_child[],
+ * and wakes up the main loop by writing to child_pipe; everything
+ * else is done by the main loop.  MAX_CHILDREN should be a power of
+ * two to make the modulus operation cheap, and at least twice the
+ * number of workers we will ever have.
  */
-#define MAX_CHILDREN 128
+#define MAX_CHILDREN 256
 
 static int max_connections = 25;
+static int prefork = 2;
+static int max_queue = -1;	/* max_connections, unless told */
 
 /* These are updated by the signal handler */
 static volatile unsigned int children_reaped = 0;
 static pid_t dead_child[MAX_CHILDREN];
+static int child_pipe[2];
 
-/* These are updated by the main loop */
-static unsigned int children_spawned = 0;
+/* This is updated by the main loop */
 static unsigned int children_deleted = 0;
 
-static struct child {
+static struct worker {
 	pid_t pid;
+	int channel;	/* to hand it a connection; -1 once busy */
+	int addrlen;
+	struct sockaddr_storage address;
+} *worker;
+static int worker_nr, worker_alloc, busy_nr;
+
+static struct waiting {
+	int fd;
 	int addrlen;
 	struct sockaddr_storage address;
-} live_child[MAX_CHILDREN];
+} *waiting;
+static int waiting_nr;
 
-static void add_child(int idx, pid_t pid, struct sockaddr *addr, int addrlen)
+static int listen_nr, *listen_fd;
+
+static int format_address(struct sockaddr *addr, char *buf, int size)
 {
-	live_child[idx].pid = pid;
-	live_child[idx].addrlen = addrlen;
-	memcpy(&live_child[idx].address, addr, addrlen);
+	*buf = '\0';
+	if (addr->sa_family == AF_INET) {
+		struct sockaddr_in *sin_addr = (void *) addr;
+		inet_ntop(AF_INET, &sin_addr->sin_addr, buf, size);
+		return sin_addr->sin_port;
+
+#ifndef NO_IPV6
+	} else if (addr->sa_family == AF_INET6) {
+		struct sockaddr_in6 *sin6_addr = (void *) addr;
+
+		*buf++ = '['; *buf = '\0'; /* stpcpy() is cool */
+		inet_ntop(AF_INET6, &sin6_addr->sin6_addr, buf, size - 2);
+		strcat(buf, "]");
+		return sin6_addr->sin6_port;
+#endif
+	}
+	return -1;
 }
 
-/*
- * Walk from "deleted" to "spawned", and remove child "pid".
- *
- * We move everything up by one, since the new "deleted" will
- * be one higher.
- */
-static void remove_child(pid_t pid, unsigned deleted, unsigned spawned)
+/* Do the two connections come from the same host? */
+static int same_host(struct sockaddr_storage *a_, struct sockaddr_storage *b_)
 {
-	struct child n;
+	struct sockaddr *a = (void *) a_, *b = (void *) b_;
 
-	deleted %= MAX_CHILDREN;
-	spawned %= MAX_CHILDREN;
-	if (live_child[deleted].pid == pid) {
-		live_child[deleted].pid = -1;
-		return;
-	}
-	n = live_child[deleted];
-	for (;;) {
-		struct child m;
-		deleted = (deleted + 1) % MAX_CHILDREN;
-		if (deleted == spawned)
-			die("could not find dead child %d\n", pid);
-		m = live_child[deleted];
-		live_child[deleted] = n;
-		if (m.pid == pid)
-			return;
-		n = m;
-	}
+	if (a->sa_family != b->sa_family)
+		return 0;
+	if (a->sa_family == AF_INET)
+		return !memcmp(&((struct sockaddr_in *)a)->sin_addr,
+			       &((struct sockaddr_in *)b)->sin_addr,
+			       sizeof(struct in_addr));
+#ifndef NO_IPV6
+	if (a->sa_family == AF_INET6)
+		return !memcmp(&((struct sockaddr_in6 *)a)->sin6_addr,
+			       &((struct sockaddr_in6 *)b)->sin6_addr,
+			       sizeof(struct in6_addr));
+#endif
+	return 0;
+}
+
+static int nr_served(struct sockaddr_storage *address)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < worker_nr; i++)
+		if (worker[i].channel < 0 &&
+		    same_host(&worker[i].address, address))
+			nr++;
+	return nr;
+}
+
+static int nr_waiting(struct sockaddr_storage *address)
+{
+	int i, nr = 0;
+
+	for (i = 0; i < waiting_nr; i++)
+		if (same_host(&waiting[i].address, address))
+			nr++;
+	return nr;
 }
 
 /*
- * This gets called if the number of connections grows
- * past "max_connections".
- *
- * We _should_ start off by searching for connections
- * from the same IP, and if there is some address wth
- * multiple connections, we should kill that first.
- *
- * As it is, we just "randomly" kill 25% of the connections,
- * and our pseudo-random generator sucks too. I have no
- * shame.
- *
- * Really, this is just a place-holder for a _real_ algorithm.
+ * Tell the client we are not going to serve it, in the one way a
+ * client can show to the user, and hang up.  Whatever request it has
+ * sent already is read first, so that closing does not reset the
+ * connection before the client sees our answer.
  */
-static void kill_some_children(int signo, unsigned start, unsigned stop)
+static void turn_away(int fd, struct sockaddr_storage *address, const char *msg)
 {
-	start %= MAX_CHILDREN;
-	stop %= MAX_CHILDREN;
-	while (start != stop) {
-		if (!(start & 3))
-			kill(live_child[start].pid, signo);
-		start = (start + 1) % MAX_CHILDREN;
-	}
+	char buf[1000];
+	int len, port;
+
+	port = format_address((struct sockaddr *) address, buf, sizeof(buf));
+	loginfo("Turned away %s:%d: %s", buf, port, msg);
+
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	len = snprintf(buf + 4, sizeof(buf) - 4, "ERR %s\n", msg);
+	if (len > sizeof(buf) - 5)
+		len = sizeof(buf) - 5;
+	sprintf(buf, "%04x", len + 4);
+	buf[4] = 'E';	/* sprintf() wrote a NUL there */
+	write(fd, buf, len + 4);
+	shutdown(fd, SHUT_WR);
+	close(fd);
 }
 
-static void check_max_connections(void)
+static void serve_connection(int incoming, struct sockaddr *addr)
 {
-	for (;;) {
-		int active;
-		unsigned spawned, reaped, deleted;
+	char addrbuf[256];
+	int port;
 
-		spawned = children_spawned;
-		reaped = children_reaped;
-		deleted = children_deleted;
+	dup2(incoming, 0);
+	dup2(incoming, 1);
+	close(incoming);
 
-		while (deleted < reaped) {
-			pid_t pid = dead_child[deleted % MAX_CHILDREN];
-			remove_child(pid, deleted, spawned);
-			deleted++;
-		}
-		children_deleted = deleted;
+	port = format_address(addr, addrbuf, sizeof(addrbuf));
+	loginfo("Connection from %s:%d", addrbuf, port);
 
-		active = spawned - deleted;
-		if (active <= max_connections)
-			break;
+	exit(execute());
+}
 
-		/* Kill some unstarted connections with SIGTERM */
-		kill_some_children(SIGTERM, deleted, spawned);
-		if (active <= max_connections << 1)
-			break;
+/* An idle worker waits here for the connection it is going to serve */
+static void worker_loop(int channel)
+{
+	struct sockaddr_storage address;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int incoming;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &address;
+	iov.iov_len = sizeof(address);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	while (recvmsg(channel, &msg, 0) <= 0) {
+		if (errno != EINTR)
+			exit(0);	/* the daemon went away */
+	}
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+		exit(1);
+	memcpy(&incoming, CMSG_DATA(cmsg), sizeof(int));
+	close(channel);
+	serve_connection(incoming, (struct sockaddr *) &address);
+}
+
+static void child_handler(int signo);
 
-		/* If the SIGTERM thing isn't helping use SIGKILL */
-		kill_some_children(SIGKILL, deleted, spawned);
-		sleep(1);
+static struct worker *start_worker(void)
+{
+	struct worker *w;
+	int sv[2], i;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return NULL;
+	pid = fork();
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return NULL;
+	}
+	if (!pid) {
+		/* Nothing the daemon holds is ours to keep open */
+		for (i = 0; i < listen_nr; i++)
+			close(listen_fd[i]);
+		for (i = 0; i < worker_nr; i++)
+			if (0 <= worker[i].channel)
+				close(worker[i].channel);
+		for (i = 0; i < waiting_nr; i++)
+			close(waiting[i].fd);
+		close(child_pipe[0]);
+		close(child_pipe[1]);
+		close(sv[0]);
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		worker_loop(sv[1]);
+	}
+	close(sv[1]);
+	if (worker_nr == worker_alloc) {
+		worker_alloc = alloc_nr(worker_alloc);
+		worker = xrealloc(worker, worker_alloc * sizeof(*worker));
 	}
+	w = &worker[worker_nr++];
+	w->pid = pid;
+	w->channel = sv[0];
+	w->addrlen = 0;
+	return w;
 }
 
-static void handle(int incoming, struct sockaddr *addr, int addrlen)
+static int hand_over(struct worker *w, struct waiting *conn)
 {
-	pid_t pid = fork();
-	char addrbuf[256] = "";
-	int port = -1;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &conn->address;
+	iov.iov_len = sizeof(conn->address);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &conn->fd, sizeof(int));
+	if (sendmsg(w->channel, &msg, 0) < 0)
+		return -1;
+
+	close(w->channel);
+	w->channel = -1;
+	w->addrlen = conn->addrlen;
+	memcpy(&w->address, &conn->address, conn->addrlen);
+	close(conn->fd);
+	busy_nr++;
+	return 0;
+}
 
-	if (pid) {
-		unsigned idx;
+static void serve_waiting(struct waiting *conn)
+{
+	int i;
 
-		close(incoming);
-		if (pid < 0)
+	for (i = 0; i < worker_nr; i++) {
+		struct worker *w = &worker[i];
+		if (0 <= w->channel && !hand_over(w, conn))
+			return;
+	}
+	for (i = 0; i < 2; i++) {
+		struct worker *w = start_worker();
+		if (w && !hand_over(w, conn))
 			return;
+	}
+	turn_away(conn->fd, &conn->address, "unable to start a worker");
+}
 
-		idx = children_spawned % MAX_CHILDREN;
-		children_spawned++;
-		add_child(idx, pid, addr, addrlen);
+/* Serve waiting connections, fairly between hosts, while we can */
+static void serve_queue(void)
+{
+	while (waiting_nr && busy_nr < max_connections) {
+		struct waiting conn;
+		int i, best = 0, best_nr = nr_served(&waiting[0].address);
+
+		for (i = 1; i < waiting_nr && best_nr; i++) {
+			int nr = nr_served(&waiting[i].address);
+			if (nr < best_nr) {
+				best = i;
+				best_nr = nr;
+			}
+		}
+		conn = waiting[best];
+		waiting_nr--;
+		memmove(waiting + best, waiting + best + 1,
+			(waiting_nr - best) * sizeof(*waiting));
+		serve_waiting(&conn);
+	}
+}
 
-		check_max_connections();
-		return;
+static void add_waiting(int fd, struct sockaddr *addr, int addrlen)
+{
+	struct waiting *conn;
+	struct sockaddr_storage address;
+
+	memcpy(&address, addr, addrlen);
+	if (waiting_nr == max_queue) {
+		int i, victim = -1, most = nr_waiting(&address);
+
+		/* The latest connection of the host with the most waiting */
+		for (i = waiting_nr - 1; 0 <= i; i--) {
+			int nr = nr_waiting(&waiting[i].address);
+			if (most < nr) {
+				victim = i;
+				most = nr;
+			}
+		}
+		if (victim < 0) {
+			turn_away(fd, &address, "server busy, try again later");
+			return;
+		}
+		turn_away(waiting[victim].fd, &waiting[victim].address,
+			  "server busy, try again later");
+		waiting_nr--;
+		memmove(waiting + victim, waiting + victim + 1,
+			(waiting_nr - victim) * sizeof(*waiting));
 	}
+	conn = &waiting[waiting_nr++];
+	conn->fd = fd;
+	conn->addrlen = addrlen;
+	memcpy(&conn->address, addr, addrlen);
+}
 
-	dup2(incoming, 0);
-	dup2(incoming, 1);
-	close(incoming);
+/*
+ * The queue is only ever non-empty while all workers are busy, so a
+ * connection that finds one free is served right away; only one
+ * that must wait is subject to max_queue.
+ */
+static void new_connection(int fd, struct sockaddr *addr, int addrlen)
+{
+	struct waiting conn;
 
-	if (addr->sa_family == AF_INET) {
-		struct sockaddr_in *sin_addr = (void *) addr;
-		inet_ntop(AF_INET, &sin_addr->sin_addr, addrbuf, sizeof(addrbuf));
-		port = sin_addr->sin_port;
+	if (busy_nr < max_connections) {
+		conn.fd = fd;
+		conn.addrlen = addrlen;
+		memcpy(&conn.address, addr, addrlen);
+		serve_waiting(&conn);
+		return;
+	}
+	add_waiting(fd, addr, addrlen);
+}
 
-#ifndef NO_IPV6
-	} else if (addr->sa_family == AF_INET6) {
-		struct sockaddr_in6 *sin6_addr = (void *) addr;
+/* Forget the workers that are gone, and keep the idle ones ready */
+static void tend_workers(void)
+{
+	unsigned reaped = children_reaped;
+	int i, idle;
 
-		char *buf = addrbuf;
-		*buf++ = '['; *buf = '\0'; /* stpcpy() is cool */
-		inet_ntop(AF_INET6, &sin6_addr->sin6_addr, buf, sizeof(addrbuf) - 1);
-		strcat(buf, "]");
+	while (children_deleted < reaped) {
+		pid_t pid = dead_child[children_deleted++ % MAX_CHILDREN];
 
-		port = sin6_addr->sin6_port;
-#endif
+		for (i = 0; i < worker_nr; i++) {
+			if (worker[i].pid != pid)
+				continue;
+			if (0 <= worker[i].channel)
+				close(worker[i].channel);
+			else
+				busy_nr--;
+			worker[i] = worker[--worker_nr];
+			break;
+		}
 	}
-	loginfo("Connection from %s:%d", addrbuf, port);
 
-	exit(execute());
+	serve_queue();
+
+	idle = worker_nr - busy_nr;
+	while (idle < prefork && start_worker())
+		idle++;
 }
 
 static void child_handler(int signo)
@@ -429,6 +640,7 @@ static void child_handler(int signo)
 		}
 		break;
 	}
+	write(child_pipe[1], "", 1);
 }
 
 #ifndef NO_IPV6
@@ -539,19 +751,35 @@ static int service_loop(int socknum, int *socklist)
 	struct pollfd *pfd;
 	int i;
 
-	pfd = xcalloc(socknum, sizeof(struct pollfd));
+	pfd = xcalloc(socknum + 1, sizeof(struct pollfd));
 
 	for (i = 0; i < socknum; i++) {
 		pfd[i].fd = socklist[i];
 		pfd[i].events = POLLIN;
 	}
+	listen_nr = socknum;
+	listen_fd = socklist;
+
+	if (pipe(child_pipe) < 0)
+		die("unable to create pipe: %s", strerror(errno));
+	fcntl(child_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(child_pipe[1], F_SETFL, O_NONBLOCK);
+	pfd[socknum].fd = child_pipe[0];
+	pfd[socknum].events = POLLIN;
 
+	if (max_queue < 0)
+		max_queue = max_connections;
+	waiting = xcalloc(max_queue + 1, sizeof(*waiting));
+
+	signal(SIGPIPE, SIG_IGN);
 	signal(SIGCHLD, child_handler);
 
 	for (;;) {
 		int i;
 
-		if (poll(pfd, socknum, -1) < 0) {
+		tend_workers();
+
+		if (poll(pfd, socknum + 1, -1) < 0) {
 			if (errno != EINTR) {
 				error("poll failed, resuming: %s",
 				      strerror(errno));
@@ -560,6 +788,12 @@ static int service_loop(int socknum, int *socklist)
 			continue;
 		}
 
+		if (pfd[socknum].revents & POLLIN) {
+			char buf[64];
+			while (read(child_pipe[0], buf, sizeof(buf)) > 0)
+				;
+		}
+
 		for (i = 0; i < socknum; i++) {
 			if (pfd[i].revents & POLLIN) {
 				struct sockaddr_storage ss;
@@ -575,7 +809,7 @@ static int service_loop(int socknum, int *socklist)
 						die("accept returned %s", strerror(errno));
 					}
 				}
-				handle(incoming, (struct sockaddr *)&ss, sslen);
+				new_connection(incoming, (struct sockaddr *)&ss, sslen);
 			}
 		}
 	}
@@ -635,6 +869,18 @@ int main(int argc, char **argv)
 			init_timeout = atoi(arg+15);
 			continue;
 		}
+		if (!strncmp(arg, "--max-connections=", 18)) {
+			max_connections = atoi(arg+18);
+			continue;
+		}
+		if (!strncmp(arg, "--prefork=", 10)) {
+			prefork = atoi(arg+10);
+			continue;
+		}
+		if (!strncmp(arg, "--max-queue=", 12)) {
+			max_queue = atoi(arg+12);
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
@@ -653,6 +899,11 @@ int main(int argc, char **argv)
 	if (log_syslog)
 		openlog("git-daemon", 0, LOG_DAEMON);
 
+	if (max_connections < 1 || prefork < 0 ||
+	    MAX_CHILDREN / 2 < max_connections + prefork)
+		die("git-daemon: --max-connections and --prefork must "
+		    "add up to at most %d", MAX_CHILDREN / 2);
+
 	if (strict_paths && (!ok_paths || !*ok_paths)) {
 		if (!inetd_mode)
 			die("git-daemon: option --strict-paths requires a whitelist");
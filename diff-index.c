@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "diff.h"
+#include "tree.h"
 
 static int cached_only = 0;
 static int match_nonexisting = 0;
@@ -88,79 +89,111 @@ static int show_modified(struct cache_entry *old,
 	return 0;
 }
 
-static int diff_cache(struct cache_entry **ac, int entries, const char **pathspec)
-{
-	while (entries) {
-		struct cache_entry *ce = *ac;
-		int same = (entries > 1) && ce_same_name(ce, ac[1]);
-
-		if (!ce_path_match(ce, pathspec))
-			goto skip_entry;
-
-		switch (ce_stage(ce)) {
-		case 0:
-			/* No stage 1 entry? That means it's a new file */
-			if (!same) {
-				show_new_file(ce);
-				break;
-			}
-			/* Show difference between old and new */
-			show_modified(ac[1], ce, 1);
-			break;
-		case 1:
-			/* No stage 3 (merge) entry? That means it's been deleted */
-			if (!same) {
-				show_file("-", ce, ce->sha1, ce->ce_mode);
-				break;
-			}
-			/* We come here with ce pointing at stage 1
-			 * (original tree) and ac[1] pointing at stage
-			 * 3 (unmerged).  show-modified with
-			 * report-mising set to false does not say the
-			 * file is deleted but reports true if work
-			 * tree does not have it, in which case we
-			 * fall through to report the unmerged state.
-			 * Otherwise, we show the differences between
-			 * the original tree and the work tree.
-			 */
-			if (!cached_only && !show_modified(ce, ac[1], 0))
-				break;
-			/* fallthru */
-		case 3:
-			diff_unmerge(&diff_options, ce->name);
-			break;
+/*
+ * The tree is not read into the index as stage #1 entries.  Instead,
+ * its files come one at a time from read_tree_recursive(), in the
+ * same order the index is sorted in, and are matched up with the
+ * index entries at the cursor below.
+ */
+static struct cache_entry **cursor;
+static int cursor_left;
+static const char **pathspec;
 
-		default:
-			die("impossible cache entry stage");
-		}
+/*
+ * Compare the entry from the tree (or the one at the cursor if there
+ * is none) with the index entries with the same name, and move the
+ * cursor past them.
+ */
+static void diff_entry(struct cache_entry *tree_ce)
+{
+	struct cache_entry *ce = NULL;
 
-skip_entry:
+	if (cursor_left &&
+	    (!tree_ce || ce_same_name(tree_ce, cursor[0]))) {
+		ce = cursor[0];
 		/*
 		 * Ignore all the different stages for this file,
-		 * we've handled the relevant cases now.
+		 * we handle the relevant cases with the first one.
 		 */
 		do {
-			ac++;
-			entries--;
-		} while (entries && ce_same_name(ce, ac[0]));
+			cursor++;
+			cursor_left--;
+		} while (cursor_left && ce_same_name(ce, cursor[0]));
 	}
-	return 0;
+
+	if (!ce_path_match(tree_ce ? tree_ce : ce, pathspec))
+		return;
+
+	if (!ce) {
+		/* Only in the tree? That means it's been deleted */
+		show_file("-", tree_ce, tree_ce->sha1, tree_ce->ce_mode);
+		return;
+	}
+	if (!ce_stage(ce)) {
+		/* Only in the index? That means it's a new file */
+		if (!tree_ce) {
+			show_new_file(ce);
+			return;
+		}
+		/* Show difference between old and new */
+		show_modified(tree_ce, ce, 1);
+		return;
+	}
+	/* We come here with ce pointing at the first unmerged
+	 * entry.  show-modified with report-mising set to false
+	 * does not say the file is deleted but reports true if
+	 * work tree does not have it, in which case we fall
+	 * through to report the unmerged state.  Otherwise, we
+	 * show the differences between the original tree and the
+	 * work tree.
+	 */
+	if (tree_ce && !cached_only && !show_modified(tree_ce, ce, 0))
+		return;
+	diff_unmerge(&diff_options, ce->name);
 }
 
-/*
- * This turns all merge entries into "stage 3". That guarantees that
- * when we read in the new tree (into "stage 1"), we won't lose sight
- * of the fact that we had unmerged entries.
- */
-static void mark_merge_entries(void)
+static int diff_tree_entry(unsigned char *sha1, const char *base, int baselen,
+			   const char *pathname, unsigned mode, int stage)
 {
-	int i;
-	for (i = 0; i < active_nr; i++) {
-		struct cache_entry *ce = active_cache[i];
-		if (!ce_stage(ce))
-			continue;
-		ce->ce_flags |= htons(CE_STAGEMASK);
+	static struct cache_entry *ce;
+	static int ce_alloc;
+	int len, size;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	len = strlen(pathname);
+	size = cache_entry_size(baselen + len);
+	if (ce_alloc < size) {
+		ce_alloc = size;
+		ce = xrealloc(ce, size);
 	}
+	memset(ce, 0, size);
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(baselen + len, stage);
+	memcpy(ce->name, base, baselen);
+	memcpy(ce->name + baselen, pathname, len+1);
+	memcpy(ce->sha1, sha1, 20);
+
+	/* Index entries that sort before this one are not in the tree */
+	while (cursor_left &&
+	       cache_name_compare(cursor[0]->name, ce_namelen(cursor[0]),
+				  ce->name, baselen + len) < 0)
+		diff_entry(NULL);
+	diff_entry(ce);
+	return 0;
+}
+
+static int diff_cache(void *tree, unsigned long size)
+{
+	cursor = active_cache;
+	cursor_left = active_nr;
+	if (read_tree_recursive(tree, size, "", 0, 1, pathspec,
+				diff_tree_entry))
+		return -1;
+	while (cursor_left)
+		diff_entry(NULL);
+	return 0;
 }
 
 static const char diff_cache_usage[] =
@@ -173,10 +206,8 @@ int main(int argc, const char **argv)
 	const char *tree_name = NULL;
 	unsigned char sha1[20];
 	const char *prefix = setup_git_directory();
-	const char **pathspec = NULL;
 	void *tree;
 	unsigned long size;
-	int ret;
 	int allow_options = 1;
 	int i;
 
@@ -231,17 +262,13 @@ int main(int argc, const char **argv)
 
 	read_cache();
 
-	mark_merge_entries();
-
 	tree = read_object_with_reference(sha1, "tree", &size, NULL);
 	if (!tree)
 		die("bad tree object %s", tree_name);
-	if (read_tree(tree, size, 1, pathspec))
+	if (diff_cache(tree, size))
 		die("unable to read tree object %s", tree_name);
 
-	ret = diff_cache(active_cache, active_nr, pathspec);
-
 	diffcore_std(&diff_options);
 	diff_flush(&diff_options);
-	return ret;
+	return 0;
 }
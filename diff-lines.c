@@ -0,0 +1,705 @@
+/*
+ * In-core line diff.
+ *
+ * This produces the same unified format "diff -u" (and "diff -pu")
+ * does, so that showing a patch does not have to write the two sides
+ * out to temporary files and run an external diff on them.
+ *
+ * The edit script is found with the O(ND) algorithm by Eugene Myers
+ * ("An O(ND) Difference Algorithm and Its Variations", Algorithmica
+ * 1(2), 1986), splitting at the middle snake.  Runs of changes are
+ * then slid down so that the hunks come out where people are used to
+ * seeing them.  The hunks are usually what "diff" gives, but where
+ * there is more than one shortest edit script they may differ.
+ */
+#include <limits.h>
+#include "cache.h"
+#include "diff.h"
+#include "diffcore.h"
+
+struct diff_line {
+	const char *ptr;
+	unsigned long len;	/* including the newline, if there is one */
+	unsigned int hash;
+};
+
+struct diff_side {
+	struct diff_line *line;
+	int nr;
+	int *equiv;		/* class of each line */
+	char *changed;		/* with a zero sentinel on each side */
+	int *kept;		/* lines that have a match on the other side */
+	int *kept_equiv;
+	int kept_nr;
+};
+
+static void split_lines(struct diff_side *s, const char *buf, unsigned long size)
+{
+	const char *end = buf + size;
+	int alloc = 0;
+
+	s->line = NULL;
+	s->nr = 0;
+	while (buf < end) {
+		const char *eol = memchr(buf, '\n', end - buf);
+		unsigned long len = eol ? eol - buf + 1 : end - buf;
+		unsigned int hash = 5381;
+		unsigned long i;
+
+		for (i = 0; i < len; i++)
+			hash = (hash * 33) ^ (unsigned char)buf[i];
+		if (s->nr == alloc) {
+			alloc = alloc_nr(alloc);
+			s->line = xrealloc(s->line, alloc * sizeof(*s->line));
+		}
+		s->line[s->nr].ptr = buf;
+		s->line[s->nr].len = len;
+		s->line[s->nr].hash = hash;
+		s->nr++;
+		buf += len;
+	}
+}
+
+static int same_line(const struct diff_line *a, const struct diff_line *b)
+{
+	return a->hash == b->hash && a->len == b->len &&
+		!memcmp(a->ptr, b->ptr, a->len);
+}
+
+/*
+ * Give every distinct line a number, so that the rest only has to
+ * compare integers, and count how often each appears on each side.
+ */
+static void classify_lines(struct diff_side *side, int *count[2])
+{
+	const struct diff_line **class_line;
+	int *hash;
+	int hash_size, nr_class = 0, total, i, f;
+
+	total = side[0].nr + side[1].nr;
+	hash_size = 64;
+	while (hash_size < total * 2)
+		hash_size <<= 1;
+	hash = xcalloc(hash_size, sizeof(int));
+	class_line = xmalloc((total + 1) * sizeof(*class_line));
+	count[0] = xcalloc(total + 1, sizeof(int));
+	count[1] = xcalloc(total + 1, sizeof(int));
+
+	for (f = 0; f < 2; f++) {
+		struct diff_side *s = &side[f];
+
+		s->equiv = xmalloc((s->nr + 1) * sizeof(int));
+		for (i = 0; i < s->nr; i++) {
+			const struct diff_line *l = &s->line[i];
+			unsigned int pos = l->hash & (hash_size - 1);
+
+			/* slots hold the class number plus one */
+			while (hash[pos]) {
+				if (same_line(class_line[hash[pos] - 1], l))
+					break;
+				pos = (pos + 1) & (hash_size - 1);
+			}
+			if (!hash[pos]) {
+				class_line[nr_class] = l;
+				hash[pos] = ++nr_class;
+			}
+			s->equiv[i] = hash[pos] - 1;
+			count[f][hash[pos] - 1]++;
+		}
+	}
+	free(hash);
+	free(class_line);
+}
+
+/*
+ * A line that does not appear on the other side at all is a change no
+ * matter what; mark it so and leave it out of the search, which then
+ * only has to look at the lines that may have a partner.
+ */
+static void drop_unique_lines(struct diff_side *side, int *count[2])
+{
+	int f, i;
+
+	for (f = 0; f < 2; f++) {
+		struct diff_side *s = &side[f];
+		const int *other = count[1 - f];
+
+		s->kept = xmalloc((s->nr + 1) * sizeof(int));
+		s->kept_equiv = xmalloc((s->nr + 1) * sizeof(int));
+		s->kept_nr = 0;
+		for (i = 0; i < s->nr; i++) {
+			if (!other[s->equiv[i]]) {
+				s->changed[i] = 1;
+				continue;
+			}
+			s->kept[s->kept_nr] = i;
+			s->kept_equiv[s->kept_nr++] = s->equiv[i];
+		}
+	}
+}
+
+/*
+ * The search for the shortest edit script, using the "middle snake"
+ * of Myers' paper to do it in linear space.
+ *
+ * Within a box of n lines of a by m lines of b, diagonal k holds the
+ * points with x - y == k.  fwd[k] is how far (in x) a path from the
+ * top left corner that makes "cost" edits gets along diagonal k, and
+ * bwd[k] how far back a path from the bottom right corner gets; -1
+ * and INT_MAX mean the diagonal cannot be reached at that cost.
+ */
+struct diff_search {
+	const int *a, *b;	/* kept_equiv of the two sides */
+	int *fwd, *bwd;		/* indexed by diagonal, from -m to n */
+	int max_cost;
+};
+
+/*
+ * Find a point in the box (x0, y0) - (x1, y1) that a shortest edit
+ * script passes through, other than its corners.  Both sides must be
+ * non-empty and differ in their first and in their last line.  If
+ * even the best script costs more than max_cost edits, we give up on
+ * it and take the point the forward search has got furthest to.
+ */
+static void split_box(struct diff_search *ds,
+		      int x0, int x1, int y0, int y1, int *xp, int *yp)
+{
+	const int *a = ds->a + x0, *b = ds->b + y0;
+	int *fwd = ds->fwd, *bwd = ds->bwd;
+	int n = x1 - x0, m = y1 - y0, delta = n - m;
+	int odd = delta & 1;
+	int cost;
+
+	for (cost = 0; ; cost++) {
+		int k, lo, hi;
+
+		/* forward, from the top left */
+		lo = -cost < -m ? -m + ((cost - m) & 1) : -cost;
+		hi = cost > n ? n - ((cost - n) & 1) : cost;
+		for (k = lo; k <= hi; k += 2) {
+			int x = -1, y;
+
+			if (!cost)
+				x = 0;
+			else {
+				/* a step down from diagonal k + 1 */
+				if (k + 1 <= n && k + 1 < cost && 0 <= fwd[k + 1] &&
+				    fwd[k + 1] - (k + 1) < m)
+					x = fwd[k + 1];
+				/* or a step right from diagonal k - 1 */
+				if (-m <= k - 1 && -cost < k - 1 && 0 <= fwd[k - 1] &&
+				    fwd[k - 1] < n && x < fwd[k - 1] + 1)
+					x = fwd[k - 1] + 1;
+			}
+			fwd[k] = x;
+			if (x < 0)
+				continue;
+			y = x - k;
+			while (x < n && y < m && a[x] == b[y])
+				x++, y++;
+			fwd[k] = x;
+			if (odd && delta - cost < k && k < delta + cost &&
+			    bwd[k] != INT_MAX && bwd[k] <= x) {
+				*xp = x0 + x;
+				*yp = y0 + y;
+				return;
+			}
+		}
+
+		/* backward, from the bottom right */
+		lo = delta - cost < -m ? -m + ((delta - cost + m) & 1) : delta - cost;
+		hi = delta + cost > n ? n - ((delta + cost - n) & 1) : delta + cost;
+		for (k = lo; k <= hi; k += 2) {
+			int x = INT_MAX, y;
+
+			if (!cost)
+				x = n;
+			else {
+				/* a step up from diagonal k - 1 */
+				if (-m <= k - 1 && delta - cost < k - 1 &&
+				    bwd[k - 1] != INT_MAX && 0 < bwd[k - 1] - (k - 1))
+					x = bwd[k - 1];
+				/* or a step left from diagonal k + 1 */
+				if (k + 1 <= n && k + 1 < delta + cost &&
+				    bwd[k + 1] != INT_MAX && 0 < bwd[k + 1] &&
+				    bwd[k + 1] - 1 < x)
+					x = bwd[k + 1] - 1;
+			}
+			bwd[k] = x;
+			if (x == INT_MAX)
+				continue;
+			y = x - k;
+			while (0 < x && 0 < y && a[x - 1] == b[y - 1])
+				x--, y--;
+			bwd[k] = x;
+			if (!odd && -cost <= k && k <= cost &&
+			    0 <= fwd[k] && x <= fwd[k]) {
+				*xp = x0 + x;
+				*yp = y0 + y;
+				return;
+			}
+		}
+
+		if (ds->max_cost <= cost) {
+			int best = -1;
+
+			lo = -cost < -m ? -m : -cost;
+			hi = cost > n ? n : cost;
+			for (k = lo; k <= hi; k++) {
+				if ((k - cost) & 1 || fwd[k] < 0)
+					continue;
+				if (best < fwd[k] + fwd[k] - k &&
+				    (fwd[k] < n || fwd[k] - k < m)) {
+					best = fwd[k] + fwd[k] - k;
+					*xp = x0 + fwd[k];
+					*yp = y0 + fwd[k] - k;
+				}
+			}
+			if (0 <= best)
+				return;
+			ds->max_cost = INT_MAX;
+		}
+	}
+}
+
+static void mark_changed(struct diff_side *s, int from, int to)
+{
+	while (from < to)
+		s->changed[s->kept[from++]] = 1;
+}
+
+static void compare_kept(struct diff_search *ds, struct diff_side *side,
+			 int x0, int x1, int y0, int y1)
+{
+	const int *a = ds->a, *b = ds->b;
+
+	while (x0 < x1 && y0 < y1 && a[x0] == b[y0])
+		x0++, y0++;
+	while (x0 < x1 && y0 < y1 && a[x1 - 1] == b[y1 - 1])
+		x1--, y1--;
+
+	if (x0 == x1 || y0 == y1) {
+		mark_changed(&side[0], x0, x1);
+		mark_changed(&side[1], y0, y1);
+	}
+	else {
+		int x, y;
+
+		split_box(ds, x0, x1, y0, y1, &x, &y);
+		compare_kept(ds, side, x0, x, y0, y);
+		compare_kept(ds, side, x, x1, y, y1);
+	}
+}
+
+/*
+ * Lines that are not changed pair up in order between the two sides.
+ * For each such pairing, gap[u] says whether the other side has
+ * changed lines right before its u-th unchanged line (or at its end,
+ * for u == the number of unchanged lines).
+ */
+static char *change_gaps(const struct diff_side *s)
+{
+	char *gap = xcalloc(s->nr + 1, 1);
+	int i, u = 0;
+
+	for (i = 0; i < s->nr; i++) {
+		if (s->changed[i])
+			gap[u] = 1;
+		else
+			u++;
+	}
+	return gap;
+}
+
+/*
+ * The edit script is not unique where a changed run sits next to
+ * lines like its own: "-b +a b" and "a -b" say the same thing.  Move
+ * each run as far down as it goes, merging it with the runs it meets
+ * on the way, so that insertions of whole blocks come out the way
+ * people wrote them.  If on the way it passed a place where the other
+ * side has changes, too, settle there instead, so that the two show
+ * up as one change instead of two.
+ */
+static void slide_runs(struct diff_side *side)
+{
+	int f;
+
+	for (f = 0; f < 2; f++) {
+		struct diff_side *s = &side[f];
+		char *changed = s->changed;
+		const int *equiv = s->equiv;
+		char *gap = change_gaps(&side[1 - f]);
+		int i = 0, u = 0;
+
+		while (i < s->nr) {
+			int start, end, len, paired;
+
+			if (!changed[i]) {
+				i++;
+				u++;
+				continue;
+			}
+			start = i;
+			for (end = start; end < s->nr && changed[end]; end++)
+				;
+
+			do {
+				len = end - start;
+				while (start && equiv[start - 1] == equiv[end - 1]) {
+					changed[--start] = 1;
+					changed[--end] = 0;
+					u--;
+					while (start && changed[start - 1])
+						start--;
+				}
+				paired = gap[u] ? end : -1;
+				while (end < s->nr && equiv[start] == equiv[end]) {
+					changed[start++] = 0;
+					changed[end++] = 1;
+					u++;
+					while (end < s->nr && changed[end])
+						end++;
+					if (gap[u])
+						paired = end;
+				}
+			} while (len != end - start);
+
+			while (0 <= paired && paired < end) {
+				changed[--start] = 1;
+				changed[--end] = 0;
+				u--;
+			}
+			i = end;
+		}
+		free(gap);
+	}
+}
+
+struct diff_change {
+	int line0, line1;	/* first line changed on each side */
+	int deleted, inserted;
+};
+
+static struct diff_change *build_changes(struct diff_side *side, int *nr_p)
+{
+	struct diff_change *change = NULL;
+	int nr = 0, alloc = 0, i = 0, j = 0;
+
+	while (i < side[0].nr || j < side[1].nr) {
+		struct diff_change *c;
+
+		if (!side[0].changed[i] && !side[1].changed[j]) {
+			i++;
+			j++;
+			continue;
+		}
+		if (nr == alloc) {
+			alloc = alloc_nr(alloc);
+			change = xrealloc(change, alloc * sizeof(*change));
+		}
+		c = &change[nr++];
+		c->line0 = i;
+		c->line1 = j;
+		while (side[0].changed[i])
+			i++;
+		while (side[1].changed[j])
+			j++;
+		c->deleted = i - c->line0;
+		c->inserted = j - c->line1;
+	}
+	*nr_p = nr;
+	return change;
+}
+
+/* The hunks are collected here */
+static char *out;
+static unsigned long out_len, out_alloc;
+
+static void emit(const char *buf, unsigned long len)
+{
+	if (out_alloc < out_len + len) {
+		out_alloc = alloc_nr(out_len + len);
+		out = xrealloc(out, out_alloc);
+	}
+	memcpy(out + out_len, buf, len);
+	out_len += len;
+}
+
+static void emit_char(int c)
+{
+	char ch = c;
+	emit(&ch, 1);
+}
+
+static void emit_str(const char *str)
+{
+	emit(str, strlen(str));
+}
+
+static void print_range(int start, int count)
+{
+	char buf[50];
+
+	if (!count)
+		sprintf(buf, "%d,0", start);
+	else if (count == 1)
+		sprintf(buf, "%d", start + 1);
+	else
+		sprintf(buf, "%d,%d", start + 1, count);
+	emit_str(buf);
+}
+
+static void print_line(int prefix, const struct diff_line *l)
+{
+	emit_char(prefix);
+	emit(l->ptr, l->len);
+	if (!l->len || l->ptr[l->len - 1] != '\n')
+		emit_str("\n\\ No newline at end of file\n");
+}
+
+/* What "diff -p" uses: a line that begins with a letter, '_' or '$' */
+static int is_function_line(const struct diff_line *l)
+{
+	return l->len && l->ptr[0] != '\n' &&
+		(isalpha(l->ptr[0]) || l->ptr[0] == '_' || l->ptr[0] == '$');
+}
+
+static void print_function(const struct diff_line *l)
+{
+	int i = 0, j, len = l->len;
+
+	while (i < len && isspace(l->ptr[i]) && l->ptr[i] != '\n')
+		i++;
+	for (j = i; j < i + 40 && j < len && l->ptr[j] != '\n'; j++)
+		;
+	while (i < j && isspace(l->ptr[j - 1]))
+		j--;
+	emit_char(' ');
+	emit(l->ptr + i, j - i);
+}
+
+static void emit_hunks(struct diff_side *side,
+		       struct diff_change *change, int nr,
+		       const struct diff_lines_options *opt)
+{
+	int context = opt->context;
+	int last_search = 0, last_match = -1;
+	int c = 0;
+
+	while (c < nr) {
+		int first = c, last, first0, first1, last0, last1, i, k;
+
+		/* changes closer than this share a hunk */
+		for (last = c; last + 1 < nr; last++) {
+			int top0 = change[last].line0 + change[last].deleted;
+			if (change[last + 1].line0 - top0 >= 2 * context + 1)
+				break;
+		}
+		c = last + 1;
+
+		first0 = change[first].line0 - context;
+		first1 = change[first].line1 - context;
+		if (first0 < 0)
+			first0 = 0;
+		if (first1 < 0)
+			first1 = 0;
+		last0 = change[last].line0 + change[last].deleted + context;
+		last1 = change[last].line1 + change[last].inserted + context;
+		if (side[0].nr < last0)
+			last0 = side[0].nr;
+		if (side[1].nr < last1)
+			last1 = side[1].nr;
+
+		emit_str("@@ -");
+		print_range(first0, last0 - first0);
+		emit_str(" +");
+		print_range(first1, last1 - first1);
+		emit_str(" @@");
+		if (opt->show_function) {
+			for (i = first0 - 1; last_search <= i; i--)
+				if (is_function_line(&side[0].line[i])) {
+					last_match = i;
+					break;
+				}
+			last_search = first0;
+			if (0 <= last_match)
+				print_function(&side[0].line[last_match]);
+		}
+		emit_char('\n');
+
+		i = first0;
+		for (k = first; k <= last; k++) {
+			const struct diff_change *ch = &change[k];
+			int n;
+
+			for ( ; i < ch->line0; i++)
+				print_line(' ', &side[0].line[i]);
+			for (n = 0; n < ch->deleted; n++)
+				print_line('-', &side[0].line[i++]);
+			for (n = 0; n < ch->inserted; n++)
+				print_line('+', &side[1].line[ch->line1 + n]);
+		}
+		for ( ; i < last0; i++)
+			print_line(' ', &side[0].line[i]);
+	}
+}
+
+/*
+ * Find the shortest edit script between the two sides, marking the
+ * lines that are not common in their "changed" arrays.
+ */
+static void compare_sides(struct diff_side *side)
+{
+	struct diff_search ds;
+	int *count[2];
+	int n, m;
+
+	classify_lines(side, count);
+	drop_unique_lines(side, count);
+	free(count[0]);
+	free(count[1]);
+
+	n = side[0].kept_nr;
+	m = side[1].kept_nr;
+	ds.a = side[0].kept_equiv;
+	ds.b = side[1].kept_equiv;
+	ds.fwd = xmalloc((n + m + 1) * 2 * sizeof(int));
+	ds.bwd = ds.fwd + (n + m + 1);
+	ds.fwd += m;
+	ds.bwd += m;
+	/* about the square root of the number of lines, but at least 256 */
+	for (ds.max_cost = 256; ds.max_cost * ds.max_cost < n + m; )
+		ds.max_cost <<= 1;
+
+	compare_kept(&ds, side, 0, n, 0, m);
+	free(ds.fwd - m);
+
+	slide_runs(side);
+
+	free(side[0].equiv);
+	free(side[1].equiv);
+	free(side[0].kept);
+	free(side[1].kept);
+	free(side[0].kept_equiv);
+	free(side[1].kept_equiv);
+}
+
+/*
+ * Return the hunks of the unified diff between a and b, without the
+ * "---" and "+++" lines, in a buffer the caller should free.
+ */
+char *diff_lines(const char *a, unsigned long a_size,
+		 const char *b, unsigned long b_size,
+		 const struct diff_lines_options *opt,
+		 unsigned long *size)
+{
+	struct diff_side side[2];
+	struct diff_change *change;
+	int nr_change, f;
+
+	split_lines(&side[0], a, a_size);
+	split_lines(&side[1], b, b_size);
+	for (f = 0; f < 2; f++)
+		side[f].changed = xcalloc(side[f].nr + 2, 1) + 1;
+	compare_sides(side);
+
+	out = NULL;
+	out_len = out_alloc = 0;
+	change = build_changes(side, &nr_change);
+	emit_hunks(side, change, nr_change, opt);
+
+	free(change);
+	for (f = 0; f < 2; f++) {
+		free(side[f].line);
+		free(side[f].changed - 1);
+	}
+	*size = out_len;
+	return out;
+}
+
+static int parse_context(const char *arg, int len,
+			 struct diff_lines_options *opt)
+{
+	int i, context = 0;
+
+	if (!len)
+		return -1;
+	for (i = 0; i < len; i++) {
+		if (!isdigit(arg[i]))
+			return -1;
+		context = context * 10 + arg[i] - '0';
+	}
+	/* like "diff", the largest one given wins */
+	if (opt->context < context)
+		opt->context = context;
+	return 0;
+}
+
+/*
+ * Can we do what GIT_DIFF_OPTS asks for ourselves?  We know the
+ * unified format with any number of context lines, with or without
+ * function names in the hunk headers; anything else is left to the
+ * external "diff".
+ */
+int diff_lines_parse_opts(const char *opts, struct diff_lines_options *opt)
+{
+	int unified = 0;
+
+	opt->context = 0;
+	opt->show_function = 0;
+	while (*opts) {
+		const char *arg = opts;
+		int len;
+
+		while (*opts && !isspace(*opts))
+			opts++;
+		len = opts - arg;
+		while (isspace(*opts))
+			opts++;
+		if (!len)
+			continue;
+
+		if (len == 9 && !strncmp(arg, "--unified", 9)) {
+			unified = 1;
+			if (opt->context < 3)
+				opt->context = 3;
+		}
+		else if (len > 10 && !strncmp(arg, "--unified=", 10)) {
+			unified = 1;
+			if (parse_context(arg + 10, len - 10, opt))
+				return -1;
+		}
+		else if (len == 17 && !strncmp(arg, "--show-c-function", 17))
+			opt->show_function = 1;
+		else if (len >= 2 && !strncmp(arg, "-U", 2)) {
+			unified = 1;
+			if (len == 2) {
+				/* "-U 5" */
+				arg = opts;
+				while (*opts && !isspace(*opts))
+					opts++;
+				if (parse_context(arg, opts - arg, opt))
+					return -1;
+			}
+			else if (parse_context(arg + 2, len - 2, opt))
+				return -1;
+		}
+		else if (len >= 2 && arg[0] == '-' && arg[1] != '-') {
+			int i;
+			for (i = 1; i < len; i++) {
+				if (arg[i] == 'u') {
+					unified = 1;
+					if (opt->context < 3)
+						opt->context = 3;
+				}
+				else if (arg[i] == 'p')
+					opt->show_function = 1;
+				else
+					return -1;
+			}
+		}
+		else
+			return -1;
+	}
+	return unified ? 0 : -1;
+}
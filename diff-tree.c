@@ -7,6 +7,7 @@ static int no_commit_id = 0;
 static int verbose_header = 0;
 static int ignore_merges = 1;
 static int read_stdin = 0;
+static char stdout_buffer[65536];
 
 static const char *header = NULL;
 static const char *header_prefix = "";
@@ -113,10 +114,18 @@ static int diff_tree_commit(const unsigned char *commit_sha1)
 
 	for (parents = commit->parents; parents; parents = parents->next) {
 		struct commit *parent = parents->item;
+		const unsigned char *parent_tree = parent->object.sha1;
+
+		/*
+		 * Name the trees themselves, so that the parent tree is
+		 * found in the tree cache when it is our next input.
+		 */
+		if (!parse_commit(parent))
+			parent_tree = parent->tree->object.sha1;
 		header = generate_header(sha1,
 					 parent->object.sha1,
 					 commit->buffer);
-		diff_tree_sha1_top(parent->object.sha1, commit_sha1, "");
+		diff_tree_sha1_top(parent_tree, commit->tree->object.sha1, "");
 		if (!header && verbose_header) {
 			header_prefix = "\ndiff-tree ";
 			/*
@@ -245,9 +254,17 @@ int main(int argc, const char **argv)
 	if (diff_options.output_format == DIFF_FORMAT_PATCH)
 		diff_options.recursive = 1;
 
+	if (read_stdin && diff_options.detect_rename)
+		diff_options.setup |= (DIFF_SETUP_USE_SIZE_CACHE |
+				       DIFF_SETUP_USE_CACHE);
+
 	diff_tree_setup_paths(get_pathspec(prefix, argv));
 	diff_setup_done(&diff_options);
 
+	/* Nobody is waiting for each commit; write in large blocks */
+	if (read_stdin && !isatty(1))
+		setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+
 	switch (nr_sha1) {
 	case 0:
 		if (!read_stdin)
@@ -264,9 +281,6 @@ int main(int argc, const char **argv)
 	if (!read_stdin)
 		return 0;
 
-	if (diff_options.detect_rename)
-		diff_options.setup |= (DIFF_SETUP_USE_SIZE_CACHE |
-				       DIFF_SETUP_USE_CACHE);
 	while (fgets(line, sizeof(line), stdin))
 		diff_tree_stdin(line);
 
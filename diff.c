@@ -8,12 +8,21 @@
 #include "quote.h"
 #include "diff.h"
 #include "diffcore.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
+#ifdef USE_MEMFD
+#include <sys/syscall.h>
+#endif
 
 static const char *diff_opts = "-pu";
+static struct diff_lines_options builtin_opts;
+static int builtin_opts_ok;
 
 static int use_size_cache;
 
 int diff_rename_limit_default = -1;
+int diff_threads;
 
 int git_diff_config(const char *var, const char *value)
 {
@@ -21,6 +30,24 @@ int git_diff_config(const char *var, const char *value)
 		diff_rename_limit_default = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.patchcachesize")) {
+		char *end;
+
+		patch_cache_size = strtoul(value ? value : "", &end, 0);
+		if (!strcasecmp(end, "k"))
+			patch_cache_size <<= 10;
+		else if (!strcasecmp(end, "m"))
+			patch_cache_size <<= 20;
+		else if (!strcasecmp(end, "g"))
+			patch_cache_size <<= 30;
+		else if (*end || end == value)
+			die("bad config value for '%s'", var);
+		return 0;
+	}
+	if (!strcmp(var, "diff.threads")) {
+		diff_threads = git_config_int(var, value);
+		return 0;
+	}
 
 	return git_default_config(var, value);
 }
@@ -87,6 +114,7 @@ static const char *external_diff(void)
 	/* In case external diff fails... */
 	env_diff_opts = getenv("GIT_DIFF_OPTS");
 	if (env_diff_opts) diff_opts = env_diff_opts;
+	builtin_opts_ok = !diff_lines_parse_opts(diff_opts, &builtin_opts);
 
 	done_preparing = 1;
 	return external_diff_cmd;
@@ -99,15 +127,15 @@ static struct diff_tempfile {
 	char hex[41];
 	char mode[10];
 	char tmp_path[TEMPFILE_PATH_LEN];
+	int fd;		  /* tmp_path is /dev/fd/<fd>, not a file */
 } diff_temp[2];
 
-static int count_lines(const char *filename)
+static int count_lines(const char *data, int size)
 {
-	FILE *in;
 	int count, ch, completely_empty = 1, nl_just_seen = 0;
-	in = fopen(filename, "r");
 	count = 0;
-	while ((ch = fgetc(in)) != EOF)
+	while (0 < size--) {
+		ch = *data++;
 		if (ch == '\n') {
 			count++;
 			nl_just_seen = 1;
@@ -117,7 +145,7 @@ static int count_lines(const char *filename)
 			nl_just_seen = 0;
 			completely_empty = 0;
 		}
-	fclose(in);
+	}
 	if (completely_empty)
 		return 0;
 	if (!nl_just_seen)
@@ -140,12 +168,11 @@ static void print_line_count(int count)
 	}
 }
 
-static void copy_file(int prefix, const char *filename)
+static void copy_file(int prefix, const char *data, int size)
 {
-	FILE *in;
 	int ch, nl_just_seen = 1;
-	in = fopen(filename, "r");
-	while ((ch = fgetc(in)) != EOF) {
+	while (0 < size--) {
+		ch = *data++;
 		if (nl_just_seen)
 			putchar(prefix);
 		putchar(ch);
@@ -154,35 +181,77 @@ static void copy_file(int prefix, const char *filename)
 		else
 			nl_just_seen = 0;
 	}
-	fclose(in);
 	if (!nl_just_seen)
 		printf("\n\\ No newline at end of file\n");
 }
 
 static void emit_rewrite_diff(const char *name_a,
 			      const char *name_b,
-			      struct diff_tempfile *temp)
+			      struct diff_filespec *one,
+			      struct diff_filespec *two)
 {
-	/* Use temp[i].name as input, name_a and name_b as labels */
 	int lc_a, lc_b;
-	lc_a = count_lines(temp[0].name);
-	lc_b = count_lines(temp[1].name);
+	lc_a = count_lines(one->data, one->size);
+	lc_b = count_lines(two->data, two->size);
 	printf("--- %s\n+++ %s\n@@ -", name_a, name_b);
 	print_line_count(lc_a);
 	printf(" +");
 	print_line_count(lc_b);
 	printf(" @@\n");
 	if (lc_a)
-		copy_file('-', temp[0].name);
+		copy_file('-', one->data, one->size);
 	if (lc_b)
-		copy_file('+', temp[1].name);
+		copy_file('+', two->data, two->size);
 }
 
-static void builtin_diff(const char *name_a,
-			 const char *name_b,
-			 struct diff_tempfile *temp,
-			 const char *xfrm_msg,
-			 int complete_rewrite)
+/*
+ * Show the "diff --git" header and the extended header lines; returns
+ * 0 if the contents of the two sides should not be compared.
+ */
+static int show_diff_header(const char *name_a, const char *name_b,
+			    const char *mode_a, const char *mode_b,
+			    const char *xfrm_msg)
+{
+	printf("diff --git %s %s\n",
+	       quote_two("a/", name_a), quote_two("b/", name_b));
+	if (!mode_a) {
+		/* dev/null */
+		printf("new file mode %s\n", mode_b);
+		if (xfrm_msg && xfrm_msg[0])
+			puts(xfrm_msg);
+	}
+	else if (!mode_b) {
+		printf("deleted file mode %s\n", mode_a);
+		if (xfrm_msg && xfrm_msg[0])
+			puts(xfrm_msg);
+	}
+	else {
+		if (strcmp(mode_a, mode_b)) {
+			printf("old mode %s\n", mode_a);
+			printf("new mode %s\n", mode_b);
+		}
+		if (xfrm_msg && xfrm_msg[0])
+			puts(xfrm_msg);
+		if (strncmp(mode_a, mode_b, 3))
+			/* we do not run diff between different kind
+			 * of objects.
+			 */
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Run "diff" on the temporary files, for GIT_DIFF_OPTS that
+ * the built-in diff does not understand.
+ */
+static void exec_diff(const char *name_a,
+		      const char *name_b,
+		      struct diff_tempfile *temp,
+		      struct diff_filespec *one,
+		      struct diff_filespec *two,
+		      const char *xfrm_msg,
+		      int complete_rewrite)
 {
 	int i, next_at, cmd_size;
 	const char *const diff_cmd = "diff -L%s -L%s";
@@ -222,39 +291,133 @@ static void builtin_diff(const char *name_a,
 	next_at += snprintf(cmd+next_at, cmd_size-next_at,
 			    diff_arg, input_name_sq[0], input_name_sq[1]);
 
-	printf("diff --git %s %s\n",
-	       quote_two("a/", name_a), quote_two("b/", name_b));
-	if (label_path[0][0] == '/') {
-		/* dev/null */
-		printf("new file mode %s\n", temp[1].mode);
-		if (xfrm_msg && xfrm_msg[0])
-			puts(xfrm_msg);
-	}
-	else if (label_path[1][0] == '/') {
-		printf("deleted file mode %s\n", temp[0].mode);
-		if (xfrm_msg && xfrm_msg[0])
-			puts(xfrm_msg);
+	if (!show_diff_header(name_a, name_b,
+			      label_path[0][0] == '/' ? NULL : temp[0].mode,
+			      label_path[1][0] == '/' ? NULL : temp[1].mode,
+			      xfrm_msg))
+		exit(0);
+	if (complete_rewrite &&
+	    label_path[0][0] != '/' && label_path[1][0] != '/') {
+		if (diff_populate_filespec(one, 0) ||
+		    diff_populate_filespec(two, 0))
+			die("cannot read data blob for %s", name_a);
+		emit_rewrite_diff(name_a, name_b, one, two);
+		exit(0);
 	}
-	else {
-		if (strcmp(temp[0].mode, temp[1].mode)) {
-			printf("old mode %s\n", temp[0].mode);
-			printf("new mode %s\n", temp[1].mode);
+	fflush(NULL);
+	execlp("/bin/sh","sh", "-c", cmd, NULL);
+}
+
+/* Roughly what "diff" looks at to decide a file is binary */
+#define FIRST_FEW_BYTES 8000
+
+static int is_binary(struct diff_filespec *one)
+{
+	unsigned long sz = one->size;
+	if (FIRST_FEW_BYTES < sz)
+		sz = FIRST_FEW_BYTES;
+	return !!memchr(one->data, 0, sz);
+}
+
+/*
+ * Produce what exec_diff() would, without running anything: the
+ * sides are compared in core, straight from the filespecs.
+ */
+static void show_hunks(const char *label_a, const char *label_b,
+		       const char *hunks, unsigned long size)
+{
+	if (!size)
+		return;
+	printf("--- %s\n+++ %s\n", label_a, label_b);
+	fwrite(hunks, size, 1, stdout);
+}
+
+static void builtin_diff(const char *name_a,
+			 const char *name_b,
+			 struct diff_filespec *one,
+			 struct diff_filespec *two,
+			 const char *xfrm_msg,
+			 int complete_rewrite)
+{
+	static struct diff_filespec null_spec = { .data = "" };
+	char mode[2][10], *label[2], cache_key[50], *hunks;
+	struct diff_filespec *spec[2];
+	unsigned long size;
+	int i;
+
+	/* Patches between two blobs are worth keeping */
+	cache_key[0] = 0;
+	if (patch_cache_size && !complete_rewrite &&
+	    DIFF_FILE_VALID(one) && one->sha1_valid &&
+	    DIFF_FILE_VALID(two) && two->sha1_valid &&
+	    memcmp(one->sha1, two->sha1, 20)) {
+		sprintf(cache_key, "-U%d%s", builtin_opts.context,
+			builtin_opts.show_function ? " -p" : "");
+		hunks = read_patch_cache(one->sha1, two->sha1,
+					 cache_key, &size);
+		if (hunks) {
+			sprintf(mode[0], "%06o", one->mode);
+			sprintf(mode[1], "%06o", two->mode);
+			label[0] = quote_two("a/", name_a);
+			label[1] = quote_two("b/", name_b);
+			if (show_diff_header(name_a, name_b,
+					     mode[0], mode[1], xfrm_msg))
+				show_hunks(label[0], label[1], hunks, size);
+			free(hunks);
+			free(label[0]);
+			free(label[1]);
+			return;
 		}
-		if (xfrm_msg && xfrm_msg[0])
-			puts(xfrm_msg);
-		if (strncmp(temp[0].mode, temp[1].mode, 3))
-			/* we do not run diff between different kind
-			 * of objects.
-			 */
-			exit(0);
-		if (complete_rewrite) {
-			fflush(NULL);
-			emit_rewrite_diff(name_a, name_b, temp);
-			exit(0);
+	}
+
+	spec[0] = one;
+	spec[1] = two;
+	for (i = 0; i < 2; i++) {
+		label[i] = NULL;
+		if (DIFF_FILE_VALID(spec[i])) {
+			if (diff_populate_filespec(spec[i], 0))
+				die("unable to read files to diff");
+			label[i] = quote_two(i ? "b/" : "a/",
+					     i ? name_b : name_a);
+			sprintf(mode[i], "%06o", spec[i]->mode);
 		}
+		else
+			/* like diffing against /dev/null */
+			spec[i] = &null_spec;
 	}
-	fflush(NULL);
-	execlp("/bin/sh","sh", "-c", cmd, NULL);
+
+	if (!show_diff_header(name_a, name_b,
+			      label[0] ? mode[0] : NULL,
+			      label[1] ? mode[1] : NULL,
+			      xfrm_msg))
+		goto free_and_return;
+	if (label[0] && label[1] && complete_rewrite) {
+		emit_rewrite_diff(name_a, name_b, spec[0], spec[1]);
+		goto free_and_return;
+	}
+	if (spec[0]->size == spec[1]->size &&
+	    !memcmp(spec[0]->data, spec[1]->data, spec[0]->size))
+		goto free_and_return;
+	if (is_binary(spec[0]) || is_binary(spec[1])) {
+		printf("Binary files %s and %s differ\n",
+		       label[0] ? label[0] : "/dev/null",
+		       label[1] ? label[1] : "/dev/null");
+		goto free_and_return;
+	}
+	hunks = diff_lines(spec[0]->data, spec[0]->size,
+			   spec[1]->data, spec[1]->size,
+			   &builtin_opts, &size);
+	if (cache_key[0] && label[0] && label[1])
+		write_patch_cache(one->sha1, two->sha1, cache_key,
+				  hunks, size);
+	show_hunks(label[0] ? label[0] : "/dev/null",
+		   label[1] ? label[1] : "/dev/null",
+		   hunks, size);
+	free(hunks);
+
+ free_and_return:
+	free(label[0]);
+	free(label[1]);
 }
 
 struct diff_filespec *alloc_filespec(const char *path)
@@ -327,6 +490,7 @@ static struct sha1_size_cache {
 	unsigned long size;
 } **sha1_size_cache;
 static int sha1_size_cache_nr, sha1_size_cache_alloc;
+static int size_cache_dirty;
 
 static struct sha1_size_cache *locate_size_cache(unsigned char *sha1,
 						 int find_only,
@@ -368,15 +532,137 @@ static struct sha1_size_cache *locate_size_cache(unsigned char *sha1,
 	sha1_size_cache[first] = e;
 	memcpy(e->sha1, sha1, 20);
 	e->size = size;
+	size_cache_dirty = 1;
 	return e;
 }
 
+/*
+ * The size cache is kept in $GIT_DIR/size-cache between runs.  After
+ * a 4-byte signature, each entry is a 20-byte object name followed by
+ * the size in 4 bytes of network byte order, in the same order as
+ * sha1_size_cache[] keeps them.
+ */
+#define SIZE_CACHE_SIGNATURE 0x44535a43	/* "DSZC" */
+#define SIZE_CACHE_ENTRY 24
+
+static void read_size_cache(void)
+{
+	struct sha1_size_cache *e;
+	unsigned char *map;
+	struct stat st;
+	int fd, i, nr;
+
+	fd = open(git_path("size-cache"), O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || st.st_size < 4 ||
+	    (st.st_size - 4) % SIZE_CACHE_ENTRY) {
+		close(fd);
+		return;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+	nr = (st.st_size - 4) / SIZE_CACHE_ENTRY;
+	if (ntohl(*(unsigned int *)map) != SIZE_CACHE_SIGNATURE || !nr) {
+		munmap(map, st.st_size);
+		return;
+	}
+
+	e = xmalloc(nr * sizeof(*e));
+	sha1_size_cache_alloc = sha1_size_cache_nr + nr;
+	sha1_size_cache = xrealloc(sha1_size_cache,
+				   sha1_size_cache_alloc *
+				   sizeof(*sha1_size_cache));
+	for (i = 0; i < nr; i++, e++) {
+		unsigned char *ent = map + 4 + i * SIZE_CACHE_ENTRY;
+		unsigned int size;
+
+		memcpy(&size, ent + 20, 4);
+		/* entries in the file are sorted; stop at a broken one */
+		if (i && memcmp(ent - SIZE_CACHE_ENTRY, ent, 20) <= 0)
+			break;
+		memcpy(e->sha1, ent, 20);
+		e->size = ntohl(size);
+		sha1_size_cache[sha1_size_cache_nr++] = e;
+	}
+	munmap(map, st.st_size);
+	size_cache_dirty = 0;
+}
+
+static void write_size_cache(void)
+{
+	char tmp[PATH_MAX];
+	unsigned char *buf, *ent;
+	unsigned long len, done;
+	unsigned int sig;
+	ssize_t n;
+	int fd, i;
+
+	if (!size_cache_dirty)
+		return;
+	if (strlen(git_path("size-cache")) + 8 > sizeof(tmp))
+		return;
+	sprintf(tmp, "%s.XXXXXX", git_path("size-cache"));
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+
+	ent = buf = xmalloc(4 + sha1_size_cache_nr * SIZE_CACHE_ENTRY);
+	sig = htonl(SIZE_CACHE_SIGNATURE);
+	memcpy(ent, &sig, 4);
+	ent += 4;
+	for (i = 0; i < sha1_size_cache_nr; i++) {
+		struct sha1_size_cache *e = sha1_size_cache[i];
+		unsigned int size = htonl(e->size);
+
+		if (e->size != (unsigned int)e->size)
+			continue;
+		memcpy(ent, e->sha1, 20);
+		memcpy(ent + 20, &size, 4);
+		ent += SIZE_CACHE_ENTRY;
+	}
+	len = ent - buf;
+	for (done = 0; done < len; done += n) {
+		n = xwrite(fd, buf + done, len - done);
+		if (n <= 0)
+			break;
+	}
+	free(buf);
+	if (close(fd) || done != len || rename(tmp, git_path("size-cache")))
+		unlink(tmp);
+}
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t populate_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static int populate_filespec(struct diff_filespec *s, int size_only);
+
 /*
  * While doing rename detection and pickaxe operation, we may need to
  * grab the data for the blob (or file) for our own in-core comparison.
  * diff_filespec has data and size fields for this purpose.
+ *
+ * This may be called from diff_parallel() workers; the object store
+ * is not thread safe, so only one of them reads at a time.
  */
 int diff_populate_filespec(struct diff_filespec *s, int size_only)
+{
+	int ret;
+
+#ifndef NO_PTHREADS
+	pthread_mutex_lock(&populate_lock);
+#endif
+	ret = populate_filespec(s, size_only);
+#ifndef NO_PTHREADS
+	pthread_mutex_unlock(&populate_lock);
+#endif
+	return ret;
+}
+
+static int populate_filespec(struct diff_filespec *s, int size_only)
 {
 	int err = 0;
 	if (!DIFF_FILE_VALID(s))
@@ -438,17 +724,87 @@ int diff_populate_filespec(struct diff_filespec *s, int size_only)
 				s->size = e->size;
 				return 0;
 			}
-			if (!sha1_object_info(s->sha1, type, &s->size))
-				locate_size_cache(s->sha1, 0, s->size);
+			if (sha1_object_size(s->sha1, &s->size))
+				return -1;
+			locate_size_cache(s->sha1, 0, s->size);
 		}
 		else {
 			s->data = read_sha1_file(s->sha1, type, &s->size);
+			if (!s->data)
+				return -1;
 			s->should_free = 1;
 		}
 	}
 	return 0;
 }
 
+#ifndef NO_PTHREADS
+struct parallel_job {
+	pthread_mutex_t lock;
+	int nr, next;
+	void (*fn)(int, void *);
+	void *data;
+};
+
+static void *parallel_worker(void *job_)
+{
+	struct parallel_job *job = job_;
+
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (job->nr <= i)
+			return NULL;
+		job->fn(i, job->data);
+	}
+}
+#endif
+
+/*
+ * Call fn(i, data) for 0 <= i < nr, on as many threads as diff.threads
+ * says (by default, one per processor).  Each call must only write to
+ * its own slot of the result, so that the outcome does not depend on
+ * the number of threads or on the order the calls are made in.
+ */
+void diff_parallel(int nr, void (*fn)(int, void *), void *data)
+{
+	int i;
+#ifndef NO_PTHREADS
+	int nr_threads = diff_threads;
+
+	if (nr_threads <= 0)
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr < nr_threads)
+		nr_threads = nr;
+	if (1 < nr_threads) {
+		pthread_t *thread = xmalloc((nr_threads - 1) * sizeof(*thread));
+		struct parallel_job job;
+		int started;
+
+		pthread_mutex_init(&job.lock, NULL);
+		job.nr = nr;
+		job.next = 0;
+		job.fn = fn;
+		job.data = data;
+		for (started = 0; started < nr_threads - 1; started++)
+			if (pthread_create(&thread[started], NULL,
+					   parallel_worker, &job))
+				break;
+		parallel_worker(&job);
+		for (i = 0; i < started; i++)
+			pthread_join(thread[i], NULL);
+		pthread_mutex_destroy(&job.lock);
+		free(thread);
+		return;
+	}
+#endif
+	for (i = 0; i < nr; i++)
+		fn(i, data);
+}
+
 void diff_free_filespec_data(struct diff_filespec *s)
 {
 	if (s->should_free)
@@ -459,6 +815,33 @@ void diff_free_filespec_data(struct diff_filespec *s)
 	s->data = NULL;
 }
 
+#ifdef USE_MEMFD
+/*
+ * Give the blob to the external diff as /dev/fd/<n> of an in-core
+ * file, which it inherits, instead of writing it out to $TMPDIR.
+ */
+static int prep_memfd_blob(struct diff_tempfile *temp,
+			   void *blob, unsigned long size)
+{
+	int fd = syscall(SYS_memfd_create, "git-diff", 0);
+	unsigned long done;
+
+	if (fd < 0)
+		return -1;
+	for (done = 0; done < size; ) {
+		ssize_t n = xwrite(fd, (char *) blob + done, size - done);
+		if (n <= 0)
+			die("unable to write in-core file: %s",
+			    strerror(errno));
+		done += n;
+	}
+	lseek(fd, 0, SEEK_SET);
+	temp->fd = fd;
+	sprintf(temp->tmp_path, "/dev/fd/%d", fd);
+	return 0;
+}
+#endif
+
 static void prep_temp_blob(struct diff_tempfile *temp,
 			   void *blob,
 			   unsigned long size,
@@ -467,12 +850,19 @@ static void prep_temp_blob(struct diff_tempfile *temp,
 {
 	int fd;
 
-	fd = git_mkstemp(temp->tmp_path, TEMPFILE_PATH_LEN, ".diff_XXXXXX");
-	if (fd < 0)
-		die("unable to create temp-file");
-	if (write(fd, blob, size) != size)
-		die("unable to write temp-file");
-	close(fd);
+	temp->fd = -1;
+#ifdef USE_MEMFD
+	if (prep_memfd_blob(temp, blob, size))
+#endif
+	{
+		fd = git_mkstemp(temp->tmp_path, TEMPFILE_PATH_LEN,
+				 ".diff_XXXXXX");
+		if (fd < 0)
+			die("unable to create temp-file");
+		if (write(fd, blob, size) != size)
+			die("unable to write temp-file");
+		close(fd);
+	}
 	temp->name = temp->tmp_path;
 	strcpy(temp->hex, sha1_to_hex(sha1));
 	temp->hex[40] = 0;
@@ -547,7 +937,10 @@ static void remove_tempfile(void)
 
 	for (i = 0; i < 2; i++)
 		if (diff_temp[i].name == diff_temp[i].tmp_path) {
-			unlink(diff_temp[i].name);
+			if (0 <= diff_temp[i].fd)
+				close(diff_temp[i].fd);
+			else
+				unlink(diff_temp[i].name);
 			diff_temp[i].name = NULL;
 		}
 }
@@ -578,6 +971,11 @@ static void run_external_diff(const char *pgm,
 	const char *othername;
 
 	othername = (other? other : name);
+	if (!pgm && one && two && builtin_opts_ok) {
+		builtin_diff(name, othername, one, two, xfrm_msg,
+			     complete_rewrite);
+		return;
+	}
 	if (one && two) {
 		prepare_temp_file(name, &temp[0], one);
 		prepare_temp_file(othername, &temp[1], two);
@@ -621,8 +1019,8 @@ static void run_external_diff(const char *pgm,
 		 * otherwise we use the built-in one.
 		 */
 		if (one && two)
-			builtin_diff(name, othername, temp, xfrm_msg,
-				     complete_rewrite);
+			exec_diff(name, othername, temp, one, two, xfrm_msg,
+				  complete_rewrite);
 		else
 			printf("* Unmerged path %s\n", name);
 		exit(0);
@@ -791,8 +1189,11 @@ int diff_setup_done(struct diff_options *options)
 			 */
 			read_cache();
 	}
-	if (options->setup & DIFF_SETUP_USE_SIZE_CACHE)
+	if ((options->setup & DIFF_SETUP_USE_SIZE_CACHE) && !use_size_cache) {
 		use_size_cache = 1;
+		read_size_cache();
+		atexit(write_size_cache);
+	}
 	if (options->abbrev <= 0 || 40 < options->abbrev)
 		options->abbrev = 40; /* full */
 
@@ -825,7 +1226,9 @@ int diff_opt_parse(struct diff_options *options, const char **av, int ac)
 	else if (!strncmp(arg, "--diff-filter=", 14))
 		options->filter = arg + 14;
 	else if (!strcmp(arg, "--pickaxe-all"))
-		options->pickaxe_opts = DIFF_PICKAXE_ALL;
+		options->pickaxe_opts |= DIFF_PICKAXE_ALL;
+	else if (!strcmp(arg, "--pickaxe-regex"))
+		options->pickaxe_opts |= DIFF_PICKAXE_REGEX;
 	else if (!strncmp(arg, "-B", 2)) {
 		if ((options->break_opt =
 		     diff_scoreopt_parse(arg)) == -1)
@@ -87,6 +87,7 @@ extern int diff_setup_done(struct diff_options *);
 #define DIFF_DETECT_COPY	2
 
 #define DIFF_PICKAXE_ALL	1
+#define DIFF_PICKAXE_REGEX	2
 
 #define DIFF_DEFAULT_INDEX_ABBREV	7 /* hex digits */
 #define DIFF_DEFAULT_ABBREV	7 /* hex digits */
@@ -114,7 +115,9 @@ extern void diffcore_std_no_resolve(struct diff_options *);
 "  -O<file>      reorder diffs according to the <file>.\n" \
 "  -S<string>    find filepair whose only one side contains the string.\n" \
 "  --pickaxe-all\n" \
-"                show all files diff when -S is used and hit is found.\n"
+"                show all files diff when -S is used and hit is found.\n" \
+"  --pickaxe-regex\n" \
+"                treat the <string> given to -S as an extended regex.\n"
 
 extern int diff_queue_is_empty(void);
 
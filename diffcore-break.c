@@ -108,6 +108,33 @@ static int should_break(struct diff_filespec *src,
 	return to_break;
 }
 
+struct break_job {
+	struct diff_queue_struct *q;
+	int break_score;
+	struct break_result {
+		int to_break;
+		int merge_score;
+	} *result;
+};
+
+/* Decide whether to break one pair in the queue, for diff_parallel() */
+static void break_one(int i, void *job_)
+{
+	struct break_job *job = job_;
+	struct diff_filepair *p = job->q->queue[i];
+	struct break_result *r = &job->result[i];
+
+	/* We deal only with in-place edit of non directory.
+	 * We do not break anything else.
+	 */
+	r->to_break = r->merge_score = 0;
+	if (DIFF_FILE_VALID(p->one) && DIFF_FILE_VALID(p->two) &&
+	    !S_ISDIR(p->one->mode) && !S_ISDIR(p->two->mode) &&
+	    !strcmp(p->one->path, p->two->path))
+		r->to_break = should_break(p->one, p->two, job->break_score,
+					   &r->merge_score);
+}
+
 void diffcore_break(int break_score)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
@@ -145,6 +172,7 @@ void diffcore_break(int break_score)
 	 * together).
 	 */
 	int merge_score;
+	struct break_job job;
 	int i;
 
 	/* See comment on DEFAULT_BREAK_SCORE and
@@ -161,51 +189,52 @@ void diffcore_break(int break_score)
 	outq.nr = outq.alloc = 0;
 	outq.queue = NULL;
 
+	/* The pairs are examined independently of each other, maybe
+	 * in parallel, before the queue is rebuilt in order.
+	 */
+	job.q = q;
+	job.break_score = break_score;
+	job.result = xmalloc(q->nr * sizeof(*job.result));
+	diff_parallel(q->nr, break_one, &job);
+
 	for (i = 0; i < q->nr; i++) {
 		struct diff_filepair *p = q->queue[i];
-		int score;
-
-		/* We deal only with in-place edit of non directory.
-		 * We do not break anything else.
-		 */
-		if (DIFF_FILE_VALID(p->one) && DIFF_FILE_VALID(p->two) &&
-		    !S_ISDIR(p->one->mode) && !S_ISDIR(p->two->mode) &&
-		    !strcmp(p->one->path, p->two->path)) {
-			if (should_break(p->one, p->two,
-					 break_score, &score)) {
-				/* Split this into delete and create */
-				struct diff_filespec *null_one, *null_two;
-				struct diff_filepair *dp;
-
-				/* Set score to 0 for the pair that
-				 * needs to be merged back together
-				 * should they survive rename/copy.
-				 * Also we do not want to break very
-				 * small files.
-				 */
-				if (score < merge_score)
-					score = 0;
-
-				/* deletion of one */
-				null_one = alloc_filespec(p->one->path);
-				dp = diff_queue(&outq, p->one, null_one);
-				dp->score = score;
-				dp->broken_pair = 1;
-
-				/* creation of two */
-				null_two = alloc_filespec(p->two->path);
-				dp = diff_queue(&outq, null_two, p->two);
-				dp->score = score;
-				dp->broken_pair = 1;
-
-				free(p); /* not diff_free_filepair(), we are
-					  * reusing one and two here.
-					  */
-				continue;
-			}
+		int score = job.result[i].merge_score;
+
+		if (job.result[i].to_break) {
+			/* Split this into delete and create */
+			struct diff_filespec *null_one, *null_two;
+			struct diff_filepair *dp;
+
+			/* Set score to 0 for the pair that
+			 * needs to be merged back together
+			 * should they survive rename/copy.
+			 * Also we do not want to break very
+			 * small files.
+			 */
+			if (score < merge_score)
+				score = 0;
+
+			/* deletion of one */
+			null_one = alloc_filespec(p->one->path);
+			dp = diff_queue(&outq, p->one, null_one);
+			dp->score = score;
+			dp->broken_pair = 1;
+
+			/* creation of two */
+			null_two = alloc_filespec(p->two->path);
+			dp = diff_queue(&outq, null_two, p->two);
+			dp->score = score;
+			dp->broken_pair = 1;
+
+			free(p); /* not diff_free_filepair(), we are
+				  * reusing one and two here.
+				  */
+			continue;
 		}
 		diff_q(&outq, p);
 	}
+	free(job.result);
 	free(q->queue);
 	*q = outq;
 
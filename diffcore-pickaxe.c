@@ -5,41 +5,140 @@
 #include "diff.h"
 #include "diffcore.h"
 
-static unsigned int contains(struct diff_filespec *one,
-			     const char *needle, unsigned long len)
+#include <regex.h>
+
+/*
+ * The same needle is looked for in every filespec of every commit,
+ * so the searcher is prepared once and kept around.
+ */
+static struct pickaxe {
+	char *needle;
+	unsigned long len;
+	int opts;
+	regex_t regex;
+	unsigned long skip[256];	/* Horspool bad character shifts */
+} pickaxe;
+
+static void prepare_pickaxe(const char *needle, int opts)
 {
-	unsigned int cnt;
-	unsigned long offset, sz;
-	const char *data;
-	if (diff_populate_filespec(one, 0))
+	unsigned long i, len = strlen(needle);
+
+	if (pickaxe.needle && !strcmp(pickaxe.needle, needle) &&
+	    pickaxe.opts == opts)
+		return;
+	if (pickaxe.needle) {
+		if (pickaxe.opts & DIFF_PICKAXE_REGEX)
+			regfree(&pickaxe.regex);
+		free(pickaxe.needle);
+	}
+	pickaxe.needle = strdup(needle);
+	pickaxe.len = len;
+	pickaxe.opts = opts;
+
+	if (opts & DIFF_PICKAXE_REGEX) {
+		int err = regcomp(&pickaxe.regex, needle,
+				  REG_EXTENDED | REG_NEWLINE);
+		if (err) {
+			char errbuf[1024];
+			regerror(err, &pickaxe.regex, errbuf, sizeof(errbuf));
+			die("invalid pickaxe regex: %s", errbuf);
+		}
+		return;
+	}
+	for (i = 0; i < 256; i++)
+		pickaxe.skip[i] = len;
+	for (i = 0; i + 1 < len; i++)
+		pickaxe.skip[(unsigned char)needle[i]] = len - 1 - i;
+}
+
+static unsigned int count_regex(const char *data, unsigned long sz)
+{
+	unsigned int cnt = 0;
+	regmatch_t match;
+	char *buf, *cp;
+	int flags = 0;
+
+	/* *data may not be NUL terminated */
+	buf = xmalloc(sz + 1);
+	memcpy(buf, data, sz);
+	buf[sz] = 0;
+	cp = buf;
+	while (*cp && !regexec(&pickaxe.regex, cp, 1, &match, flags)) {
+		cnt++;
+		/* we count non-overlapping matches */
+		cp += match.rm_eo ? match.rm_eo : 1;
+		flags = REG_NOTBOL;
+	}
+	free(buf);
+	return cnt;
+}
+
+static unsigned int count_fixed(const char *data, unsigned long sz)
+{
+	const unsigned char *needle = (const unsigned char *)pickaxe.needle;
+	const unsigned char *buf = (const unsigned char *)data;
+	unsigned long len = pickaxe.len, offset = 0;
+	unsigned char first, last;
+	unsigned int cnt = 0;
+
+	if (!len || sz < len)
 		return 0;
+	first = needle[0];
+	last = needle[len - 1];
+
+	/* Short needles: let memchr() find the candidates */
+	if (len < 4) {
+		while (offset + len <= sz) {
+			const unsigned char *p;
+
+			p = memchr(buf + offset, first, sz - len + 1 - offset);
+			if (!p)
+				break;
+			offset = p - buf;
+			if (!memcmp(p, needle, len)) {
+				cnt++;
+				offset += len;
+			}
+			else
+				offset++;
+		}
+		return cnt;
+	}
 
-	sz = one->size;
-	data = one->data;
-	cnt = 0;
-
-	/* Yes, I've heard of strstr(), but the thing is *data may
-	 * not be NUL terminated.  Sue me.
-	 */
-	for (offset = 0; offset + len <= sz; offset++) {
-		/* we count non-overlapping occurrences of needle */
-		if (!memcmp(needle, data + offset, len)) {
-			offset += len - 1;
+	/* Boyer-Moore-Horspool */
+	while (offset + len <= sz) {
+		unsigned char c = buf[offset + len - 1];
+
+		if (c == last && buf[offset] == first &&
+		    !memcmp(buf + offset + 1, needle + 1, len - 2)) {
+			/* we count non-overlapping occurrences of needle */
 			cnt++;
+			offset += len;
 		}
+		else
+			offset += pickaxe.skip[c];
 	}
 	return cnt;
 }
 
+static unsigned int contains(struct diff_filespec *one)
+{
+	if (diff_populate_filespec(one, 0))
+		return 0;
+	if (pickaxe.opts & DIFF_PICKAXE_REGEX)
+		return count_regex(one->data, one->size);
+	return count_fixed(one->data, one->size);
+}
+
 void diffcore_pickaxe(const char *needle, int opts)
 {
 	struct diff_queue_struct *q = &diff_queued_diff;
-	unsigned long len = strlen(needle);
 	int i, has_changes;
 	struct diff_queue_struct outq;
 	outq.queue = NULL;
 	outq.nr = outq.alloc = 0;
 
+	prepare_pickaxe(needle, opts);
 	if (opts & DIFF_PICKAXE_ALL) {
 		/* Showing the whole changeset if needle exists */
 		for (i = has_changes = 0; !has_changes && i < q->nr; i++) {
@@ -48,16 +147,16 @@ void diffcore_pickaxe(const char *needle, int opts)
 				if (!DIFF_FILE_VALID(p->two))
 					continue; /* ignore unmerged */
 				/* created */
-				if (contains(p->two, needle, len))
+				if (contains(p->two))
 					has_changes++;
 			}
 			else if (!DIFF_FILE_VALID(p->two)) {
-				if (contains(p->one, needle, len))
+				if (contains(p->one))
 					has_changes++;
 			}
 			else if (!diff_unmodified_pair(p) &&
-				 contains(p->one, needle, len) !=
-				 contains(p->two, needle, len))
+				 contains(p->one) !=
+				 contains(p->two))
 				has_changes++;
 		}
 		if (has_changes)
@@ -80,16 +179,16 @@ void diffcore_pickaxe(const char *needle, int opts)
 				if (!DIFF_FILE_VALID(p->two))
 					; /* ignore unmerged */
 				/* created */
-				else if (contains(p->two, needle, len))
+				else if (contains(p->two))
 					has_changes = 1;
 			}
 			else if (!DIFF_FILE_VALID(p->two)) {
-				if (contains(p->one, needle, len))
+				if (contains(p->one))
 					has_changes = 1;
 			}
 			else if (!diff_unmodified_pair(p) &&
-				 contains(p->one, needle, len) !=
-				 contains(p->two, needle, len))
+				 contains(p->one) !=
+				 contains(p->two))
 				has_changes = 1;
 
 			if (has_changes)
@@ -9,9 +9,12 @@
 
 /* Table of rename/copy destinations */
 
+struct signature;
+
 static struct diff_rename_dst {
 	struct diff_filespec *two;
 	struct diff_filepair *pair;
+	struct signature *sig;
 } *rename_dst;
 static int rename_dst_nr, rename_dst_alloc;
 
@@ -50,12 +53,14 @@ static struct diff_rename_dst *locate_rename_dst(struct diff_filespec *two,
 	rename_dst[first].two = alloc_filespec(two->path);
 	fill_filespec(rename_dst[first].two, two->sha1, two->mode);
 	rename_dst[first].pair = NULL;
+	rename_dst[first].sig = NULL;
 	return &(rename_dst[first]);
 }
 
 /* Table of rename/copy src files */
 static struct diff_rename_src {
 	struct diff_filespec *one;
+	struct signature *sig;
 	unsigned src_path_left : 1;
 } *rename_src;
 static int rename_src_nr, rename_src_alloc;
@@ -91,27 +96,11 @@ static struct diff_rename_src *register_rename_src(struct diff_filespec *one,
 		memmove(rename_src + first + 1, rename_src + first,
 			(rename_src_nr - first - 1) * sizeof(*rename_src));
 	rename_src[first].one = one;
+	rename_src[first].sig = NULL;
 	rename_src[first].src_path_left = src_path_left;
 	return &(rename_src[first]);
 }
 
-static int is_exact_match(struct diff_filespec *src, struct diff_filespec *dst)
-{
-	if (src->sha1_valid && dst->sha1_valid &&
-	    !memcmp(src->sha1, dst->sha1, 20))
-		return 1;
-	if (diff_populate_filespec(src, 1) || diff_populate_filespec(dst, 1))
-		return 0;
-	if (src->size != dst->size)
-		return 0;
-	if (diff_populate_filespec(src, 0) || diff_populate_filespec(dst, 0))
-		return 0;
-	if (src->size == dst->size &&
-	    !memcmp(src->data, dst->data, src->size))
-		return 1;
-	return 0;
-}
-
 struct diff_score {
 	int src; /* index in rename_src */
 	int dst; /* index in rename_dst */
@@ -147,6 +136,8 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (!S_ISREG(src->mode) || !S_ISREG(dst->mode))
 		return 0;
 
+	if (diff_populate_filespec(src, 1) || diff_populate_filespec(dst, 1))
+		return 0;
 	delta_size = ((src->size < dst->size) ?
 		      (dst->size - src->size) : (src->size - dst->size));
 	base_size = ((src->size < dst->size) ? src->size : dst->size);
@@ -202,6 +193,197 @@ static int estimate_similarity(struct diff_filespec *src,
 	return score;
 }
 
+/*
+ * A signature summarizes a file as the hashes of its chunks, each
+ * with the number of bytes it stands for, sorted by hash.  Chunks end
+ * at a newline or where a rolling hash of the last few bytes says so
+ * (about every 16 bytes, but at most 64), so an edit in the middle of
+ * a line only disturbs the chunks around it.  The number of bytes two
+ * signatures have in common is a cheap estimate of how much of the
+ * source survives in the destination; it is used to pick the few
+ * sources worth running a real delta against.
+ */
+#define RENAME_CANDIDATES 8
+
+struct chunk {
+	unsigned int hash;
+	unsigned int bytes;
+};
+
+struct signature {
+	int nr;
+	struct chunk *chunk;
+};
+
+static int chunk_compare(const void *a_, const void *b_)
+{
+	const struct chunk *a = a_, *b = b_;
+	if (a->hash == b->hash)
+		return 0;
+	return a->hash < b->hash ? -1 : 1;
+}
+
+static struct signature *make_signature(struct diff_filespec *spec)
+{
+	struct signature *sig;
+	const unsigned char *buf, *end;
+	int i, nr, alloc;
+
+	if (!S_ISREG(spec->mode) || diff_populate_filespec(spec, 0))
+		return NULL;
+	sig = xmalloc(sizeof(*sig));
+	nr = alloc = 0;
+	sig->chunk = NULL;
+	buf = spec->data;
+	end = buf + spec->size;
+	while (buf < end) {
+		unsigned int hash = 0x811c9dc5, roll = 0, bytes = 0;
+		int c;
+
+		do {
+			c = *buf++;
+			hash = (hash ^ c) * 0x01000193;
+			roll = (roll << 1) + (c + 1) * 0x9e3779b1;
+			bytes++;
+		} while (c != '\n' && (roll & 0xf0000000) && bytes < 64 &&
+			 buf < end);
+		if (nr == alloc) {
+			alloc = alloc_nr(alloc);
+			sig->chunk = xrealloc(sig->chunk,
+					      alloc * sizeof(*sig->chunk));
+		}
+		sig->chunk[nr].hash = hash;
+		sig->chunk[nr].bytes = bytes;
+		nr++;
+	}
+	qsort(sig->chunk, nr, sizeof(*sig->chunk), chunk_compare);
+	for (i = sig->nr = 0; i < nr; i++) {
+		if (sig->nr && sig->chunk[sig->nr - 1].hash == sig->chunk[i].hash)
+			sig->chunk[sig->nr - 1].bytes += sig->chunk[i].bytes;
+		else
+			sig->chunk[sig->nr++] = sig->chunk[i];
+	}
+	return sig;
+}
+
+static void free_signature(struct signature *sig)
+{
+	if (sig) {
+		free(sig->chunk);
+		free(sig);
+	}
+}
+
+/*
+ * Estimate what estimate_similarity() would say from the signatures
+ * alone.  The result is not clamped, so that candidates that are all
+ * too different can still be ranked.
+ */
+static double signature_similarity(struct diff_filespec *src,
+				   struct signature *src_sig,
+				   struct diff_filespec *dst,
+				   struct signature *dst_sig)
+{
+	unsigned long copied = 0, base_size, delta_size;
+	int i = 0, j = 0;
+
+	while (i < src_sig->nr && j < dst_sig->nr) {
+		const struct chunk *a = &src_sig->chunk[i];
+		const struct chunk *b = &dst_sig->chunk[j];
+		if (a->hash == b->hash) {
+			copied += (a->bytes < b->bytes) ? a->bytes : b->bytes;
+			i++;
+			j++;
+		}
+		else if (a->hash < b->hash)
+			i++;
+		else
+			j++;
+	}
+	base_size = (src->size < dst->size) ? src->size : dst->size;
+	if (!base_size)
+		return 0;
+	delta_size = (src->size - copied) + (dst->size - copied);
+	return MAX_SCORE - (double)MAX_SCORE * delta_size / base_size;
+}
+
+struct candidate {
+	int src;
+	double estimate;
+};
+
+static int candidate_compare(const void *a_, const void *b_)
+{
+	const struct candidate *a = a_, *b = b_;
+	return a->src - b->src;
+}
+
+/*
+ * Find the sources that look most like rename_dst[dst], best first,
+ * and return them in rename_src order.  Returns -1 when a source left
+ * out looks just as good as the last one kept; the estimates cannot
+ * tell them apart, so the caller should try them all.
+ */
+static int find_candidates(int dst, int minimum_score,
+			   struct candidate *cand)
+{
+	struct diff_rename_dst *d = &rename_dst[dst];
+	int j, k, nr = 0, tie = 0;
+
+	/*
+	 * Sizes are much cheaper to learn than signatures, so the
+	 * signatures are only made for files that pass the size check.
+	 */
+	if (!S_ISREG(d->two->mode) || diff_populate_filespec(d->two, 1))
+		return 0;
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_rename_src *s = &rename_src[j];
+		unsigned long base_size, delta_size;
+		double estimate;
+
+		if (!S_ISREG(s->one->mode) ||
+		    diff_populate_filespec(s->one, 1))
+			continue;
+		/* the same size check estimate_similarity() starts with */
+		if (s->one->size < d->two->size) {
+			base_size = s->one->size;
+			delta_size = d->two->size - base_size;
+		} else {
+			base_size = d->two->size;
+			delta_size = s->one->size - base_size;
+		}
+		if (base_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
+			continue;
+
+		if (!d->sig)
+			d->sig = make_signature(d->two);
+		if (!d->sig)
+			return 0;
+		if (!s->sig)
+			s->sig = make_signature(s->one);
+		if (!s->sig)
+			continue;
+		estimate = signature_similarity(s->one, s->sig, d->two, d->sig);
+		if (nr == RENAME_CANDIDATES) {
+			if (estimate <= cand[nr - 1].estimate) {
+				tie |= estimate == cand[nr - 1].estimate;
+				continue;
+			}
+			nr--;
+			tie = cand[nr].estimate == cand[nr - 1].estimate;
+		}
+		for (k = nr; 0 < k && cand[k - 1].estimate < estimate; k--)
+			cand[k] = cand[k - 1];
+		cand[k].src = j;
+		cand[k].estimate = estimate;
+		nr++;
+	}
+	if (tie)
+		return -1;
+	qsort(cand, nr, sizeof(*cand), candidate_compare);
+	return nr;
+}
+
 static void record_rename_pair(int dst_index, int src_index, int score)
 {
 	struct diff_filespec *one, *two, *src, *dst;
@@ -224,6 +406,105 @@ static void record_rename_pair(int dst_index, int src_index, int score)
 	rename_dst[dst_index].pair = dp;
 }
 
+/*
+ * Exact renames are found by looking up the object name of each
+ * destination in a table of the sources sorted by theirs, instead
+ * of comparing every destination with every source.
+ */
+struct exact_src {
+	unsigned char sha1[20];
+	int src;	/* index in rename_src */
+};
+
+static int spec_sha1(struct diff_filespec *spec, unsigned char *sha1)
+{
+	char hdr[50];
+	SHA_CTX c;
+
+	if (spec->sha1_valid) {
+		memcpy(sha1, spec->sha1, 20);
+		return 0;
+	}
+	if (diff_populate_filespec(spec, 0))
+		return -1;
+	SHA1_Init(&c);
+	SHA1_Update(&c, hdr, sprintf(hdr, "blob %lu", spec->size) + 1);
+	SHA1_Update(&c, spec->data, spec->size);
+	SHA1_Final(sha1, &c);
+	return 0;
+}
+
+static int exact_src_compare(const void *a_, const void *b_)
+{
+	const struct exact_src *a = a_, *b = b_;
+	int cmp = memcmp(a->sha1, b->sha1, 20);
+	if (cmp)
+		return cmp;
+	return a->src - b->src;
+}
+
+static int find_exact_renames(void)
+{
+	struct exact_src *table = xmalloc(rename_src_nr * sizeof(*table));
+	int i, nr = 0, rename_count = 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		if (spec_sha1(rename_src[i].one, table[nr].sha1))
+			continue;
+		table[nr++].src = i;
+	}
+	qsort(table, nr, sizeof(*table), exact_src_compare);
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		unsigned char sha1[20];
+		int lo = 0, hi = nr;
+
+		if (spec_sha1(rename_dst[i].two, sha1))
+			continue;
+		/* the first source with this content, as the old
+		 * one-by-one comparison would have picked.
+		 */
+		while (lo < hi) {
+			int mi = (lo + hi) / 2;
+			if (memcmp(table[mi].sha1, sha1, 20) < 0)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		if (lo < nr && !memcmp(table[lo].sha1, sha1, 20)) {
+			record_rename_pair(i, table[lo].src, MAX_SCORE);
+			rename_count++;
+		}
+	}
+	free(table);
+	return rename_count;
+}
+
+
+struct score_job {
+	struct diff_score *mx;
+	int *row;		/* where each destination's entries begin */
+	int minimum_score;
+};
+
+/*
+ * Fill in the entries of the similarity matrix for one destination,
+ * for diff_parallel().  The sources are compared with others, too,
+ * but the destination is done with, so its data can go.
+ */
+static void score_row(int r, void *job_)
+{
+	struct score_job *job = job_;
+	struct diff_score *m = &job->mx[job->row[r]];
+	struct diff_score *end = &job->mx[job->row[r + 1]];
+
+	for ( ; m < end; m++)
+		m->score = estimate_similarity(rename_src[m->src].one,
+					       rename_dst[m->dst].two,
+					       job->minimum_score);
+	diff_free_filespec_data(rename_dst[end[-1].dst].two);
+}
+
 /*
  * We sort the rename similarity matrix with the score, in descending
  * order (the most similar first).
@@ -257,8 +538,9 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count;
-	int num_create, num_src, dst_cnt;
+	struct score_job job;
+	int i, j, nr, nr_row, rename_count;
+	int num_create, num_src, mx_alloc;
 
 	if (!minimum_score)
 		minimum_score = DEFAULT_RENAME_SCORE;
@@ -282,24 +564,14 @@ void diffcore_rename(struct diff_options *options)
 		else if (detect_rename == DIFF_DETECT_COPY)
 			register_rename_src(p->one, 1);
 	}
-	if (rename_dst_nr == 0 ||
+	if (rename_dst_nr == 0 || rename_src_nr == 0 ||
 	    (0 < rename_limit && rename_limit < rename_dst_nr))
 		goto cleanup; /* nothing to do */
 
 	/* We really want to cull the candidates list early
 	 * with cheap tests in order to avoid doing deltas.
 	 */
-	for (i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].one;
-			if (!is_exact_match(one, two))
-				continue;
-			record_rename_pair(i, j, MAX_SCORE);
-			rename_count++;
-			break; /* we are done with this entry */
-		}
-	}
+	rename_count = find_exact_renames();
 
 	/* Have we run out the created file pool?  If so we can avoid
 	 * doing the delta matrix altogether.
@@ -310,27 +582,58 @@ void diffcore_rename(struct diff_options *options)
 	if (minimum_score == MAX_SCORE)
 		goto cleanup;
 
+	/* With many sources, only the few whose signatures look most
+	 * like the destination are compared with a real delta.
+	 */
 	num_create = (rename_dst_nr - rename_count);
 	num_src = rename_src_nr;
-	mx = xmalloc(sizeof(*mx) * num_create * num_src);
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		int base = dst_cnt * num_src;
-		struct diff_filespec *two = rename_dst[i].two;
+	if (RENAME_CANDIDATES < num_src)
+		num_src = RENAME_CANDIDATES;
+	mx_alloc = num_create * num_src;
+	mx = xmalloc(sizeof(*mx) * mx_alloc);
+	job.row = xmalloc(sizeof(int) * (num_create + 1));
+	for (nr = nr_row = i = 0; i < rename_dst_nr; i++) {
+		struct candidate cand[RENAME_CANDIDATES];
+		int num_cand;
+
 		if (rename_dst[i].pair)
 			continue; /* dealt with exact match already. */
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].one;
-			struct diff_score *m = &mx[base+j];
-			m->src = j;
+		num_cand = -1;
+		if (RENAME_CANDIDATES < rename_src_nr) {
+			num_cand = find_candidates(i, minimum_score, cand);
+			/* score_row() reads it again when its turn comes */
+			diff_free_filespec_data(rename_dst[i].two);
+		}
+		if (!num_cand)
+			continue;
+		job.row[nr_row++] = nr;
+		if (num_cand < 0) {
+			/* all of them, as without the signatures */
+			if (mx_alloc < nr + rename_src_nr) {
+				mx_alloc = alloc_nr(nr + rename_src_nr);
+				mx = xrealloc(mx, sizeof(*mx) * mx_alloc);
+			}
+			for (j = 0; j < rename_src_nr; j++) {
+				mx[nr].src = j;
+				mx[nr++].dst = i;
+			}
+			continue;
+		}
+		for (j = 0; j < num_cand; j++) {
+			struct diff_score *m = &mx[nr++];
+			m->src = cand[j].src;
 			m->dst = i;
-			m->score = estimate_similarity(one, two,
-						       minimum_score);
 		}
-		dst_cnt++;
 	}
+	job.row[nr_row] = nr;
+	job.mx = mx;
+	job.minimum_score = minimum_score;
+	diff_parallel(nr_row, score_row, &job);
+	free(job.row);
+
 	/* cost matrix sorted by most to least similar pair */
-	qsort(mx, num_create * num_src, sizeof(*mx), score_compare);
-	for (i = 0; i < num_create * num_src; i++) {
+	qsort(mx, nr, sizeof(*mx), score_compare);
+	for (i = 0; i < nr; i++) {
 		struct diff_rename_dst *dst = &rename_dst[mx[i].dst];
 		if (dst->pair)
 			continue; /* already done, either exact or fuzzy. */
@@ -451,7 +754,10 @@ void diffcore_rename(struct diff_options *options)
 	for (i = 0; i < rename_dst_nr; i++) {
 		diff_free_filespec_data(rename_dst[i].two);
 		free(rename_dst[i].two);
+		free_signature(rename_dst[i].sig);
 	}
+	for (i = 0; i < rename_src_nr; i++)
+		free_signature(rename_src[i].sig);
 
 	free(rename_dst);
 	rename_dst = NULL;
@@ -43,6 +43,8 @@ extern void fill_filespec(struct diff_filespec *, const unsigned char *,
 			  unsigned short);
 
 extern int diff_populate_filespec(struct diff_filespec *, int);
+extern int diff_threads;
+extern void diff_parallel(int nr, void (*fn)(int, void *), void *data);
 extern void diff_free_filespec_data(struct diff_filespec *);
 
 struct diff_filepair {
@@ -83,6 +85,26 @@ extern struct diff_filepair *diff_queue(struct diff_queue_struct *,
 					struct diff_filespec *);
 extern void diff_q(struct diff_queue_struct *, struct diff_filepair *);
 
+struct diff_lines_options {
+	int context;
+	int show_function;	/* "diff -p" */
+};
+
+extern int diff_lines_parse_opts(const char *, struct diff_lines_options *);
+extern char *diff_lines(const char *a, unsigned long a_size,
+			const char *b, unsigned long b_size,
+			const struct diff_lines_options *,
+			unsigned long *size);
+
+extern unsigned long patch_cache_size;
+extern char *read_patch_cache(const unsigned char *one,
+			      const unsigned char *two,
+			      const char *opts, unsigned long *size);
+extern void write_patch_cache(const unsigned char *one,
+			      const unsigned char *two,
+			      const char *opts,
+			      const char *buf, unsigned long size);
+
 extern void diffcore_pathspec(const char **pathspec);
 extern void diffcore_break(int);
 extern void diffcore_rename(struct diff_options *);
@@ -9,170 +9,140 @@
  */
 #include <stdlib.h>
 
-/* Provides arbitrary precision integers required to accurately represent
- * fractional mass: */
-#include <openssl/bn.h>
-
 #include "cache.h"
 #include "commit.h"
 #include "epoch.h"
 
-struct fraction {
-	BIGNUM numerator;
-	BIGNUM denominator;
-};
-
 #define HAS_EXACTLY_ONE_PARENT(n) ((n)->parents && !(n)->parents->next)
 
-static BN_CTX *context = NULL;
-static struct fraction *one = NULL;
-static struct fraction *zero = NULL;
-
-static BN_CTX *get_BN_CTX(void)
-{
-	if (!context) {
-		context = BN_CTX_new();
-	}
-	return context;
-}
-
-static struct fraction *new_zero(void)
-{
-	struct fraction *result = xmalloc(sizeof(*result));
-	BN_init(&result->numerator);
-	BN_init(&result->denominator);
-	BN_zero(&result->numerator);
-	BN_one(&result->denominator);
-	return result;
-}
-
-static void clear_fraction(struct fraction *fraction)
-{
-	BN_clear(&fraction->numerator);
-	BN_clear(&fraction->denominator);
-}
+/* Where a commit stands in the search for the base of a list */
+#define BASE_SOURCE	01	/* one of the starting list */
+#define BASE_QUEUED	02	/* waiting in the date ordered queue */
+#define BASE_DONE	04	/* parents have been looked at */
+#define BASE_REACHED	010	/* recheck: a sorted child or a source */
 
-static struct fraction *divide(struct fraction *result, struct fraction *fraction, int divisor)
-{
-	BIGNUM bn_divisor;
-
-	BN_init(&bn_divisor);
-	BN_set_word(&bn_divisor, divisor);
-
-	BN_copy(&result->numerator, &fraction->numerator);
-	BN_mul(&result->denominator, &fraction->denominator, &bn_divisor, get_BN_CTX());
+struct base_node {
+	unsigned int state;
+	int children;		/* recheck: done children not yet sorted */
+};
 
-	BN_clear(&bn_divisor);
-	return result;
-}
+/*
+ * The commits waiting to be visited, kept as a binary heap so that
+ * the one with the latest commit date is always on top.
+ */
+static struct commit **queue;
+static int queue_nr, queue_alloc;
 
-static struct fraction *init_fraction(struct fraction *fraction)
+static void queue_push(struct commit *commit)
 {
-	BN_init(&fraction->numerator);
-	BN_init(&fraction->denominator);
-	BN_zero(&fraction->numerator);
-	BN_one(&fraction->denominator);
-	return fraction;
-}
+	int i, parent;
 
-static struct fraction *get_one(void)
-{
-	if (!one) {
-		one = new_zero();
-		BN_one(&one->numerator);
+	if (queue_nr == queue_alloc) {
+		queue_alloc = alloc_nr(queue_alloc);
+		queue = xrealloc(queue, queue_alloc * sizeof(*queue));
 	}
-	return one;
-}
-
-static struct fraction *get_zero(void)
-{
-	if (!zero) {
-		zero = new_zero();
+	for (i = queue_nr++; i; i = parent) {
+		parent = (i - 1) / 2;
+		if (queue[parent]->date >= commit->date)
+			break;
+		queue[i] = queue[parent];
 	}
-	return zero;
+	queue[i] = commit;
 }
 
-static struct fraction *copy(struct fraction *to, struct fraction *from)
+static struct commit *queue_pop(void)
 {
-	BN_copy(&to->numerator, &from->numerator);
-	BN_copy(&to->denominator, &from->denominator);
-	return to;
+	struct commit *top = queue[0];
+	struct commit *last = queue[--queue_nr];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < queue_nr) {
+		if (child + 1 < queue_nr &&
+		    queue[child + 1]->date > queue[child]->date)
+			child++;
+		if (last->date >= queue[child]->date)
+			break;
+		queue[i] = queue[child];
+		i = child;
+	}
+	queue[i] = last;
+	return top;
 }
 
-static struct fraction *add(struct fraction *result, struct fraction *left, struct fraction *right)
+static struct base_node *new_base_node(struct commit *commit, struct commit_list **cleaner)
 {
-	BIGNUM a, b, gcd;
-
-	BN_init(&a);
-	BN_init(&b);
-	BN_init(&gcd);
+	struct base_node *node = xmalloc(sizeof(*node));
+	memset(node, 0, sizeof(*node));
 
-	BN_mul(&a, &left->numerator, &right->denominator, get_BN_CTX());
-	BN_mul(&b, &left->denominator, &right->numerator, get_BN_CTX());
-	BN_mul(&result->denominator, &left->denominator, &right->denominator, get_BN_CTX());
-	BN_add(&result->numerator, &a, &b);
-
-	BN_gcd(&gcd, &result->denominator, &result->numerator, get_BN_CTX());
-	BN_div(&result->denominator, NULL, &result->denominator, &gcd, get_BN_CTX());
-	BN_div(&result->numerator, NULL, &result->numerator, &gcd, get_BN_CTX());
+	if (commit->object.util) {
+		die("multiple attempts to initialize base search for %s",
+		    sha1_to_hex(commit->object.sha1));
+	}
 
-	BN_clear(&a);
-	BN_clear(&b);
-	BN_clear(&gcd);
+	commit->object.util = node;
+	commit_list_insert(commit, cleaner);
 
-	return result;
+	return node;
 }
 
-static int compare(struct fraction *left, struct fraction *right)
+/*
+ * Looks for the base again among the commits the date ordered walk
+ * has finished with, this time in a strictly topological order: a
+ * commit is only looked at once all of its children that the walk
+ * saw have been.  The first commit that leaves nothing else open,
+ * before any path has run into a root, is the base.
+ */
+static struct commit *recheck_base(struct commit_list *cleaner)
 {
-	BIGNUM a, b;
-	int result;
-
-	BN_init(&a);
-	BN_init(&b);
-
-	BN_mul(&a, &left->numerator, &right->denominator, get_BN_CTX());
-	BN_mul(&b, &left->denominator, &right->numerator, get_BN_CTX());
-
-	result = BN_cmp(&a, &b);
+	struct commit_list *ready = NULL;
+	struct commit_list *list, *parents;
+	int open = 0, reached_root = 0;
 
-	BN_clear(&a);
-	BN_clear(&b);
+	for (list = cleaner; list; list = list->next) {
+		struct base_node *node = list->item->object.util;
 
-	return result;
-}
-
-struct mass_counter {
-	struct fraction seen;
-	struct fraction pending;
-};
+		if (node->state & BASE_SOURCE) {
+			node->state |= BASE_REACHED;
+			open++;
+		}
+		if (!(node->state & BASE_DONE))
+			continue;
+		for (parents = list->item->parents; parents; parents = parents->next) {
+			struct base_node *parent_node = parents->item->object.util;
+			if (parent_node->state & BASE_DONE)
+				parent_node->children++;
+		}
+	}
+	for (list = cleaner; list; list = list->next) {
+		struct base_node *node = list->item->object.util;
+		if ((node->state & BASE_DONE) && !node->children)
+			commit_list_insert(list->item, &ready);
+	}
 
-static struct mass_counter *new_mass_counter(struct commit *commit, struct fraction *pending)
-{
-	struct mass_counter *mass_counter = xmalloc(sizeof(*mass_counter));
-	memset(mass_counter, 0, sizeof(*mass_counter));
+	while (ready) {
+		struct commit *item = pop_commit(&ready);
 
-	init_fraction(&mass_counter->seen);
-	init_fraction(&mass_counter->pending);
+		if (!--open && !reached_root) {
+			free_commit_list(ready);
+			return item;
+		}
+		if (!item->parents)
+			reached_root = 1;
 
-	copy(&mass_counter->pending, pending);
-	copy(&mass_counter->seen, get_zero());
+		for (parents = item->parents; parents; parents = parents->next) {
+			struct base_node *parent_node = parents->item->object.util;
 
-	if (commit->object.util) {
-		die("multiple attempts to initialize mass counter for %s",
-		    sha1_to_hex(commit->object.sha1));
+			if (!(parent_node->state & BASE_REACHED)) {
+				parent_node->state |= BASE_REACHED;
+				open++;
+			}
+			if ((parent_node->state & BASE_DONE) &&
+			    !--parent_node->children)
+				commit_list_insert(parents->item, &ready);
+		}
 	}
 
-	commit->object.util = mass_counter;
-
-	return mass_counter;
-}
-
-static void free_mass_counter(struct mass_counter *counter)
-{
-	clear_fraction(&counter->seen);
-	clear_fraction(&counter->pending);
-	free(counter);
+	return NULL;
 }
 
 /*
@@ -180,33 +150,27 @@ static void free_mass_counter(struct mass_counter *counter)
  *
  * One property of the commit being searched for is that every commit reachable
  * from the base commit is reachable from the commits in the starting list only
- * via paths that include the base commit.
+ * via paths that include the base commit.  Put the other way round, every
+ * path from the starting list down to a root goes through the base, and of
+ * all the commits with that property it is the one nearest to the list.
  *
- * This algorithm uses a conservation of mass approach to find the base commit.
+ * We start by queueing each of the commits in the starting list, and then
+ * repeatedly take the queued commit with the latest commit date and queue
+ * those of its parents that have not been queued yet.  We count the commits
+ * that are queued but not yet visited; these are the ends of the paths we
+ * are following.  If, when we take a commit off the queue, it is the only
+ * open end left and no path has run into a root yet, then every path goes
+ * through it, and it is the base.
  *
- * We start by injecting one unit of mass into the graph at each
- * of the commits in the starting list. Injecting mass into a commit
- * is achieved by adding to its pending mass counter and, if it is not already
- * enqueued, enqueuing the commit in a list of pending commits, in latest
- * commit date first order.
+ * This used to be done by pushing fractional amounts of "mass" down the
+ * graph, which needed arbitrary precision arithmetic; the commit found is
+ * the same, but counting open ends only needs an int.
  *
- * The algorithm then preceeds to visit each commit in the pending queue.
- * Upon each visit, the pending mass is added to the mass already seen for that
- * commit and then divided into N equal portions, where N is the number of
- * parents of the commit being visited. The divided portions are then injected
- * into each of the parents.
- *
- * The algorithm continues until we discover a commit which has seen all the
- * mass originally injected or until we run out of things to do.
- *
- * If we find a commit that has seen all the original mass, we have found
- * the common base of all the commits in the starting list.
- *
- * The algorithm does _not_ depend on accurate timestamps for correct operation.
- * However, reasonably sane (e.g. non-random) timestamps are required in order
- * to prevent an exponential performance characteristic. The occasional
- * timestamp inaccuracy will not dramatically affect performance but may
- * result in more nodes being processed than strictly necessary.
+ * The date order stands in for a topological order.  If timestamps lie and
+ * we visit a commit before one of its children, we may have walked past
+ * the base without noticing, so we go over what we have walked once more
+ * in a real topological order (see recheck_base()).  The result does not
+ * depend on accurate timestamps, but sane ones keep it at a single walk.
  *
  * This procedure sets *boundary to the address of the base commit. It returns
  * non-zero if, and only if, there was a problem parsing one of the
@@ -215,77 +179,63 @@ static void free_mass_counter(struct mass_counter *counter)
 static int find_base_for_list(struct commit_list *list, struct commit **boundary)
 {
 	int ret = 0;
+	int open = 0, reached_root = 0, skewed = 0;
 	struct commit_list *cleaner = NULL;
-	struct commit_list *pending = NULL;
-	struct fraction injected;
-	init_fraction(&injected);
 	*boundary = NULL;
+	queue_nr = 0;
 
 	for (; list; list = list->next) {
 		struct commit *item = list->item;
 
 		if (!item->object.util) {
-			new_mass_counter(list->item, get_one());
-			add(&injected, &injected, get_one());
-
-			commit_list_insert(list->item, &cleaner);
-			commit_list_insert(list->item, &pending);
+			struct base_node *node = new_base_node(item, &cleaner);
+			node->state = BASE_SOURCE | BASE_QUEUED;
+			queue_push(item);
+			open++;
 		}
 	}
 
-	while (!*boundary && pending && !ret) {
-		struct commit *latest = pop_commit(&pending);
-		struct mass_counter *latest_node = (struct mass_counter *) latest->object.util;
-		int num_parents;
+	while (!*boundary && queue_nr && !ret) {
+		struct commit *latest = queue_pop();
+		struct base_node *latest_node = (struct base_node *) latest->object.util;
+		struct commit_list *parents;
 
 		if ((ret = parse_commit(latest)))
 			continue;
-		add(&latest_node->seen, &latest_node->seen, &latest_node->pending);
-
-		num_parents = count_parents(latest);
-		if (num_parents) {
-			struct fraction distribution;
-			struct commit_list *parents;
-
-			divide(init_fraction(&distribution), &latest_node->pending, num_parents);
-
-			for (parents = latest->parents; parents; parents = parents->next) {
-				struct commit *parent = parents->item;
-				struct mass_counter *parent_node = (struct mass_counter *) parent->object.util;
-
-				if (!parent_node) {
-					parent_node = new_mass_counter(parent, &distribution);
-					insert_by_date(parent, &pending);
-					commit_list_insert(parent, &cleaner);
-				} else {
-					if (!compare(&parent_node->pending, get_zero()))
-						insert_by_date(parent, &pending);
-					add(&parent_node->pending, &parent_node->pending, &distribution);
-				}
-			}
-
-			clear_fraction(&distribution);
-		}
+		latest_node->state = (latest_node->state & ~BASE_QUEUED) | BASE_DONE;
 
-		if (!compare(&latest_node->seen, &injected))
+		if (!--open && !reached_root)
 			*boundary = latest;
-		copy(&latest_node->pending, get_zero());
+		if (!latest->parents)
+			reached_root = 1;
+
+		for (parents = latest->parents; parents; parents = parents->next) {
+			struct commit *parent = parents->item;
+			struct base_node *parent_node = (struct base_node *) parent->object.util;
+
+			if (!parent_node) {
+				parent_node = new_base_node(parent, &cleaner);
+				parent_node->state = BASE_QUEUED;
+				queue_push(parent);
+				open++;
+			} else if (parent_node->state & BASE_DONE)
+				skewed = 1;
+		}
 	}
 
+	if (skewed && !ret)
+		*boundary = recheck_base(cleaner);
+
 	while (cleaner) {
 		struct commit *next = pop_commit(&cleaner);
-		free_mass_counter((struct mass_counter *) next->object.util);
+		free(next->object.util);
 		next->object.util = NULL;
 	}
+	queue_nr = 0;
 
-	if (pending)
-		free_commit_list(pending);
-
-	clear_fraction(&injected);
 	return ret;
 }
 
-
 /*
  * Finds the base of an minimal, non-linear epoch, headed at head, by
  * applying the find_base_for_list to a list consisting of the parents
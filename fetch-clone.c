@@ -1,5 +1,7 @@
 #include "cache.h"
+#include "sideband.h"
 #include <sys/wait.h>
+#include <sys/time.h>
 
 static int finish_pack(const char *pack_tmp_name, const char *me)
 {
@@ -130,43 +132,153 @@ int receive_unpack_pack(int fd[2], const char *me, int quiet)
 	die("git-unpack-objects died of unnatural causes %d", status);
 }
 
-int receive_keep_pack(int fd[2], const char *me)
+/*
+ * Tell how much of the pack we have, and how fast it is coming in,
+ * once a second; a pack that is done within the first second is not
+ * worth talking about.
+ */
+static void show_receive_progress(unsigned long total, struct timeval *last,
+				  unsigned long *last_total)
+{
+	struct timeval now;
+	long ms;
+
+	gettimeofday(&now, NULL);
+	ms = (now.tv_sec - last->tv_sec) * 1000 +
+		(now.tv_usec - last->tv_usec) / 1000;
+	if (ms < 1000)
+		return;
+	fprintf(stderr, "Receiving pack: %lu KiB, %lu KiB/s  \r", total / 1024,
+		(total - *last_total) / 1024 * 1000 / ms);
+	*last = now;
+	*last_total = total;
+}
+
+static int write_in_full(int ofd, const char *buf, ssize_t sz)
+{
+	ssize_t wsz, pos = 0;
+
+	while (pos < sz) {
+		wsz = write(ofd, buf + pos, sz - pos);
+		if (wsz < 0)
+			return error("error writing pack (%s)",
+				     strerror(errno));
+		pos += wsz;
+	}
+	return 0;
+}
+
+/*
+ * Store the pack read from ifd under objects/pack/ and index it.
+ * The first headlen bytes of it may already have been read by the
+ * caller, who passes them in head.
+ */
+int store_pack(int ifd, const void *head, unsigned long headlen,
+	       const char *me)
 {
 	char tmpfile[PATH_MAX];
-	int ofd, ifd;
+	int ofd;
+	unsigned long total = headlen, last_total = 0;
+	struct timeval last;
 
-	ifd = fd[0];
 	snprintf(tmpfile, sizeof(tmpfile),
 		 "%s/pack/tmp-XXXXXX", get_object_directory());
 	ofd = mkstemp(tmpfile);
 	if (ofd < 0)
 		return error("unable to create temporary file %s", tmpfile);
+	if (write_in_full(ofd, head, headlen)) {
+		close(ofd);
+		unlink(tmpfile);
+		return -1;
+	}
 
+	gettimeofday(&last, NULL);
 	while (1) {
 		char buf[8192];
-		ssize_t sz, wsz, pos;
+		ssize_t sz;
 		sz = read(ifd, buf, sizeof(buf));
 		if (sz == 0)
 			break;
+		if (0 < sz) {
+			total += sz;
+			show_receive_progress(total, &last, &last_total);
+		}
 		if (sz < 0) {
 			error("error reading pack (%s)", strerror(errno));
 			close(ofd);
 			unlink(tmpfile);
 			return -1;
 		}
-		pos = 0;
-		while (pos < sz) {
-			wsz = write(ofd, buf + pos, sz - pos);
-			if (wsz < 0) {
-				error("error writing pack (%s)",
-				      strerror(errno));
-				close(ofd);
-				unlink(tmpfile);
-				return -1;
-			}
-			pos += wsz;
+		if (write_in_full(ofd, buf, sz)) {
+			close(ofd);
+			unlink(tmpfile);
+			return -1;
 		}
 	}
+	if (fsync(ofd) < 0) {
+		error("error syncing pack (%s)", strerror(errno));
+		close(ofd);
+		unlink(tmpfile);
+		return -1;
+	}
 	close(ofd);
+	if (last_total)
+		fprintf(stderr, "\n");
 	return finish_pack(tmpfile, me);
 }
+
+int receive_keep_pack(int fd[2], const char *me)
+{
+	return store_pack(fd[0], NULL, 0, me);
+}
+
+/*
+ * When the other end sends the pack multiplexed with its messages
+ * ("side-band"), fork off a process to take the pack out of the
+ * stream and write the messages to our stderr (unless quiet), and
+ * read the pack from a pipe it feeds instead of fd[0].
+ */
+pid_t setup_sideband(int fd[2], const char *me, int quiet)
+{
+	int pipe_fd[2];
+	pid_t pid;
+
+	if (pipe(pipe_fd) < 0)
+		die("%s: unable to set up pipe", me);
+	pid = fork();
+	if (pid < 0)
+		die("%s: unable to fork off sideband demultiplexer", me);
+	if (!pid) {
+		close(pipe_fd[0]);
+		if (fd[1] != fd[0])
+			close(fd[1]);
+		if (recv_sideband(me, fd[0], pipe_fd[1], quiet ? -1 : 2))
+			exit(1);
+		exit(0);
+	}
+	close(pipe_fd[1]);
+	if (fd[0] != fd[1])
+		close(fd[0]);
+	fd[0] = pipe_fd[0];
+	return pid;
+}
+
+/*
+ * Wait for the demultiplexer setup_sideband() started.  Returns 0 if
+ * the stream ended normally, and -1 if it did not, e.g. because the
+ * other end reported an error, even when what came down the pack
+ * band happened to make a good pack.
+ */
+int finish_sideband(pid_t pid, const char *me)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return error("%s: waiting for sideband demultiplexer: %s",
+				     me, strerror(errno));
+	}
+	if (WIFEXITED(status) && !WEXITSTATUS(status))
+		return 0;
+	return -1;
+}
@@ -18,7 +18,7 @@ static const char *exec = "git-upload-pack";
 #define POPPED		(1U << 4)
 
 static struct commit_list *rev_list = NULL;
-static int non_common_revs = 0, multi_ack = 0;
+static int non_common_revs = 0, multi_ack = 0, use_sideband = 0;
 
 static void rev_list_push(struct commit *commit, int mark)
 {
@@ -78,17 +78,55 @@ static void mark_common(struct commit *commit,
 	}
 }
 
+/*
+ * With multi_ack, we do not have to tell the other end about every
+ * commit on the way down: after the first few, each line of history
+ * walks past more and more commits (1, 2, 4, 7, 11, ...) before
+ * sending the next "have", so that thousands of commits they do not
+ * have cost only a few lines.  The price is that when a have we sent
+ * after walking past some commits turns out to be common, the real
+ * boundary may be anywhere among the commits we walked past; we go
+ * back and bisect them, one probe per round.
+ *
+ * The commits we walk down to keep this in their object.util.
+ */
+struct negotiation {
+	struct commit *child;	/* we came down to this one from */
+	struct commit *sent;	/* the last one we sent on the way */
+	int skip;		/* commits to walk past before sending one */
+	int gap;		/* ... and how many after the next one */
+};
+
+static void walk_down(struct commit *parent, struct commit *child, int sent)
+{
+	struct negotiation *c = child->object.util;
+	struct negotiation *n = xmalloc(sizeof(*n));
+
+	n->child = child;
+	if (sent) {
+		n->sent = child;
+		n->gap = c ? c->gap * 3 / 2 + 1 : 0;
+		n->skip = n->gap;
+	} else {
+		n->sent = c->sent;
+		n->gap = c->gap;
+		n->skip = c->skip - 1;
+	}
+	parent->object.util = n;
+}
+
 /*
   Get the next rev to send, ignoring the common.
 */
 
-static const unsigned char* get_rev()
+static struct commit *get_rev(void)
 {
-	struct commit *commit = NULL;
-
-	while (commit == NULL) {
+	for (;;) {
+		struct commit *commit;
+		struct negotiation *n;
 		unsigned int mark;
 		struct commit_list* parents;
+		int send = 1;
 
 		if (rev_list == NULL || non_common_revs == 0)
 			return NULL;
@@ -101,38 +139,177 @@ static const unsigned char* get_rev()
 			non_common_revs--;
 	
 		parents = commit->parents;
+		n = commit->object.util;
 
 		if (commit->object.flags & COMMON) {
 			/* do not send "have", and ignore ancestors */
-			commit = NULL;
+			send = 0;
 			mark = COMMON | SEEN;
 		} else if (commit->object.flags & COMMON_REF)
 			/* send "have", and ignore ancestors */
 			mark = COMMON | SEEN;
-		else
-			/* send "have", also for its ancestors */
+		else {
+			/* send "have" unless walking past, also for its ancestors */
 			mark = SEEN;
+			if (multi_ack && n && n->skip)
+				send = 0;
+		}
 
 		while (parents) {
-			if (!(parents->item->object.flags & SEEN))
+			if (!(parents->item->object.flags & SEEN)) {
 				rev_list_push(parents->item, mark);
+				if (!(mark & COMMON))
+					walk_down(parents->item, commit, send);
+			}
 			if (mark & COMMON)
 				mark_common(parents->item, 1, 0);
 			parents = parents->next;
 		}
 
 		rev_list = rev_list->next;
+		if (send)
+			return commit;
 	}
+}
 
-	return commit->object.sha1;
+/*
+ * A "have" whose answer may tell us to look between "upper" and the
+ * commit: either one sent after walking past commits, or one of the
+ * bisection probes among them, in which case "lower" is the common
+ * commit below them.  We learn whether the commit is common when the
+ * other end says NAK to the batch it was sent in.
+ */
+struct probe {
+	struct commit *commit, *upper, *lower;
+	int batch;
+	struct probe *next;
+};
+static struct probe *probes_to_send, *probes_sent, **probes_sent_tail = &probes_sent;
+
+/* The commit half way between the two on the way we walked down */
+static struct commit *halfway(struct commit *upper, struct commit *lower)
+{
+	struct negotiation *n = lower->object.util;
+	struct commit *commit;
+	int between = 0;
+
+	for (commit = n->child; commit != upper; commit = n->child) {
+		if (!commit || !(n = commit->object.util))
+			return NULL;
+		between++;
+	}
+	if (!between)
+		return NULL;
+	between = (between + 1) / 2;
+	for (commit = lower; between--; commit = n->child)
+		n = commit->object.util;
+	return commit;
+}
+
+static void add_probe(struct commit *commit, struct commit *upper,
+		      struct commit *lower)
+{
+	struct probe *p = xmalloc(sizeof(*p));
+
+	p->commit = commit;
+	p->upper = upper;
+	p->lower = lower;
+	p->next = probes_to_send;
+	probes_to_send = p;
+}
+
+/* We now know whether p->commit is common; look where we should */
+static void resolve_probe(struct probe *p)
+{
+	struct commit *upper, *lower, *next;
+
+	if (p->commit->object.flags & COMMON) {
+		upper = p->upper;
+		lower = p->commit;
+		if (upper->object.flags & COMMON)
+			return;
+	} else {
+		upper = p->commit;
+		lower = p->lower;
+		if (!lower)
+			return;
+	}
+	next = halfway(upper, lower);
+	if (next)
+		add_probe(next, upper, lower);
+}
+
+static void resolve_batch(int batch)
+{
+	while (probes_sent && probes_sent->batch == batch) {
+		struct probe *p = probes_sent;
+
+		probes_sent = p->next;
+		if (!probes_sent)
+			probes_sent_tail = &probes_sent;
+		resolve_probe(p);
+		free(p);
+	}
 }
 
+static void sent_probe(struct probe *p, int batch)
+{
+	p->batch = batch;
+	p->next = NULL;
+	*probes_sent_tail = p;
+	probes_sent_tail = &p->next;
+}
+
+/* Bisection probes first, then whatever walking down finds */
+static struct commit *next_have(int batch)
+{
+	struct commit *commit;
+	struct negotiation *n;
+
+	while (probes_to_send) {
+		struct probe *p = probes_to_send;
+
+		probes_to_send = p->next;
+		if (p->commit->object.flags & COMMON) {
+			/* we already know; no need to ask */
+			resolve_probe(p);
+			free(p);
+			continue;
+		}
+		sent_probe(p, batch);
+		return p->commit;
+	}
+
+	commit = get_rev();
+	if (!commit)
+		return NULL;
+	n = commit->object.util;
+	if (n && n->sent != n->child) {
+		struct probe *p = xmalloc(sizeof(*p));
+		p->commit = commit;
+		p->upper = n->sent;
+		p->lower = NULL;
+		sent_probe(p, batch);
+	}
+	return commit;
+}
+
+/*
+ * The first batch of haves is this large, and each one after that
+ * twice as large as the one before, up to MAX_FLUSH.  As we stay one
+ * batch ahead of the other end, both ends write at most two batches
+ * worth of lines before reading, which must fit in the pipe.
+ */
+#define INITIAL_FLUSH	32
+#define MAX_FLUSH	256
+
 static int find_common(int fd[2], unsigned char *result_sha1,
 		       struct ref *refs)
 {
 	int fetching;
-	int count = 0, flushes = 0, retval;
-	const unsigned char *sha1;
+	int count = 0, flush_at = INITIAL_FLUSH, batch = 0, flushes = 0;
+	int retval;
+	struct commit *commit;
 
 	for_each_ref(rev_list_insert_ref);
 
@@ -156,55 +333,69 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 			continue;
 		}
 
-		packet_write(fd[1], "want %s%s\n", sha1_to_hex(remote),
-			multi_ack ? " multi_ack" : "");
+		packet_write(fd[1], "want %s%s%s\n", sha1_to_hex(remote),
+			multi_ack ? " multi_ack" : "",
+			use_sideband ? " side-band" : "");
 		fetching++;
 	}
 	packet_flush(fd[1]);
 	if (!fetching)
 		return 1;
 
-	flushes = 0;
 	retval = -1;
-	while ((sha1 = get_rev())) {
-		packet_write(fd[1], "have %s\n", sha1_to_hex(sha1));
-		if (verbose)
-			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
-		if (!(31 & ++count)) {
-			int ack;
+	for (;;) {
+		int ack;
 
+		commit = next_have(batch + flushes);
+		if (commit) {
+			packet_write(fd[1], "have %s\n",
+				     sha1_to_hex(commit->object.sha1));
+			if (verbose)
+				fprintf(stderr, "have %s\n",
+					sha1_to_hex(commit->object.sha1));
+			if (++count < flush_at)
+				continue;
+		}
+		if (count) {
 			packet_flush(fd[1]);
 			flushes++;
+			count = 0;
+			if (flush_at < MAX_FLUSH)
+				flush_at *= 2;
 
 			/*
 			 * We keep one window "ahead" of the other side, and
 			 * will wait for an ACK only on the next one
 			 */
-			if (count == 32)
+			if (flushes == 1)
 				continue;
-
-			do {
-				ack = get_ack(fd[0], result_sha1);
-				if (verbose && ack)
-					fprintf(stderr, "got ack %d %s\n", ack,
-							sha1_to_hex(result_sha1));
-				if (ack == 1) {
-					flushes = 0;
-					multi_ack = 0;
-					retval = 0;
-					goto done;
-				} else if (ack == 2) {
-					struct commit *commit =
-						lookup_commit(result_sha1);
-					mark_common(commit, 0, 1);
-					retval = 0;
-				}
-			} while (ack);
-			flushes--;
-		}
+		} else if (!flushes || !probes_sent)
+			/* nothing to send, and nothing to learn */
+			break;
+
+		do {
+			ack = get_ack(fd[0], result_sha1);
+			if (verbose && ack)
+				fprintf(stderr, "got ack %d %s\n", ack,
+						sha1_to_hex(result_sha1));
+			if (ack == 1) {
+				flushes = 0;
+				multi_ack = 0;
+				retval = 0;
+				goto done;
+			} else if (ack == 2) {
+				struct commit *commit =
+					lookup_commit(result_sha1);
+				mark_common(commit, 0, 1);
+				retval = 0;
+			}
+		} while (ack);
+		flushes--;
+		resolve_batch(batch++);
 	}
 done:
 	packet_write(fd[1], "done\n");
+	packet_send(fd[1]);
 	if (verbose)
 		fprintf(stderr, "done\n");
 	if (retval != 0) {
@@ -362,6 +553,7 @@ static int fetch_pack(int fd[2], int nr_match, char **match)
 	struct ref *ref;
 	unsigned char sha1[20];
 	int status;
+	pid_t sideband = 0;
 
 	get_remote_heads(fd[0], &ref, 0, NULL, 0);
 	if (server_supports("multi_ack")) {
@@ -369,6 +561,11 @@ static int fetch_pack(int fd[2], int nr_match, char **match)
 			fprintf(stderr, "Server supports multi_ack\n");
 		multi_ack = 1;
 	}
+	if (server_supports("side-band")) {
+		if (verbose)
+			fprintf(stderr, "Server supports side-band\n");
+		use_sideband = 1;
+	}
 	if (!ref) {
 		packet_flush(fd[1]);
 		die("no matching remote head");
@@ -380,10 +577,14 @@ static int fetch_pack(int fd[2], int nr_match, char **match)
 	if (find_common(fd, sha1, ref) < 0)
 		fprintf(stderr, "warning: no common commits\n");
 
+	if (use_sideband)
+		sideband = setup_sideband(fd, "git-fetch-pack", quiet);
 	if (keep_pack)
 		status = receive_keep_pack(fd, "git-fetch-pack");
 	else
 		status = receive_unpack_pack(fd, "git-fetch-pack", quiet);
+	if (sideband && finish_sideband(sideband, "git-fetch-pack"))
+		status = -1;
 
 	if (status)
 		die("git-fetch-pack: fetch failed.");
@@ -149,17 +149,40 @@ static int process(struct object *obj)
 	return 0;
 }
 
+/*
+ * A walker that has several requests in flight (http-fetch) may get
+ * later objects in before the one at the head of the queue.  Scan
+ * those first, so that what they point at is asked for while we wait,
+ * instead of after.
+ */
+#define LOOKAHEAD 32
+
+static struct object_list **next_to_process(void)
+{
+	struct object_list **p = &process_queue;
+	int i;
+
+	for (i = 0; *p && i < LOOKAHEAD; i++, p = &(*p)->next) {
+		struct object *obj = (*p)->item;
+		if ((obj->flags & TO_SCAN) || has_sha1_file(obj->sha1))
+			return p;
+	}
+	return &process_queue;
+}
+
 static int loop(void)
 {
-	struct object_list *elem;
+	struct object_list *elem, **p;
 
 	while (process_queue) {
-		struct object *obj = process_queue->item;
-		elem = process_queue;
-		process_queue = elem->next;
+		struct object *obj;
+		p = next_to_process();
+		elem = *p;
+		obj = elem->item;
+		*p = elem->next;
+		if (process_queue_end == &elem->next)
+			process_queue_end = p;
 		free(elem);
-		if (!process_queue)
-			process_queue_end = &process_queue;
 
 		/* If we are not scanning this object, we placed it in
 		 * the queue because we needed to fetch it first.
@@ -115,21 +115,10 @@ yes,yes)
 
 	case "$local_shared" in
 	no)
-	    # See if we can hardlink and drop "l" if not.
-	    sample_file=$(cd "$repo" && \
-			  find objects -type f -print | sed -e 1q)
-
-	    # objects directory should not be empty since we are cloning!
-	    test -f "$repo/$sample_file" || exit
-
-	    l=
-	    if ln "$repo/$sample_file" "$D/.git/objects/sample" 2>/dev/null
-	    then
-		    l=l
-	    fi &&
-	    rm -f "$D/.git/objects/sample" &&
-	    cd "$repo" &&
-	    find objects -depth -print | cpio -puamd$l "$D/.git/" || exit 1
+	    # Hardlink the objects where we can; what cannot be linked
+	    # is copied, by the filesystem itself if it knows how.
+	    GIT_DIR="$D/.git" git-local-fetch --all-objects -l "$repo" ||
+	    exit 1
 	    ;;
 	yes)
 	    mkdir -p "$D/.git/objects/info"
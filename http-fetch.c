@@ -1,21 +1,46 @@
 #include "cache.h"
 #include "commit.h"
 #include "pack.h"
+#include "delta.h"
+#include "refs.h"
 #include "fetch.h"
 #include "http.h"
 
 #define PREV_BUF_SIZE 4096
-#define RANGE_HEADER_SIZE 30
+#define RANGE_HEADER_SIZE 48
+
+/*
+ * When we want only a few of the objects in a remote pack, we get
+ * each of them with a Range request for its bytes of the pack, as
+ * long as these add up to less than 1/RANGE_FRACTION of it, counting
+ * each request as RANGE_REQUEST_COST bytes more for its round trip.
+ * Past that, or when the server does not honour ranges, we get the
+ * whole pack instead.
+ */
+#define RANGE_FRACTION 4
+#define RANGE_REQUEST_COST 16384
 
 static int got_alternates = -1;
+static int use_ranges = 1;
 
 static struct curl_slist *no_pragma_header;
 
+struct remote_pack
+{
+	struct packed_git *pack;
+	unsigned int *offsets;	/* sorted, to tell where an object ends */
+	int nr;
+	unsigned long ranged;	/* what the Range requests so far cost */
+	int whole;		/* the next object from it gets all of it */
+	struct remote_pack *next;
+};
+
 struct alt_base
 {
 	char *base;
 	int got_indices;
 	struct packed_git *packs;
+	struct remote_pack *remote_packs;
 	struct alt_base *next;
 };
 
@@ -45,6 +70,11 @@ struct object_request
 	z_stream stream;
 	int zret;
 	int rename;
+	struct remote_pack *in_pack;
+	struct buffer range;
+	struct curl_slist *range_header;
+	int need_base;
+	unsigned char base_sha1[20];
 	struct active_request_slot *slot;
 	struct object_request *next;
 };
@@ -91,6 +121,8 @@ static void fetch_alternates(char *base);
 
 static void process_object_response(void *callback_data);
 
+static void finish_range_request(struct object_request *obj_req);
+
 static void start_object_request(struct object_request *obj_req)
 {
 	char *hex = sha1_to_hex(obj_req->sha1);
@@ -218,6 +250,7 @@ static void start_object_request(struct object_request *obj_req)
 		obj_req->slot = NULL;
 		close(obj_req->local); obj_req->local = -1;
 		free(obj_req->url);
+		obj_req->url = NULL;
 		return;
 	}
 	
@@ -266,6 +299,11 @@ static void process_object_response(void *callback_data)
 	obj_req->slot = NULL;
 	obj_req->state = COMPLETE;
 
+	if (obj_req->in_pack) {
+		finish_range_request(obj_req);
+		return;
+	}
+
 	/* Use alternates if necessary */
 	if (obj_req->http_code == 404) {
 		fetch_alternates(alt->base);
@@ -298,14 +336,272 @@ static void release_object_request(struct object_request *obj_req)
 	}
 
 	free(obj_req->url);
+	free(obj_req->range.buffer);
+	if (obj_req->range_header)
+		curl_slist_free_all(obj_req->range_header);
 	free(obj_req);
 }
 
+static int offset_compare(const void *a_, const void *b_)
+{
+	unsigned int a = *(unsigned int *)a_, b = *(unsigned int *)b_;
+	return a < b ? -1 : a > b;
+}
+
+static struct remote_pack *find_remote_pack(struct alt_base *repo,
+					    const unsigned char *sha1,
+					    unsigned long *offset)
+{
+	struct remote_pack *rp;
+	struct pack_entry e;
+
+	for (rp = repo->remote_packs; rp; rp = rp->next) {
+		if (find_pack_entry_one(sha1, &e, rp->pack)) {
+			*offset = e.offset;
+			return rp;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Where the object at offset ends, i.e. where the next one starts;
+ * 0 for the last object, which ends where the pack does.
+ */
+static unsigned long object_end(struct remote_pack *rp, unsigned long offset)
+{
+	int lo = 0, hi;
+
+	if (!rp->offsets) {
+		void *index = rp->pack->index_base + 256;
+		int i;
+
+		rp->nr = num_packed_objects(rp->pack);
+		rp->offsets = xmalloc(sizeof(*rp->offsets) * (rp->nr + 1));
+		for (i = 0; i < rp->nr; i++)
+			rp->offsets[i] = ntohl(*((unsigned int *)(index + 24 * i)));
+		qsort(rp->offsets, rp->nr, sizeof(*rp->offsets),
+		      offset_compare);
+	}
+	hi = rp->nr;
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (rp->offsets[mi] <= offset)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return lo < rp->nr ? rp->offsets[lo] : 0;
+}
+
+static size_t fwrite_range(void *ptr, size_t eltsize, size_t nmemb,
+			   void *data)
+{
+	struct object_request *obj_req = (struct object_request *)data;
+	long http_code = 0;
+
+	/* A server that ignores Range: would send us the whole pack */
+	curl_easy_getinfo(obj_req->slot->curl, CURLINFO_HTTP_CODE, &http_code);
+	if (http_code != 206)
+		return 0;
+	return fwrite_buffer(ptr, eltsize, nmemb, &obj_req->range);
+}
+
+static void start_range_request(struct object_request *obj_req,
+				unsigned long offset, unsigned long end)
+{
+	struct remote_pack *rp = obj_req->in_pack;
+	char range[RANGE_HEADER_SIZE];
+	struct active_request_slot *slot;
+
+	obj_req->url = xmalloc(strlen(obj_req->repo->base) + 65);
+	sprintf(obj_req->url, "%s/objects/pack/pack-%s.pack",
+		obj_req->repo->base, sha1_to_hex(rp->pack->sha1));
+	if (end)
+		sprintf(range, "Range: bytes=%lu-%lu", offset, end - 1);
+	else
+		sprintf(range, "Range: bytes=%lu-", offset);
+	obj_req->range_header = curl_slist_append(NULL, "Pragma:");
+	obj_req->range_header = curl_slist_append(obj_req->range_header,
+						  range);
+	obj_req->range.size = end ? end - offset : 4096;
+	obj_req->range.posn = 0;
+	obj_req->range.buffer = xmalloc(obj_req->range.size);
+
+	if (get_verbosely)
+		fprintf(stderr, "Getting %s from pack %s\n",
+			sha1_to_hex(obj_req->sha1),
+			sha1_to_hex(rp->pack->sha1));
+
+	slot = get_active_slot();
+	slot->callback_func = process_object_response;
+	slot->callback_data = obj_req;
+	obj_req->slot = slot;
+
+	curl_easy_setopt(slot->curl, CURLOPT_FILE, obj_req);
+	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_range);
+	curl_easy_setopt(slot->curl, CURLOPT_ERRORBUFFER, obj_req->errorstr);
+	curl_easy_setopt(slot->curl, CURLOPT_URL, obj_req->url);
+	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER,
+			 obj_req->range_header);
+
+	obj_req->state = ACTIVE;
+	if (!start_active_slot(slot)) {
+		obj_req->state = COMPLETE;
+		obj_req->slot = NULL;
+		rp->whole = 1;
+	}
+}
+
+/*
+ * Ask for the object the way that costs least: by itself if it is
+ * loose or we do not know where it is, by its bytes of the remote
+ * pack it is in if we want only a few from that, and otherwise not
+ * at all; fetch() then gets the whole pack.
+ */
+static void start_request(struct object_request *obj_req)
+{
+	struct remote_pack *rp = NULL;
+	unsigned long offset, end, length;
+
+	if (obj_req->repo->got_indices)
+		rp = find_remote_pack(obj_req->repo, obj_req->sha1, &offset);
+	if (!rp) {
+		start_object_request(obj_req);
+		return;
+	}
+	obj_req->in_pack = rp;
+	end = object_end(rp, offset);
+	length = (end ? end - offset : 0) + RANGE_REQUEST_COST;
+	if (use_ranges && !rp->whole && rp->nr &&
+	    rp->ranged + length <= rp->offsets[rp->nr - 1] / RANGE_FRACTION) {
+		rp->ranged += length;
+		start_range_request(obj_req, offset, end);
+		return;
+	}
+	rp->whole = 1;
+	obj_req->state = COMPLETE;
+}
+
+static void *inflate_range(unsigned char *data, unsigned long len,
+			   unsigned long size)
+{
+	z_stream stream;
+	void *buf = xmalloc(size + 1);
+	int ret;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = data;
+	stream.avail_in = len;
+	stream.next_out = buf;
+	stream.avail_out = size + 1;
+	inflateInit(&stream);
+	ret = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	if (ret != Z_STREAM_END || stream.total_out != size) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/*
+ * Write out the object whose bytes of the pack we have got.  Returns
+ * 1 if it is a delta against an object we do not have yet.
+ */
+static int unpack_range(struct object_request *obj_req)
+{
+	unsigned char *data = obj_req->range.buffer;
+	unsigned long len = obj_req->range.posn, used = 1, size;
+	unsigned char c, sha1[20];
+	const char *type;
+	char base_type[20];
+	void *buf;
+	int shift = 4;
+
+	if (!len)
+		return -1;
+	c = data[0];
+	size = c & 15;
+	while (c & 0x80) {
+		if (used >= len)
+			return -1;
+		c = data[used++];
+		size += (c & 0x7f) << shift;
+		shift += 7;
+	}
+	switch ((data[0] >> 4) & 7) {
+	case OBJ_COMMIT: type = "commit"; break;
+	case OBJ_TREE: type = "tree"; break;
+	case OBJ_BLOB: type = "blob"; break;
+	case OBJ_TAG: type = "tag"; break;
+	case OBJ_DELTA:
+		if (used + 20 > len)
+			return -1;
+		memcpy(obj_req->base_sha1, data + used, 20);
+		used += 20;
+		if (!has_sha1_file(obj_req->base_sha1))
+			return 1;
+		type = base_type;
+		break;
+	default:
+		return -1;
+	}
+	buf = inflate_range(data + used, len - used, size);
+	if (!buf)
+		return -1;
+	if (type == base_type) {
+		unsigned long base_size;
+		void *base, *result;
+
+		base = read_sha1_file(obj_req->base_sha1, base_type, &base_size);
+		if (!base) {
+			free(buf);
+			return -1;
+		}
+		result = patch_delta(base, base_size, buf, size, &size);
+		free(base);
+		free(buf);
+		if (!result)
+			return -1;
+		buf = result;
+	}
+	if (write_sha1_file(buf, size, type, sha1) ||
+	    memcmp(sha1, obj_req->sha1, 20)) {
+		free(buf);
+		return error("File %s from pack %s has bad hash",
+			     sha1_to_hex(obj_req->sha1),
+			     sha1_to_hex(obj_req->in_pack->pack->sha1));
+	}
+	free(buf);
+	pull_say("got %s\n", sha1_to_hex(obj_req->sha1));
+	return 0;
+}
+
+static struct object_request *queue_request(unsigned char *sha1);
+
+static void finish_range_request(struct object_request *obj_req)
+{
+	int ret = -1;
+
+	if (obj_req->curl_result == CURLE_OK && obj_req->http_code == 206)
+		ret = unpack_range(obj_req);
+	if (ret < 0) {
+		obj_req->in_pack->whole = 1;
+	} else if (ret > 0) {
+		/*
+		 * Ask for the base along with the rest; fetch_object()
+		 * waits for it and then applies the delta.
+		 */
+		obj_req->need_base = 1;
+		queue_request(obj_req->base_sha1)->repo = obj_req->repo;
+	}
+}
+
 #ifdef USE_CURL_MULTI
 void fill_active_slots(void)
 {
 	struct object_request *obj_req = object_queue_head;
-	struct active_request_slot *slot = active_queue_head;
 	int num_transfers;
 
 	while (active_requests < max_requests && obj_req != NULL) {
@@ -313,23 +609,21 @@ void fill_active_slots(void)
 			if (has_sha1_file(obj_req->sha1))
 				release_object_request(obj_req);
 			else
-				start_object_request(obj_req);
+				start_request(obj_req);
 			curl_multi_perform(curlm, &num_transfers);
 		}
 		obj_req = obj_req->next;
 	}
 
-	while (slot != NULL) {
-		if (!slot->in_use && slot->curl != NULL) {
-			curl_easy_cleanup(slot->curl);
-			slot->curl = NULL;
-		}
-		slot = slot->next;
-	}				
+	/*
+	 * Keep the handles of idle slots, and with them their
+	 * connections, for the requests that follow; there are never
+	 * many more slots than max_requests.
+	 */
 }
 #endif
 
-void prefetch(unsigned char *sha1)
+static struct object_request *queue_request(unsigned char *sha1)
 {
 	struct object_request *newreq;
 	struct object_request *tail;
@@ -341,6 +635,10 @@ void prefetch(unsigned char *sha1)
 	newreq->url = NULL;
 	newreq->local = -1;
 	newreq->state = WAITING;
+	newreq->in_pack = NULL;
+	newreq->range.buffer = NULL;
+	newreq->range_header = NULL;
+	newreq->need_base = 0;
 	snprintf(newreq->filename, sizeof(newreq->filename), "%s", filename);
 	snprintf(newreq->tmpfile, sizeof(newreq->tmpfile),
 		 "%s.temp", filename);
@@ -355,6 +653,12 @@ void prefetch(unsigned char *sha1)
 		}
 		tail->next = newreq;
 	}
+	return newreq;
+}
+
+void prefetch(unsigned char *sha1)
+{
+	queue_request(sha1);
 
 #ifdef USE_CURL_MULTI
 	fill_active_slots();
@@ -362,84 +666,108 @@ void prefetch(unsigned char *sha1)
 #endif
 }
 
-static int fetch_index(struct alt_base *repo, unsigned char *sha1)
+struct index_request
 {
-	char *hex = sha1_to_hex(sha1);
-	char *filename;
+	struct alt_base *repo;
+	unsigned char sha1[20];
 	char *url;
 	char tmpfile[PATH_MAX];
-	long prev_posn = 0;
-	char range[RANGE_HEADER_SIZE];
-	struct curl_slist *range_header = NULL;
-
 	FILE *indexfile;
+	struct curl_slist *range_header;
+	char errorstr[CURL_ERROR_SIZE];
+	int ret;
 	struct active_request_slot *slot;
+};
 
-	if (has_pack_index(sha1))
-		return 0;
+static void process_index_response(void *callback_data)
+{
+	struct index_request *idx_req = (struct index_request *)callback_data;
+	struct active_request_slot *slot = idx_req->slot;
+
+	idx_req->slot = NULL;
+	fclose(idx_req->indexfile);
+	if (slot->curl_result != CURLE_OK)
+		idx_req->ret = error("Unable to get pack index %s\n%s",
+				     idx_req->url, idx_req->errorstr);
+	else
+		idx_req->ret = move_temp_to_file(idx_req->tmpfile,
+					sha1_pack_index_name(idx_req->sha1));
+}
+
+/*
+ * Start getting the index of a remote pack; fetch_indices() asks for
+ * all of them before waiting for any.
+ */
+static int start_index_request(struct index_request *idx_req)
+{
+	char *hex = sha1_to_hex(idx_req->sha1);
+	long prev_posn = 0;
+	char range[RANGE_HEADER_SIZE];
+	struct active_request_slot *slot;
 
 	if (get_verbosely)
 		fprintf(stderr, "Getting index for pack %s\n", hex);
-	
-	url = xmalloc(strlen(repo->base) + 64);
-	sprintf(url, "%s/objects/pack/pack-%s.idx", repo->base, hex);
-	
-	filename = sha1_pack_index_name(sha1);
-	snprintf(tmpfile, sizeof(tmpfile), "%s.temp", filename);
-	indexfile = fopen(tmpfile, "a");
-	if (!indexfile)
-		return error("Unable to open local file %s for pack index",
-			     filename);
+
+	idx_req->url = xmalloc(strlen(idx_req->repo->base) + 64);
+	sprintf(idx_req->url, "%s/objects/pack/pack-%s.idx",
+		idx_req->repo->base, hex);
+	snprintf(idx_req->tmpfile, sizeof(idx_req->tmpfile), "%s.temp",
+		 sha1_pack_index_name(idx_req->sha1));
+	idx_req->range_header = NULL;
+	idx_req->slot = NULL;
+	idx_req->indexfile = fopen(idx_req->tmpfile, "a");
+	if (!idx_req->indexfile)
+		return idx_req->ret =
+			error("Unable to open local file %s for pack index",
+			      idx_req->tmpfile);
 
 	slot = get_active_slot();
-	curl_easy_setopt(slot->curl, CURLOPT_FILE, indexfile);
+	slot->callback_func = process_index_response;
+	slot->callback_data = idx_req;
+	curl_easy_setopt(slot->curl, CURLOPT_FILE, idx_req->indexfile);
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite);
-	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
+	curl_easy_setopt(slot->curl, CURLOPT_ERRORBUFFER, idx_req->errorstr);
+	curl_easy_setopt(slot->curl, CURLOPT_URL, idx_req->url);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, no_pragma_header);
-	slot->local = indexfile;
+	slot->local = idx_req->indexfile;
 
 	/* If there is data present from a previous transfer attempt,
 	   resume where it left off */
-	prev_posn = ftell(indexfile);
+	prev_posn = ftell(idx_req->indexfile);
 	if (prev_posn>0) {
 		if (get_verbosely)
 			fprintf(stderr,
 				"Resuming fetch of index for pack %s at byte %ld\n",
 				hex, prev_posn);
 		sprintf(range, "Range: bytes=%ld-", prev_posn);
-		range_header = curl_slist_append(range_header, range);
-		curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, range_header);
+		idx_req->range_header = curl_slist_append(NULL, range);
+		curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER,
+				 idx_req->range_header);
 	}
 
-	if (start_active_slot(slot)) {
-		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK) {
-			fclose(indexfile);
-			return error("Unable to get pack index %s\n%s", url,
-				     curl_errorstr);
-		}
-	} else {
-		fclose(indexfile);
-		return error("Unable to start request");
+	if (!start_active_slot(slot)) {
+		fclose(idx_req->indexfile);
+		return idx_req->ret = error("Unable to start request");
 	}
-
-	fclose(indexfile);
-
-	return move_temp_to_file(tmpfile, filename);
+	idx_req->slot = slot;
+	return 0;
 }
 
 static int setup_index(struct alt_base *repo, unsigned char *sha1)
 {
 	struct packed_git *new_pack;
-	if (has_pack_file(sha1))
-		return 0; // don't list this as something we can get
-
-	if (fetch_index(repo, sha1))
-		return -1;
+	struct remote_pack *rp;
 
 	new_pack = parse_pack_index(sha1);
+	if (!new_pack)
+		return -1;
 	new_pack->next = repo->packs;
 	repo->packs = new_pack;
+
+	rp = xcalloc(1, sizeof(*rp));
+	rp->pack = new_pack;
+	rp->next = repo->remote_packs;
+	repo->remote_packs = rp;
 	return 0;
 }
 
@@ -466,6 +794,8 @@ static void process_alternates_response(void *callback_data)
 					 alt_req->url);
 			active_requests++;
 			slot->in_use = 1;
+			if (slot->finished != NULL)
+				(*slot->finished) = 0;
 			if (start_active_slot(slot)) {
 				return;
 			} else {
@@ -534,6 +864,7 @@ static void process_alternates_response(void *callback_data)
 				newalt->base = target;
 				newalt->got_indices = 0;
 				newalt->packs = NULL;
+				newalt->remote_packs = NULL;
 				while (tail->next != NULL)
 					tail = tail->next;
 				tail->next = newalt;
@@ -611,9 +942,11 @@ static int fetch_indices(struct alt_base *repo)
 	char *url;
 	struct buffer buffer;
 	char *data;
-	int i = 0;
+	int i = 0, j, nr = 0, alloc = 0;
+	struct index_request *idx_req = NULL;
 
 	struct active_request_slot *slot;
+	struct slot_results results;
 
 	if (repo->got_indices)
 		return 0;
@@ -634,10 +967,11 @@ static int fetch_indices(struct alt_base *repo)
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, NULL);
+	slot->results = &results;
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK) {
-			if (slot->http_code == 404) {
+		if (results.curl_result != CURLE_OK) {
+			if (results.http_code == 404) {
 				repo->got_indices = 1;
 				free(buffer.buffer);
 				return 0;
@@ -658,12 +992,25 @@ static int fetch_indices(struct alt_base *repo)
 		switch (data[i]) {
 		case 'P':
 			i++;
-			if (i + 52 < buffer.posn &&
+			if (i + 52 <= buffer.posn &&
 			    !strncmp(data + i, " pack-", 6) &&
 			    !strncmp(data + i + 46, ".pack\n", 6)) {
 				get_sha1_hex(data + i + 6, sha1);
-				setup_index(repo, sha1);
 				i += 51;
+				if (has_pack_file(sha1))
+					break; /* not something we can get */
+				if (nr == alloc) {
+					alloc = alloc_nr(alloc);
+					idx_req = xrealloc(idx_req,
+						alloc * sizeof(*idx_req));
+				}
+				idx_req[nr].repo = repo;
+				memcpy(idx_req[nr].sha1, sha1, 20);
+				idx_req[nr].url = NULL;
+				idx_req[nr].ret = 0;
+				idx_req[nr].slot = NULL;
+				idx_req[nr].range_header = NULL;
+				nr++;
 				break;
 			}
 		default:
@@ -673,6 +1020,20 @@ static int fetch_indices(struct alt_base *repo)
 		i++;
 	}
 
+	for (j = 0; j < nr; j++)
+		if (!has_pack_index(idx_req[j].sha1))
+			start_index_request(&idx_req[j]);
+	for (j = 0; j < nr; j++) {
+		while (idx_req[j].slot)
+			run_active_slot(idx_req[j].slot);
+		if (!idx_req[j].ret)
+			setup_index(repo, idx_req[j].sha1);
+		free(idx_req[j].url);
+		if (idx_req[j].range_header)
+			curl_slist_free_all(idx_req[j].range_header);
+	}
+	free(idx_req);
+
 	free(buffer.buffer);
 	repo->got_indices = 1;
 	return 0;
@@ -683,6 +1044,7 @@ static int fetch_pack(struct alt_base *repo, unsigned char *sha1)
 	char *url;
 	struct packed_git *target;
 	struct packed_git **lst;
+	struct remote_pack **rp;
 	FILE *packfile;
 	char *filename;
 	char tmpfile[PATH_MAX];
@@ -692,6 +1054,7 @@ static int fetch_pack(struct alt_base *repo, unsigned char *sha1)
 	struct curl_slist *range_header = NULL;
 
 	struct active_request_slot *slot;
+	struct slot_results results;
 
 	if (fetch_indices(repo))
 		return -1;
@@ -723,6 +1086,7 @@ static int fetch_pack(struct alt_base *repo, unsigned char *sha1)
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, no_pragma_header);
 	slot->local = packfile;
+	slot->results = &results;
 
 	/* If there is data present from a previous transfer attempt,
 	   resume where it left off */
@@ -739,7 +1103,7 @@ static int fetch_pack(struct alt_base *repo, unsigned char *sha1)
 
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK) {
+		if (results.curl_result != CURLE_OK) {
 			fclose(packfile);
 			return error("Unable to get pack file %s\n%s", url,
 				     curl_errorstr);
@@ -760,6 +1124,13 @@ static int fetch_pack(struct alt_base *repo, unsigned char *sha1)
 		lst = &((*lst)->next);
 	*lst = (*lst)->next;
 
+	/* Requests still in flight may point at it; just unlink it */
+	for (rp = &repo->remote_packs; *rp; rp = &(*rp)->next)
+		if ((*rp)->pack == target) {
+			*rp = (*rp)->next;
+			break;
+		}
+
 	if (verify_pack(target, 0))
 		return -1;
 	install_packed_git(target);
@@ -767,6 +1138,30 @@ static int fetch_pack(struct alt_base *repo, unsigned char *sha1)
 	return 0;
 }
 
+static int fetch_object(struct alt_base *repo, unsigned char *sha1);
+
+/*
+ * Returns 0 once the object from a remote pack is ours, or -1 to have
+ * fetch() get the whole pack.
+ */
+static int finish_in_pack(struct object_request *obj_req)
+{
+	if (has_sha1_file(obj_req->sha1))
+		return 0;
+	if (!obj_req->need_base)
+		return -1;
+	if (!has_sha1_file(obj_req->base_sha1) &&
+	    fetch_object(obj_req->repo, obj_req->base_sha1))
+		return -1;
+	if (has_sha1_file(obj_req->sha1))
+		return 0; /* the whole pack came in meanwhile */
+	if (unpack_range(obj_req)) {
+		obj_req->in_pack->whole = 1;
+		return -1;
+	}
+	return 0;
+}
+
 static int fetch_object(struct alt_base *repo, unsigned char *sha1)
 {
 	char *hex = sha1_to_hex(sha1);
@@ -784,11 +1179,14 @@ static int fetch_object(struct alt_base *repo, unsigned char *sha1)
 	}
 
 #ifdef USE_CURL_MULTI
+	/* It may have been queued with nothing in flight to start it */
+	if (obj_req->state == WAITING)
+		fill_active_slots();
 	while (obj_req->state == WAITING) {
 		step_active_slots();
 	}
 #else
-	start_object_request(obj_req);
+	start_request(obj_req);
 #endif
 
 	while (obj_req->state == ACTIVE) {
@@ -798,7 +1196,9 @@ static int fetch_object(struct alt_base *repo, unsigned char *sha1)
 		close(obj_req->local); obj_req->local = -1;
 	}
 
-	if (obj_req->state == ABORTED) {
+	if (obj_req->in_pack) {
+		ret = finish_in_pack(obj_req);
+	} else if (obj_req->state == ABORTED) {
 		ret = error("Request for %s aborted", hex);
 	} else if (obj_req->curl_result != CURLE_OK &&
 		   obj_req->http_code != 416) {
@@ -822,6 +1222,24 @@ static int fetch_object(struct alt_base *repo, unsigned char *sha1)
 	return ret;
 }
 
+/*
+ * The object is not loose in repo; get it out of one of its packs,
+ * by itself if start_request() thinks that is cheaper.
+ */
+static int fetch_from_pack(struct alt_base *repo, unsigned char *sha1)
+{
+	unsigned long offset;
+
+	if (fetch_indices(repo))
+		return -1;
+	if (use_ranges && find_remote_pack(repo, sha1, &offset)) {
+		queue_request(sha1)->repo = repo;
+		if (!fetch_object(repo, sha1))
+			return 0;
+	}
+	return fetch_pack(repo, sha1);
+}
+
 int fetch(unsigned char *sha1)
 {
 	struct alt_base *altbase = alt;
@@ -829,7 +1247,7 @@ int fetch(unsigned char *sha1)
 	if (!fetch_object(altbase, sha1))
 		return 0;
 	while (altbase) {
-		if (!fetch_pack(altbase, sha1))
+		if (!fetch_from_pack(altbase, sha1))
 			return 0;
 		fetch_alternates(alt->base);
 		altbase = altbase->next;
@@ -890,6 +1308,7 @@ int fetch_ref(char *ref, unsigned char *sha1)
         struct buffer buffer;
 	char *base = alt->base;
 	struct active_request_slot *slot;
+	struct slot_results results;
         buffer.size = 41;
         buffer.posn = 0;
         buffer.buffer = hex;
@@ -901,9 +1320,10 @@ int fetch_ref(char *ref, unsigned char *sha1)
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, NULL);
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
+	slot->results = &results;
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK)
+		if (results.curl_result != CURLE_OK)
 			return error("Couldn't get %s for %s\n%s",
 				     url, ref, curl_errorstr);
 	} else {
@@ -915,6 +1335,11 @@ int fetch_ref(char *ref, unsigned char *sha1)
         return 0;
 }
 
+static int found_ref(const char *path, const unsigned char *sha1)
+{
+	return 1;
+}
+
 int main(int argc, char **argv)
 {
 	char *commit_id;
@@ -958,8 +1383,16 @@ int main(int argc, char **argv)
 	alt->base = url;
 	alt->got_indices = 0;
 	alt->packs = NULL;
+	alt->remote_packs = NULL;
 	alt->next = NULL;
 
+	/*
+	 * Without any refs of our own, we will want (almost) everything
+	 * in the remote packs; do not bother with ranges.
+	 */
+	if (!for_each_ref(found_ref))
+		use_ranges = 0;
+
 	if (pull(commit_id))
 		rc = 1;
 
@@ -6,6 +6,7 @@
 #include "blob.h"
 #include "http.h"
 
+#include <sys/wait.h>
 #include <expat.h>
 
 static const char http_push_usage[] =
@@ -50,10 +51,21 @@ enum XML_Status {
 #define LOCK_TIME 600
 #define LOCK_REFRESH 30
 
+/* What we know of the remote objects/xx/ directories */
+#define DIR_UNKNOWN 0
+#define DIR_EXISTS 1
+#define DIR_CREATING 2	/* a MKCOL for it is on its way */
+
 static int pushing = 0;
 static int aborted = 0;
 static char remote_dir_exists[256];
 
+/*
+ * A push of this many objects or more goes up as one pack and its
+ * index, instead of a MKCOL, PUT and MOVE for every object.
+ */
+static int push_pack_limit = 10;
+
 static struct curl_slist *no_pragma_header;
 static struct curl_slist *default_headers;
 
@@ -194,6 +206,7 @@ static void start_mkcol(struct transfer_request *request)
 	if (start_active_slot(slot)) {
 		request->slot = slot;
 		request->state = RUN_MKCOL;
+		remote_dir_exists[request->sha1[0]] = DIR_CREATING;
 	} else {
 		request->state = ABORTED;
 		free(request->url);
@@ -312,6 +325,7 @@ static void start_move(struct transfer_request *request)
 static int refresh_lock(struct active_lock *lock)
 {
 	struct active_request_slot *slot;
+	struct slot_results results;
 	char *if_header;
 	char timeout_header[25];
 	struct curl_slist *dav_headers = NULL;
@@ -326,6 +340,7 @@ static int refresh_lock(struct active_lock *lock)
 	dav_headers = curl_slist_append(dav_headers, timeout_header);
 
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPGET, 1);
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_null);
 	curl_easy_setopt(slot->curl, CURLOPT_URL, lock->url);
@@ -334,8 +349,8 @@ static int refresh_lock(struct active_lock *lock)
 
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK) {
-			fprintf(stderr, "Got HTTP error %ld\n", slot->http_code);
+		if (results.curl_result != CURLE_OK) {
+			fprintf(stderr, "Got HTTP error %ld\n", results.http_code);
 		} else {
 			lock->start_time = time(NULL);
 			rc = 1;
@@ -381,7 +396,7 @@ static void finish_request(struct transfer_request *request)
 		if (request->http_code == 404) {
 			request->state = NEED_PUSH;
 		} else if (request->curl_result == CURLE_OK) {
-			remote_dir_exists[request->sha1[0]] = 1;
+			remote_dir_exists[request->sha1[0]] = DIR_EXISTS;
 			request->state = COMPLETE;
 		} else {
 			fprintf(stderr, "HEAD %s failed, aborting (%d/%ld)\n",
@@ -393,7 +408,7 @@ static void finish_request(struct transfer_request *request)
 	} else if (request->state == RUN_MKCOL) {
 		if (request->curl_result == CURLE_OK ||
 		    request->http_code == 405) {
-			remote_dir_exists[request->sha1[0]] = 1;
+			remote_dir_exists[request->sha1[0]] = DIR_EXISTS;
 			start_put(request);
 		} else {
 			fprintf(stderr, "MKCOL %s failed, aborting (%d/%ld)\n",
@@ -447,10 +462,14 @@ static void release_request(struct transfer_request *request)
 	free(request);
 }
 
+/*
+ * Idle curl handles are kept, so that their connections are reused.
+ * Only one MKCOL is sent for each objects/xx/ directory; the other
+ * objects that go there wait for it rather than send their own.
+ */
 void fill_active_slots(void)
 {
 	struct transfer_request *request = request_queue_head;
-	struct active_request_slot *slot = active_queue_head;
 	int num_transfers;
 
 	if (aborted)
@@ -461,22 +480,21 @@ void fill_active_slots(void)
 			start_check(request);
 			curl_multi_perform(curlm, &num_transfers);
 		} else if (pushing && request->state == NEED_PUSH) {
-			if (remote_dir_exists[request->sha1[0]])
+			switch (remote_dir_exists[request->sha1[0]]) {
+			case DIR_EXISTS:
 				start_put(request);
-			else
+				break;
+			case DIR_UNKNOWN:
 				start_mkcol(request);
+				break;
+			default:
+				request = request->next;
+				continue;
+			}
 			curl_multi_perform(curlm, &num_transfers);
 		}
 		request = request->next;
 	}
-
-	while (slot != NULL) {
-		if (!slot->in_use && slot->curl != NULL) {
-			curl_easy_cleanup(slot->curl);
-			slot->curl = NULL;
-		}
-		slot = slot->next;
-	}				
 }
 
 static void add_request(unsigned char *sha1, struct active_lock *lock)
@@ -518,16 +536,18 @@ static int fetch_index(unsigned char *sha1)
 
 	FILE *indexfile;
 	struct active_request_slot *slot;
+	struct slot_results results;
 
 	/* Don't use the index if the pack isn't there */
 	url = xmalloc(strlen(remote->url) + 65);
 	sprintf(url, "%s/objects/pack/pack-%s.pack", remote->url, hex);
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 1);
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK) {
+		if (results.curl_result != CURLE_OK) {
 			free(url);
 			return error("Unable to verify pack %s is available",
 				     hex);
@@ -552,6 +572,7 @@ static int fetch_index(unsigned char *sha1)
 			     filename);
 
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 0);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPGET, 1);
 	curl_easy_setopt(slot->curl, CURLOPT_FILE, indexfile);
@@ -575,7 +596,7 @@ static int fetch_index(unsigned char *sha1)
 
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK) {
+		if (results.curl_result != CURLE_OK) {
 			free(url);
 			fclose(indexfile);
 			return error("Unable to get pack index %s\n%s", url,
@@ -615,6 +636,7 @@ static int fetch_indices(void)
 	int i = 0;
 
 	struct active_request_slot *slot;
+	struct slot_results results;
 
 	data = xmalloc(4096);
 	memset(data, 0, 4096);
@@ -629,16 +651,17 @@ static int fetch_indices(void)
 	sprintf(url, "%s/objects/info/packs", remote->url);
 
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_FILE, &buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, NULL);
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK) {
+		if (results.curl_result != CURLE_OK) {
 			free(buffer.buffer);
 			free(url);
-			if (slot->http_code == 404)
+			if (results.http_code == 404)
 				return 0;
 			else
 				return error("%s", curl_errorstr);
@@ -655,7 +678,7 @@ static int fetch_indices(void)
 		switch (data[i]) {
 		case 'P':
 			i++;
-			if (i + 52 < buffer.posn &&
+			if (i + 52 <= buffer.posn &&
 			    !strncmp(data + i, " pack-", 6) &&
 			    !strncmp(data + i + 46, ".pack\n", 6)) {
 				get_sha1_hex(data + i + 6, sha1);
@@ -726,6 +749,7 @@ int fetch_ref(char *ref, unsigned char *sha1)
         struct buffer buffer;
 	char *base = remote->url;
 	struct active_request_slot *slot;
+	struct slot_results results;
         buffer.size = 41;
         buffer.posn = 0;
         buffer.buffer = hex;
@@ -733,13 +757,14 @@ int fetch_ref(char *ref, unsigned char *sha1)
         
 	url = quote_ref_url(base, ref);
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_FILE, &buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, NULL);
 	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result != CURLE_OK)
+		if (results.curl_result != CURLE_OK)
 			return error("Couldn't get %s for %s\n%s",
 				     url, ref, curl_errorstr);
 	} else {
@@ -851,6 +876,7 @@ xml_cdata(void *userData, const XML_Char *s, int len)
 static struct active_lock *lock_remote(char *file, long timeout)
 {
 	struct active_request_slot *slot;
+	struct slot_results results;
 	struct buffer out_buffer;
 	struct buffer in_buffer;
 	char *out_data;
@@ -872,14 +898,15 @@ static struct active_lock *lock_remote(char *file, long timeout)
 	while (ep) {
 		*ep = 0;
 		slot = get_active_slot();
+		slot->results = &results;
 		curl_easy_setopt(slot->curl, CURLOPT_HTTPGET, 1);
 		curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 		curl_easy_setopt(slot->curl, CURLOPT_CUSTOMREQUEST, DAV_MKCOL);
 		curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_null);
 		if (start_active_slot(slot)) {
 			run_active_slot(slot);
-			if (slot->curl_result != CURLE_OK &&
-			    slot->http_code != 405) {
+			if (results.curl_result != CURLE_OK &&
+			    results.http_code != 405) {
 				fprintf(stderr,
 					"Unable to create branch path %s\n",
 					url);
@@ -911,6 +938,7 @@ static struct active_lock *lock_remote(char *file, long timeout)
 	dav_headers = curl_slist_append(dav_headers, "Content-Type: text/xml");
 
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_INFILE, &out_buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_INFILESIZE, out_buffer.size);
 	curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, fread_buffer);
@@ -929,7 +957,7 @@ static struct active_lock *lock_remote(char *file, long timeout)
 
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result == CURLE_OK) {
+		if (results.curl_result == CURLE_OK) {
 			ctx.name = xcalloc(10, 1);
 			ctx.len = 0;
 			ctx.cdata = NULL;
@@ -976,6 +1004,7 @@ static struct active_lock *lock_remote(char *file, long timeout)
 static int unlock_remote(struct active_lock *lock)
 {
 	struct active_request_slot *slot;
+	struct slot_results results;
 	char *lock_token_header;
 	struct curl_slist *dav_headers = NULL;
 	int rc = 0;
@@ -986,6 +1015,7 @@ static int unlock_remote(struct active_lock *lock)
 	dav_headers = curl_slist_append(dav_headers, lock_token_header);
 
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_null);
 	curl_easy_setopt(slot->curl, CURLOPT_URL, lock->url);
 	curl_easy_setopt(slot->curl, CURLOPT_CUSTOMREQUEST, DAV_UNLOCK);
@@ -993,11 +1023,11 @@ static int unlock_remote(struct active_lock *lock)
 
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result == CURLE_OK)
+		if (results.curl_result == CURLE_OK)
 			rc = 1;
 		else
 			fprintf(stderr, "Got HTTP error %ld\n",
-				slot->http_code);
+				results.http_code);
 	} else {
 		fprintf(stderr, "Unable to start request\n");
 	}
@@ -1017,6 +1047,7 @@ static int unlock_remote(struct active_lock *lock)
 static int locking_available(void)
 {
 	struct active_request_slot *slot;
+	struct slot_results results;
 	struct buffer in_buffer;
 	struct buffer out_buffer;
 	char *in_data;
@@ -1042,6 +1073,7 @@ static int locking_available(void)
 	dav_headers = curl_slist_append(dav_headers, "Content-Type: text/xml");
 	
 	slot = get_active_slot();
+	slot->results = &results;
 	curl_easy_setopt(slot->curl, CURLOPT_INFILE, &out_buffer);
 	curl_easy_setopt(slot->curl, CURLOPT_INFILESIZE, out_buffer.size);
 	curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, fread_buffer);
@@ -1054,7 +1086,7 @@ static int locking_available(void)
 
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		if (slot->curl_result == CURLE_OK) {
+		if (results.curl_result == CURLE_OK) {
 			ctx.name = xcalloc(10, 1);
 			ctx.len = 0;
 			ctx.cdata = NULL;
@@ -1163,19 +1195,56 @@ static void get_delta(unsigned char *sha1, struct object *obj,
 	}
 }
 
-static int update_remote(unsigned char *sha1, struct active_lock *lock)
+/* PUT the buffer to the file the lock is held on */
+static int put_locked(struct active_lock *lock, struct buffer *out_buffer)
 {
 	struct active_request_slot *slot;
-	char *out_data;
+	struct slot_results results;
 	char *if_header;
-	struct buffer out_buffer;
 	struct curl_slist *dav_headers = NULL;
-	int i;
+	int rc = 0;
 
 	if_header = xmalloc(strlen(lock->token) + 25);
 	sprintf(if_header, "If: (<opaquelocktoken:%s>)", lock->token);
 	dav_headers = curl_slist_append(dav_headers, if_header);
 
+	slot = get_active_slot();
+	slot->results = &results;
+	curl_easy_setopt(slot->curl, CURLOPT_INFILE, out_buffer);
+	curl_easy_setopt(slot->curl, CURLOPT_INFILESIZE, out_buffer->size);
+	curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, fread_buffer);
+	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_null);
+	curl_easy_setopt(slot->curl, CURLOPT_CUSTOMREQUEST, DAV_PUT);
+	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, dav_headers);
+	curl_easy_setopt(slot->curl, CURLOPT_UPLOAD, 1);
+	curl_easy_setopt(slot->curl, CURLOPT_PUT, 1);
+	curl_easy_setopt(slot->curl, CURLOPT_URL, lock->url);
+
+	if (start_active_slot(slot)) {
+		run_active_slot(slot);
+		if (results.curl_result != CURLE_OK) {
+			fprintf(stderr,
+				"PUT error: curl result=%d, HTTP code=%ld\n",
+				results.curl_result, results.http_code);
+			/* We should attempt recovery? */
+		} else {
+			rc = 1;
+		}
+	} else {
+		fprintf(stderr, "Unable to start PUT request\n");
+	}
+
+	curl_slist_free_all(dav_headers);
+	free(if_header);
+	return rc;
+}
+
+static int update_remote(unsigned char *sha1, struct active_lock *lock)
+{
+	char *out_data;
+	struct buffer out_buffer;
+	int i, rc;
+
 	out_buffer.size = 41;
 	out_data = xmalloc(out_buffer.size + 1);
 	i = snprintf(out_data, out_buffer.size + 1, "%s\n", sha1_to_hex(sha1));
@@ -1186,36 +1255,268 @@ static int update_remote(unsigned char *sha1, struct active_lock *lock)
 	out_buffer.posn = 0;
 	out_buffer.buffer = out_data;
 
+	rc = put_locked(lock, &out_buffer);
+	free(out_data);
+	return rc;
+}
+
+/*
+ * Feed the objects the remote lacks to git-pack-objects, which
+ * leaves <base>-<name>.pack and .idx, and tell the name of the pack.
+ */
+static int make_push_pack(const char *base, unsigned char *pack_sha1)
+{
+	struct transfer_request *request;
+	int in[2], out[2];
+	pid_t pid;
+	int status, len = 0;
+	char line[41];
+	FILE *fp;
+
+	if (pipe(in) < 0)
+		return error("http-push: pipe failed");
+	if (pipe(out) < 0) {
+		close(in[0]);
+		close(in[1]);
+		return error("http-push: pipe failed");
+	}
+	pid = fork();
+	if (pid < 0)
+		return error("http-push: unable to fork git-pack-objects");
+	if (!pid) {
+		dup2(in[0], 0);
+		dup2(out[1], 1);
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		execlp("git-pack-objects", "git-pack-objects", base, NULL);
+		die("git-pack-objects exec failed (%s)", strerror(errno));
+	}
+	close(in[0]);
+	close(out[1]);
+
+	fp = fdopen(in[1], "w");
+	for (request = request_queue_head; request; request = request->next)
+		if (request->state == NEED_PUSH)
+			fprintf(fp, "%s\n", sha1_to_hex(request->sha1));
+	fclose(fp);
+
+	while (len < sizeof(line)) {
+		int n = xread(out[0], line + len, sizeof(line) - len);
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close(out[0]);
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			return error("http-push: waitpid failed");
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return error("git-pack-objects failed");
+	if (len < sizeof(line) || get_sha1_hex(line, pack_sha1))
+		return error("git-pack-objects did not name its pack");
+	return 0;
+}
+
+static void put_file_done(void *done)
+{
+	*(int *)done = 1;
+}
+
+static struct active_request_slot *start_put_file(char *url, FILE *fp,
+						  struct slot_results *results,
+						  int *done)
+{
+	struct active_request_slot *slot;
+	struct stat st;
+
+	if (fstat(fileno(fp), &st))
+		return NULL;
 	slot = get_active_slot();
-	curl_easy_setopt(slot->curl, CURLOPT_INFILE, &out_buffer);
-	curl_easy_setopt(slot->curl, CURLOPT_INFILESIZE, out_buffer.size);
-	curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, fread_buffer);
+	slot->results = results;
+	slot->callback_func = put_file_done;
+	slot->callback_data = done;
+	curl_easy_setopt(slot->curl, CURLOPT_INFILE, fp);
+	curl_easy_setopt(slot->curl, CURLOPT_INFILESIZE, (long)st.st_size);
+	curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, fread);
 	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_null);
 	curl_easy_setopt(slot->curl, CURLOPT_CUSTOMREQUEST, DAV_PUT);
-	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, dav_headers);
 	curl_easy_setopt(slot->curl, CURLOPT_UPLOAD, 1);
 	curl_easy_setopt(slot->curl, CURLOPT_PUT, 1);
-	curl_easy_setopt(slot->curl, CURLOPT_URL, lock->url);
+	curl_easy_setopt(slot->curl, CURLOPT_NOBODY, 0);
+	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
+	if (!start_active_slot(slot))
+		return NULL;
+	return slot;
+}
+
+/*
+ * Put the pack and its index up side by side.  Nobody looks at
+ * them before objects/info/packs names the pack, so they need
+ * neither a temporary name nor a lock.
+ */
+static int put_pack(const char *base, unsigned char *pack_sha1)
+{
+	char *hex = sha1_to_hex(pack_sha1);
+	char *url[2];
+	char file[PATH_MAX + 47];	/* base-<sha1>.pack */
+	FILE *fp[2];
+	struct active_request_slot *slot[2];
+	struct slot_results results[2];
+	int done[2] = { 0, 0 };
+	int i, rc = 0;
+
+	url[0] = xmalloc(strlen(remote->url) + 13);
+	sprintf(url[0], "%sobjects/pack", remote->url);
+	slot[0] = get_active_slot();
+	slot[0]->results = &results[0];
+	curl_easy_setopt(slot[0]->curl, CURLOPT_HTTPGET, 1);
+	curl_easy_setopt(slot[0]->curl, CURLOPT_URL, url[0]);
+	curl_easy_setopt(slot[0]->curl, CURLOPT_CUSTOMREQUEST, DAV_MKCOL);
+	curl_easy_setopt(slot[0]->curl, CURLOPT_WRITEFUNCTION, fwrite_null);
+	if (!start_active_slot(slot[0])) {
+		free(url[0]);
+		return error("Unable to start request");
+	}
+	run_active_slot(slot[0]);
+	free(url[0]);
+	if (results[0].curl_result != CURLE_OK && results[0].http_code != 405)
+		return error("Unable to create objects/pack on %s",
+			     remote->url);
+
+	for (i = 0; i < 2; i++) {
+		const char *ext = i ? "idx" : "pack";
+		url[i] = xmalloc(strlen(remote->url) + 64);
+		sprintf(url[i], "%sobjects/pack/pack-%s.%s",
+			remote->url, hex, ext);
+		snprintf(file, sizeof(file), "%s-%s.%s", base, hex, ext);
+		fp[i] = fopen(file, "r");
+		slot[i] = fp[i] ? start_put_file(url[i], fp[i], &results[i],
+						  &done[i]) : NULL;
+		if (!slot[i])
+			rc = error("Unable to put %s", file);
+	}
+	for (i = 0; i < 2; i++) {
+		if (slot[i]) {
+			/* it may have finished while we waited for the other */
+			while (!done[i])
+				run_active_slot(slot[i]);
+			if (results[i].curl_result != CURLE_OK)
+				rc = error("PUT %s failed (%d/%ld)", url[i],
+					   results[i].curl_result,
+					   results[i].http_code);
+		}
+		if (fp[i])
+			fclose(fp[i]);
+		free(url[i]);
+	}
+	return rc;
+}
 
+/* Name the new pack first in the remote objects/info/packs */
+static int add_remote_pack_info(unsigned char *pack_sha1)
+{
+	struct active_lock *lock;
+	struct active_request_slot *slot;
+	struct slot_results results;
+	struct buffer buffer;
+	char *url;
+	int rc = -1;
+
+	lock = lock_remote("objects/info/packs", LOCK_TIME);
+	if (!lock)
+		return error("Unable to lock remote objects/info/packs");
+
+	buffer.size = 4096;
+	buffer.buffer = xmalloc(buffer.size);
+	buffer.posn = sprintf(buffer.buffer, "P pack-%s.pack\n",
+			      sha1_to_hex(pack_sha1));
+
+	url = xmalloc(strlen(remote->url) + 19);
+	sprintf(url, "%sobjects/info/packs", remote->url);
+	slot = get_active_slot();
+	slot->results = &results;
+	curl_easy_setopt(slot->curl, CURLOPT_HTTPGET, 1);
+	curl_easy_setopt(slot->curl, CURLOPT_FILE, &buffer);
+	curl_easy_setopt(slot->curl, CURLOPT_WRITEFUNCTION, fwrite_buffer);
+	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, no_pragma_header);
+	curl_easy_setopt(slot->curl, CURLOPT_URL, url);
 	if (start_active_slot(slot)) {
 		run_active_slot(slot);
-		free(out_data);
-		free(if_header);
-		if (slot->curl_result != CURLE_OK) {
-			fprintf(stderr,
-				"PUT error: curl result=%d, HTTP code=%ld\n",
-				slot->curl_result, slot->http_code);
-			/* We should attempt recovery? */
-			return 0;
+		if (results.curl_result == CURLE_OK || results.http_code == 404) {
+			buffer.size = buffer.posn;
+			buffer.posn = 0;
+			if (put_locked(lock, &buffer))
+				rc = 0;
+		} else {
+			error("Unable to get %s\n%s", url, curl_errorstr);
 		}
 	} else {
-		free(out_data);
-		free(if_header);
-		fprintf(stderr, "Unable to start PUT request\n");
-		return 0;
+		error("Unable to start request");
+	}
+
+	free(url);
+	free(buffer.buffer);
+	unlock_remote(lock);
+	return rc;
+}
+
+/*
+ * Send what the remote lacks as one pack.  If anything goes wrong,
+ * the objects are left to be sent one by one.
+ */
+static int push_pack(void)
+{
+	struct transfer_request *request;
+	unsigned char pack_sha1[20];
+	char base[PATH_MAX];
+	char file[PATH_MAX + 47];	/* base-<sha1>.pack */
+	int nr = 0, rc;
+
+	for (request = request_queue_head; request; request = request->next)
+		if (request->state == NEED_PUSH)
+			nr++;
+	if (!nr || nr < push_pack_limit)
+		return -1;
+
+	snprintf(base, sizeof(base), "%s",
+		 git_path("http-push-%d", (int)getpid()));
+	if (make_push_pack(base, pack_sha1))
+		return -1;
+	if (push_verbosely)
+		fprintf(stderr, "sending %d objects in pack-%s\n",
+			nr, sha1_to_hex(pack_sha1));
+
+	rc = put_pack(base, pack_sha1);
+	if (!rc)
+		rc = add_remote_pack_info(pack_sha1);
+
+	snprintf(file, sizeof(file), "%s-%s.pack",
+		 base, sha1_to_hex(pack_sha1));
+	unlink(file);
+	snprintf(file, sizeof(file), "%s-%s.idx",
+		 base, sha1_to_hex(pack_sha1));
+	unlink(file);
+
+	if (rc) {
+		fprintf(stderr, "Sending the objects one by one instead\n");
+		return -1;
 	}
+	for (request = request_queue_head; request; request = request->next)
+		if (request->state == NEED_PUSH)
+			request->state = COMPLETE;
+	return 0;
+}
 
-	return 1;
+static int http_push_config(const char *var, const char *value)
+{
+	if (!strcmp(var, "http.pushpacklimit")) {
+		push_pack_limit = git_config_int(var, value);
+		return 0;
+	}
+	return git_default_config(var, value);
 }
 
 int main(int argc, char **argv)
@@ -1239,6 +1540,7 @@ int main(int argc, char **argv)
 
 	setup_git_directory();
 	setup_ident();
+	git_config(http_push_config);
 
 	remote = xmalloc(sizeof(*remote));
 	remote->url = NULL;
@@ -1381,8 +1683,10 @@ int main(int argc, char **argv)
 			  local_object, remote_lock);
 		finish_all_active_slots();
 
-		/* Push missing objects to remote, this would be a
-		   convenient time to pack them first if appropriate. */
+		/* Push missing objects to remote, as one pack if there
+		   are enough of them, else (or if that fails) loose. */
+		if (!aborted)
+			push_pack();
 		pushing = 1;
 		fill_active_slots();
 		finish_all_active_slots();
@@ -6,6 +6,10 @@ int active_requests = 0;
 #ifdef USE_CURL_MULTI
 int max_requests = -1;
 CURLM *curlm;
+static int cleaning_up;		/* in http_cleanup(), start no more requests */
+#endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+long max_host_connections = -1;
 #endif
 #ifndef NO_CURL_EASY_DUPHANDLE
 CURL *curl_default;
@@ -29,6 +33,27 @@ struct curl_slist *no_range_header;
 
 struct active_request_slot *active_queue_head = NULL;
 
+/*
+ * What the finished requests cost, as curl saw them; shown when
+ * GIT_HTTP_STATS is set.  The times are summed over requests that
+ * may have run side by side, so they can add up to more than the
+ * wall clock.
+ */
+static int http_stats;
+static struct {
+	int requests;
+	int connects;		/* requests that had to open a connection */
+	int handshakes;		/* ... and do a TLS handshake on it */
+	double received;
+	double sent;
+	double dns;		/* name lookup */
+	double connect;		/* TCP connect */
+	double tls;		/* TLS handshake */
+	double wait;		/* request sent until first byte back */
+	double transfer;	/* first byte until done */
+	double total;
+} stats;
+
 size_t fread_buffer(void *ptr, size_t eltsize, size_t nmemb,
 			   struct buffer *buffer)
 {
@@ -144,6 +169,13 @@ static int http_options(const char *var, const char *value)
 		return 0;
 	}
 #endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	if (!strcmp("http.maxhostconnections", var)) {
+		if (max_host_connections == -1)
+			max_host_connections = git_config_int(var, value);
+		return 0;
+	}
+#endif
 
 	if (!strcmp("http.lowspeedlimit", var)) {
 		if (curl_low_speed_limit == -1)
@@ -160,6 +192,85 @@ static int http_options(const char *var, const char *value)
 	return git_default_config(var, value);
 }
 
+static void record_stats(struct active_request_slot *slot)
+{
+	double namelookup = 0, connect = 0, appconnect = 0;
+	double pretransfer = 0, starttransfer = 0, total = 0;
+	double received = 0, sent = 0;
+	long connects = 1;
+	char *url = NULL;
+
+	curl_easy_getinfo(slot->curl, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+	curl_easy_getinfo(slot->curl, CURLINFO_CONNECT_TIME, &connect);
+#if LIBCURL_VERSION_NUM >= 0x071300
+	curl_easy_getinfo(slot->curl, CURLINFO_APPCONNECT_TIME, &appconnect);
+#endif
+	curl_easy_getinfo(slot->curl, CURLINFO_PRETRANSFER_TIME, &pretransfer);
+	curl_easy_getinfo(slot->curl, CURLINFO_STARTTRANSFER_TIME,
+			  &starttransfer);
+	curl_easy_getinfo(slot->curl, CURLINFO_TOTAL_TIME, &total);
+#if LIBCURL_VERSION_NUM >= 0x073700
+	{
+		curl_off_t down = 0, up = 0;
+		curl_easy_getinfo(slot->curl, CURLINFO_SIZE_DOWNLOAD_T, &down);
+		curl_easy_getinfo(slot->curl, CURLINFO_SIZE_UPLOAD_T, &up);
+		received = down;
+		sent = up;
+	}
+#else
+	curl_easy_getinfo(slot->curl, CURLINFO_SIZE_DOWNLOAD, &received);
+	curl_easy_getinfo(slot->curl, CURLINFO_SIZE_UPLOAD, &sent);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x070c03
+	curl_easy_getinfo(slot->curl, CURLINFO_NUM_CONNECTS, &connects);
+#endif
+
+	/* curl gives each time from the start of the request */
+	stats.requests++;
+	if (connects) {
+		stats.connects++;
+		if (appconnect > 0)
+			stats.handshakes++;
+	}
+	stats.received += received;
+	stats.sent += sent;
+	stats.dns += namelookup;
+	if (connect > namelookup)
+		stats.connect += connect - namelookup;
+	if (appconnect > connect)
+		stats.tls += appconnect - connect;
+	if (starttransfer > pretransfer)
+		stats.wait += starttransfer - pretransfer;
+	if (total > starttransfer)
+		stats.transfer += total - starttransfer;
+	stats.total += total;
+
+	if (http_stats < 2)
+		return;
+	curl_easy_getinfo(slot->curl, CURLINFO_EFFECTIVE_URL, &url);
+	fprintf(stderr, "http: %ld %s %.0f bytes, %s connection, "
+		"wait %.3fs, total %.3fs\n",
+		slot->http_code, url ? url : "?", received + sent,
+		connects ? "new" : "reused",
+		starttransfer - pretransfer, total);
+}
+
+static void report_stats(void)
+{
+	if (!stats.requests)
+		return;
+	fprintf(stderr, "http: %d requests, %d on a reused connection; "
+		"%d connections opened, %d TLS handshakes\n",
+		stats.requests, stats.requests - stats.connects,
+		stats.connects, stats.handshakes);
+	fprintf(stderr, "http: %.0f bytes received, %.0f bytes sent\n",
+		stats.received, stats.sent);
+	fprintf(stderr, "http: dns %.3fs, connect %.3fs, tls %.3fs, "
+		"wait %.3fs, transfer %.3fs, total %.3fs\n",
+		stats.dns, stats.connect, stats.tls,
+		stats.wait, stats.transfer, stats.total);
+}
+
 static CURL* get_curl_handle(void)
 {
 	CURL* result = curl_easy_init();
@@ -202,6 +313,17 @@ void http_init(void)
 
 	curl_global_init(CURL_GLOBAL_ALL);
 
+	{
+		char *stats_env = getenv("GIT_HTTP_STATS");
+		if (stats_env != NULL) {
+			http_stats = atoi(stats_env);
+			if (!http_stats && strcmp(stats_env, "0"))
+				http_stats = 1;
+			if (http_stats)
+				atexit(report_stats);
+		}
+	}
+
 	pragma_header = curl_slist_append(pragma_header, "Pragma: no-cache");
 	no_range_header = curl_slist_append(no_range_header, "Range:");
 
@@ -211,6 +333,13 @@ void http_init(void)
 		if (http_max_requests != NULL)
 			max_requests = atoi(http_max_requests);
 	}
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	{
+		char *http_max_host = getenv("GIT_HTTP_MAX_HOST_CONNECTIONS");
+		if (http_max_host != NULL)
+			max_host_connections = atoi(http_max_host);
+	}
+#endif
 
 	curlm = curl_multi_init();
 	if (curlm == NULL) {
@@ -247,6 +376,16 @@ void http_init(void)
 	if (max_requests < 1)
 		max_requests = DEFAULT_MAX_REQUESTS;
 #endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+	/*
+	 * Requests to a host beyond this many wait inside curl for
+	 * one of its connections to be free, instead of opening one
+	 * more; 0 leaves it to max_requests alone.
+	 */
+	if (max_host_connections > 0)
+		curl_multi_setopt(curlm, CURLMOPT_MAX_HOST_CONNECTIONS,
+				  max_host_connections);
+#endif
 
 #ifndef NO_CURL_EASY_DUPHANDLE
 	curl_default = get_curl_handle();
@@ -258,20 +397,33 @@ void http_cleanup(void)
 	struct active_request_slot *slot = active_queue_head;
 #ifdef USE_CURL_MULTI
 	char *wait_url;
-#endif
 
+	/*
+	 * Let what is in flight finish, but start nothing new from
+	 * the queue; a callback may still start a request on any
+	 * slot, so look from the head again after each one.
+	 */
+	cleaning_up = 1;
 	while (slot != NULL) {
-#ifdef USE_CURL_MULTI
 		if (slot->in_use) {
 			curl_easy_getinfo(slot->curl,
 					  CURLINFO_EFFECTIVE_URL,
 					  &wait_url);
 			fprintf(stderr, "Waiting for %s\n", wait_url);
 			run_active_slot(slot);
+			slot = active_queue_head;
+		} else {
+			slot = slot->next;
 		}
+	}
+	slot = active_queue_head;
 #endif
-		if (slot->curl != NULL)
+
+	while (slot != NULL) {
+		if (slot->curl != NULL) {
 			curl_easy_cleanup(slot->curl);
+			slot->curl = NULL;
+		}
 		slot = slot->next;
 	}
 
@@ -335,8 +487,17 @@ struct active_request_slot *get_active_slot(void)
 	active_requests++;
 	slot->in_use = 1;
 	slot->local = NULL;
+	slot->finished = NULL;
+	slot->results = NULL;
 	slot->callback_data = NULL;
 	slot->callback_func = NULL;
+	/*
+	 * A handle kept from an earlier request still has its method
+	 * and upload set up; start every request from a plain GET.
+	 */
+	curl_easy_setopt(slot->curl, CURLOPT_CUSTOMREQUEST, NULL);
+	curl_easy_setopt(slot->curl, CURLOPT_UPLOAD, 0);
+	curl_easy_setopt(slot->curl, CURLOPT_HTTPGET, 1);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, pragma_header);
 	curl_easy_setopt(slot->curl, CURLOPT_HTTPHEADER, no_range_header);
 	curl_easy_setopt(slot->curl, CURLOPT_ERRORBUFFER, curl_errorstr);
@@ -370,13 +531,15 @@ void step_active_slots(void)
 	} while (curlm_result == CURLM_CALL_MULTI_PERFORM);
 	if (num_transfers < active_requests) {
 		process_curl_messages();
-		fill_active_slots();
+		if (!cleaning_up)
+			fill_active_slots();
 	}
 }
 #endif
 
 void run_active_slot(struct active_request_slot *slot)
 {
+	int finished = 0;
 #ifdef USE_CURL_MULTI
 	long last_pos = 0;
 	long current_pos;
@@ -386,7 +549,12 @@ void run_active_slot(struct active_request_slot *slot)
 	int max_fd;
 	struct timeval select_timeout;
 
-	while (slot->in_use) {
+	/*
+	 * The slot may be handed to another request as soon as this
+	 * one is done, so it is not slot->in_use that tells us.
+	 */
+	slot->finished = &finished;
+	while (!finished) {
 		data_received = 0;
 		step_active_slots();
 
@@ -397,23 +565,35 @@ void run_active_slot(struct active_request_slot *slot)
 			last_pos = current_pos;
 		}
 
-		if (slot->in_use && !data_received) {
-			max_fd = 0;
+		if (!finished && !data_received) {
+			/*
+			 * Sleep until one of the transfers can make
+			 * progress, not for a fixed while.
+			 */
+			max_fd = -1;
 			FD_ZERO(&readfds);
 			FD_ZERO(&writefds);
 			FD_ZERO(&excfds);
+			curl_multi_fdset(curlm, &readfds, &writefds,
+					 &excfds, &max_fd);
 			select_timeout.tv_sec = 0;
 			select_timeout.tv_usec = 50000;
-			select(max_fd, &readfds, &writefds,
+			select(max_fd + 1, &readfds, &writefds,
 			       &excfds, &select_timeout);
 		}
 	}
 #else
-	while (slot->in_use) {
+	slot->finished = &finished;
+	while (!finished) {
 		slot->curl_result = curl_easy_perform(slot->curl);
 		finish_active_slot(slot);
 	}
 #endif
+	/*
+	 * Whoever has the slot now, if anybody, does not look at our
+	 * &finished; do not leave it behind.
+	 */
+	slot->finished = NULL;
 }
 
 static void finish_active_slot(struct active_request_slot *slot)
@@ -421,6 +601,14 @@ static void finish_active_slot(struct active_request_slot *slot)
         active_requests--;
         slot->in_use = 0;
         curl_easy_getinfo(slot->curl, CURLINFO_HTTP_CODE, &slot->http_code);
+        if (http_stats)
+                record_stats(slot);
+        if (slot->results != NULL) {
+                slot->results->curl_result = slot->curl_result;
+                slot->results->http_code = slot->http_code;
+        }
+        if (slot->finished != NULL)
+                (*slot->finished) = 1;
  
         /* Run callback if appropriate */
         if (slot->callback_func != NULL) {
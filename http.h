@@ -22,6 +22,17 @@
 #define NO_CURL_EASY_DUPHANDLE
 #endif
 
+/*
+ * Once run_active_slot() returns, the slot may already be carrying
+ * another request; a caller that wants to know how its own went
+ * points slot->results at one of these before running it.
+ */
+struct slot_results
+{
+	CURLcode curl_result;
+	long http_code;
+};
+
 struct active_request_slot
 {
 	CURL *curl;
@@ -29,6 +40,8 @@ struct active_request_slot
 	int in_use;
 	CURLcode curl_result;
 	long http_code;
+	int *finished;
+	struct slot_results *results;
 	void *callback_data;
 	void (*callback_func)(void *data);
 	struct active_request_slot *next;
@@ -70,6 +83,9 @@ extern int active_requests;
 extern int max_requests;
 extern CURLM *curlm;
 #endif
+#if LIBCURL_VERSION_NUM >= 0x071e00
+extern long max_host_connections;
+#endif
 #ifndef NO_CURL_EASY_DUPHANDLE
 extern CURL *curl_default;
 #endif
@@ -4,6 +4,9 @@
 #include "cache.h"
 #include "commit.h"
 #include "fetch.h"
+#ifndef NO_PTHREADS
+#include <pthread.h>
+#endif
 
 static int use_link = 0;
 static int use_symlink = 0;
@@ -32,10 +35,15 @@ static void setup_index(unsigned char *sha1)
 
 static int setup_indices(void)
 {
+	static int done;
 	DIR *dir;
 	struct dirent *de;
 	char filename[PATH_MAX];
 	unsigned char sha1[20];
+
+	if (done)
+		return 0;
+	done = 1;
 	sprintf(filename, "%s/objects/pack/", path);
 	dir = opendir(filename);
 	if (!dir)
@@ -193,19 +201,161 @@ int fetch_ref(char *ref, unsigned char *sha1)
 	return 0;
 }
 
+/*
+ * Cloning: every pack, index and loose object of path is linked or
+ * copied over as it is, without reading any of them.
+ */
+static char clone_src[PATH_MAX];
+static char clone_dst[PATH_MAX];
+static int clone_errors;
+#ifndef NO_PTHREADS
+static pthread_mutex_t clone_lock = PTHREAD_MUTEX_INITIALIZER;
+static int clone_next;
+#endif
+
+/* Copy the files of one directory under objects/ for which want() says so */
+static int clone_dir(const char *dir, int (*want)(const char *))
+{
+	char src[PATH_MAX], dst[PATH_MAX];
+	int srclen, dstlen, errors = 0;
+	DIR *d;
+	struct dirent *de;
+
+	srclen = snprintf(src, sizeof(src), "%s/%s/", clone_src, dir);
+	dstlen = snprintf(dst, sizeof(dst), "%s/%s/", clone_dst, dir);
+	d = opendir(src);
+	if (!d)
+		return 0;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.' || !want(de->d_name))
+			continue;
+		if (srclen + strlen(de->d_name) >= sizeof(src) ||
+		    dstlen + strlen(de->d_name) >= sizeof(dst)) {
+			errors++;
+			continue;
+		}
+		strcpy(src + srclen, de->d_name);
+		strcpy(dst + dstlen, de->d_name);
+		if (copy_file(src, dst, de->d_name, 1))
+			errors++;
+	}
+	closedir(d);
+	return errors;
+}
+
+static int any_file(const char *name)
+{
+	return 1;
+}
+
+static int pack_file(const char *name)
+{
+	int len = strlen(name);
+	return len > 5 && !strcmp(name + len - 5, ".pack");
+}
+
+static int pack_index_file(const char *name)
+{
+	int len = strlen(name);
+	return len > 4 && !strcmp(name + len - 4, ".idx");
+}
+
+static void clone_loose_dir(int i)
+{
+	char dir[3];
+	int errors;
+
+	sprintf(dir, "%02x", i);
+	errors = clone_dir(dir, any_file);
+	if (errors) {
+#ifndef NO_PTHREADS
+		pthread_mutex_lock(&clone_lock);
+#endif
+		clone_errors += errors;
+#ifndef NO_PTHREADS
+		pthread_mutex_unlock(&clone_lock);
+#endif
+	}
+}
+
+#ifndef NO_PTHREADS
+static void *clone_worker(void *unused)
+{
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&clone_lock);
+		i = clone_next++;
+		pthread_mutex_unlock(&clone_lock);
+		if (256 <= i)
+			return NULL;
+		clone_loose_dir(i);
+	}
+}
+#endif
+
+static int clone_objects(void)
+{
+	int i;
+
+	snprintf(clone_src, sizeof(clone_src), "%s/objects", path);
+	snprintf(clone_dst, sizeof(clone_dst), "%s", get_object_directory());
+
+	/* The packs go first, each before its index */
+	clone_errors += clone_dir("pack", pack_file);
+	clone_errors += clone_dir("pack", pack_index_file);
+
+	/*
+	 * The loose objects are many small files, where the time goes
+	 * to the filesystem metadata; the 256 fan-out directories are
+	 * handed out to a few threads.
+	 */
+#ifndef NO_PTHREADS
+	{
+		int nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		pthread_t thread[16];
+		int started;
+
+		if (nr_threads > 16)
+			nr_threads = 16;
+		for (started = 0; started < nr_threads - 1; started++)
+			if (pthread_create(&thread[started], NULL,
+					   clone_worker, NULL))
+				break;
+		clone_worker(NULL);
+		for (i = 0; i < started; i++)
+			pthread_join(thread[i], NULL);
+	}
+#else
+	for (i = 0; i < 256; i++)
+		clone_loose_dir(i);
+#endif
+
+	/* alternates and the like, last */
+	clone_errors += clone_dir("info", any_file);
+
+	if (clone_errors)
+		return error("%d files could not be copied from %s",
+			     clone_errors, clone_src);
+	return 0;
+}
+
 static const char local_pull_usage[] =
-"git-local-fetch [-c] [-t] [-a] [-d] [-v] [-w filename] [--recover] [-l] [-s] [-n] commit-id path";
+"git-local-fetch [-c] [-t] [-a] [-d] [-v] [-w filename] [--recover] [-l] [-s] [-n] commit-id path\n"
+"   or: git-local-fetch --all-objects [-v] [-l] [-s] [-n] path";
 
 /* 
  * By default we only use file copy.
  * If -l is specified, a hard link is attempted.
  * If -s is specified, then a symlink is attempted.
  * If -n is _not_ specified, then a regular file-to-file copy is done.
+ * With --all-objects, the whole object store is cloned that way.
  */
 int main(int argc, char **argv)
 {
 	char *commit_id;
 	int arg = 1;
+	int all_objects = 0;
 
 	setup_git_directory();
 
@@ -231,10 +381,18 @@ int main(int argc, char **argv)
 			write_ref = argv[++arg];
 		else if (!strcmp(argv[arg], "--recover"))
 			get_recover = 1;
+		else if (!strcmp(argv[arg], "--all-objects"))
+			all_objects = 1;
 		else
 			usage(local_pull_usage);
 		arg++;
 	}
+	if (all_objects) {
+		if (argc != arg + 1)
+			usage(local_pull_usage);
+		path = argv[arg];
+		return !!clone_objects();
+	}
 	if (argc < arg + 2)
 		usage(local_pull_usage);
 	commit_id = argv[arg];
@@ -7,69 +7,162 @@
 static const char name_rev_usage[] =
 	"git-name-rev [--tags] ( --all | --stdin | commitish [commitish...] )\n";
 
+/*
+ * A name is not spelled out while we walk.  It is the tip it was
+ * reached from, followed by one link for every merge parent other
+ * than the first one taken on the way, and is only formatted when
+ * it is shown.  Commits reached by first parents share the link of
+ * their child and differ only by their generation.
+ */
+struct name_link {
+	const struct name_link *up;	/* NULL for a tip */
+	const char *tip_name;		/* only for a tip */
+	int deref;			/* tip was a tag: "^0" */
+	int generation;			/* of the merge below "up" */
+	int parent_number;
+};
+
 typedef struct rev_name {
-	const char *tip_name;
+	const struct name_link *link;
 	int merge_traversals;
 	int generation;
 } rev_name;
 
+/*
+ * What is still to be named.  A merge parent other than the first
+ * one gets its link only when the name turns out to be better than
+ * what the commit already has.
+ */
+struct name_work {
+	struct commit *commit;
+	const struct name_link *link;
+	int merge_traversals;
+	int generation;
+	int parent_number;
+	int merge_generation;
+};
+
 static long cutoff = LONG_MAX;
 
-static void name_rev(struct commit *commit,
-		const char *tip_name, int merge_traversals, int generation,
-		int deref)
-{
-	struct rev_name *name = (struct rev_name *)commit->object.util;
-	struct commit_list *parents;
-	int parent_number = 1;
+static struct name_work *work;
+static int work_nr, work_alloc;
 
-	if (!commit->object.parsed)
-		parse_commit(commit);
+/*
+ * Names, links and the tip strings live until we exit, so carve
+ * them out of big blocks instead of allocating each separately.
+ */
+#define ARENA_BLOCK 65536
 
-	if (commit->date < cutoff)
-		return;
+static char *arena;
+static unsigned long arena_left;
 
-	if (deref) {
-		char *new_name = xmalloc(strlen(tip_name)+3);
-		strcpy(new_name, tip_name);
-		strcat(new_name, "^0");
-		tip_name = new_name;
+static void *arena_alloc(unsigned long size)
+{
+	void *p;
 
-		if (generation)
-			die("generation: %d, but deref?", generation);
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (arena_left < size) {
+		unsigned long block = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+		arena = xmalloc(block);
+		arena_left = block;
 	}
+	p = arena;
+	arena += size;
+	arena_left -= size;
+	return p;
+}
 
-	if (name == NULL) {
-		name = xmalloc(sizeof(rev_name));
-		commit->object.util = name;
-		goto copy_data;
-	} else if (name->merge_traversals > merge_traversals ||
-			(name->merge_traversals == merge_traversals &&
-			 name->generation > generation)) {
-copy_data:
-		name->tip_name = tip_name;
-		name->merge_traversals = merge_traversals;
-		name->generation = generation;
-	} else
-		return;
-
-	for (parents = commit->parents;
-			parents;
-			parents = parents->next, parent_number++) {
-		if (parent_number > 1) {
-			char *new_name = xmalloc(strlen(tip_name)+8);
-
-			if (generation > 0)
-				sprintf(new_name, "%s~%d^%d", tip_name,
-						generation, parent_number);
-			else
-				sprintf(new_name, "%s^%d", tip_name, parent_number);
-
-			name_rev(parents->item, new_name,
-				merge_traversals + 1 , 0, 0);
-		} else {
-			name_rev(parents->item, tip_name, merge_traversals,
-				generation + 1, 0);
+static const char *arena_strdup(const char *str)
+{
+	int len = strlen(str) + 1;
+	return memcpy(arena_alloc(len), str, len);
+}
+
+static struct name_work *grow_work(int nr)
+{
+	if (work_alloc < work_nr + nr) {
+		work_alloc = alloc_nr(work_nr + nr);
+		work = xrealloc(work, work_alloc * sizeof(*work));
+	}
+	work_nr += nr;
+	return work + work_nr - nr;
+}
+
+static void name_rev(struct commit *commit, const struct name_link *tip)
+{
+	struct name_work *w = grow_work(1);
+
+	w->commit = commit;
+	w->link = tip;
+	w->merge_traversals = 0;
+	w->generation = 0;
+	w->parent_number = 0;
+	w->merge_generation = 0;
+
+	/*
+	 * The parents are pushed last to first, so that we go down the
+	 * first parent before looking at the others, just like the
+	 * recursive walk this replaced; names that tie keep the one
+	 * found first.
+	 */
+	while (work_nr) {
+		struct name_work cur = work[--work_nr];
+		struct rev_name *name;
+		struct commit_list *parents;
+		int nr_parents, i;
+
+		commit = cur.commit;
+		name = (struct rev_name *)commit->object.util;
+
+		if (!commit->object.parsed)
+			parse_commit(commit);
+
+		if (commit->date < cutoff)
+			continue;
+
+		if (name && (name->merge_traversals < cur.merge_traversals ||
+			     (name->merge_traversals == cur.merge_traversals &&
+			      name->generation <= cur.generation)))
+			continue;
+		if (!name) {
+			name = arena_alloc(sizeof(rev_name));
+			commit->object.util = name;
+		}
+
+		if (cur.parent_number > 1) {
+			struct name_link *link = arena_alloc(sizeof(*link));
+			link->up = cur.link;
+			link->tip_name = NULL;
+			link->deref = 0;
+			link->generation = cur.merge_generation;
+			link->parent_number = cur.parent_number;
+			cur.link = link;
+		}
+		name->link = cur.link;
+		name->merge_traversals = cur.merge_traversals;
+		name->generation = cur.generation;
+
+		nr_parents = 0;
+		for (parents = commit->parents; parents; parents = parents->next)
+			nr_parents++;
+		if (!nr_parents)
+			continue;
+
+		w = grow_work(nr_parents) + nr_parents - 1;
+		for (parents = commit->parents, i = 1;
+				parents;
+				parents = parents->next, i++, w--) {
+			w->commit = parents->item;
+			w->link = name->link;
+			w->parent_number = i;
+			w->merge_generation = name->generation;
+			if (i > 1) {
+				w->merge_traversals = name->merge_traversals + 1;
+				w->generation = 0;
+			} else {
+				w->merge_traversals = name->merge_traversals;
+				w->generation = name->generation + 1;
+			}
 		}
 	}
 }
@@ -93,12 +186,19 @@ static int name_ref(const char *path, const unsigned char *sha1)
 	}
 	if (o && o->type == commit_type) {
 		struct commit *commit = (struct commit *)o;
+		struct name_link *tip;
 		const char *p;
 
 		while ((p = strchr(path, '/')))
 			path = p+1;
 
-		name_rev(commit, strdup(path), 0, 0, deref);
+		tip = arena_alloc(sizeof(*tip));
+		tip->up = NULL;
+		tip->tip_name = arena_strdup(path);
+		tip->deref = deref;
+		tip->generation = 0;
+		tip->parent_number = 0;
+		name_rev(commit, tip);
 	}
 	return 0;
 }
@@ -107,18 +207,43 @@ static int name_ref(const char *path, const unsigned char *sha1)
 static const char* get_rev_name(struct object *o)
 {
 	static char buffer[1024];
+	static const struct name_link **chain;
+	static int chain_alloc;
 	struct rev_name *n = (struct rev_name *)o->util;
+	const struct name_link *link;
+	int len, nr = 0;
+
 	if (!n)
 		return "undefined";
 
-	if (!n->generation)
-		return n->tip_name;
+	for (link = n->link; link; link = link->up) {
+		if (chain_alloc <= nr) {
+			chain_alloc = alloc_nr(chain_alloc);
+			chain = xrealloc(chain, chain_alloc * sizeof(*chain));
+		}
+		chain[nr++] = link;
+	}
 
-	snprintf(buffer, sizeof(buffer), "%s~%d", n->tip_name, n->generation);
+	link = chain[--nr];
+	len = snprintf(buffer, sizeof(buffer), "%s%s",
+		       link->tip_name, link->deref ? "^0" : "");
+	while (nr-- && len < sizeof(buffer)) {
+		link = chain[nr];
+		if (link->generation > 0)
+			len += snprintf(buffer + len, sizeof(buffer) - len,
+					"~%d^%d", link->generation,
+					link->parent_number);
+		else
+			len += snprintf(buffer + len, sizeof(buffer) - len,
+					"^%d", link->parent_number);
+	}
+	if (n->generation && len < sizeof(buffer))
+		snprintf(buffer + len, sizeof(buffer) - len,
+			 "~%d", n->generation);
 
 	return buffer;
 }
-	
+
 int main(int argc, char **argv)
 {
 	struct object_list *revs = NULL;
@@ -240,4 +365,3 @@ int main(int argc, char **argv)
 
 	return 0;
 }
-
@@ -3,8 +3,10 @@
 #include "delta.h"
 #include "pack.h"
 #include "csum-file.h"
+#include <sys/time.h>
+#include <signal.h>
 
-static const char pack_usage[] = "git-pack-objects [--non-empty] [--local] [--incremental] [--window=N] [--depth=N] {--stdout | base-name} < object-list";
+static const char pack_usage[] = "git-pack-objects [--non-empty] [--local] [--incremental] [--window=N] [--depth=N] [--progress] {--stdout | base-name} < object-list";
 
 struct object_entry {
 	unsigned char sha1[20];
@@ -26,6 +28,40 @@ static struct object_entry *objects = NULL;
 static int nr_objects = 0, nr_alloc = 0;
 static const char *base_name;
 static unsigned char pack_file_sha1[20];
+static int progress;
+static volatile sig_atomic_t progress_update;
+
+/*
+ * With --progress, each phase tells how far it got, but only when
+ * the interval timer says a second has passed, so that keeping the
+ * meter up to date costs nothing but a test of progress_update.
+ */
+static void progress_interval(int signum)
+{
+	signal(SIGALRM, progress_interval);
+	progress_update = 1;
+}
+
+static void setup_progress_signal(void)
+{
+	struct itimerval v;
+
+	signal(SIGALRM, progress_interval);
+	v.it_interval.tv_sec = 1;
+	v.it_interval.tv_usec = 0;
+	v.it_value = v.it_interval;
+	setitimer(ITIMER_REAL, &v, NULL);
+}
+
+static void show_progress(const char *what, unsigned done, unsigned total)
+{
+	if (!progress || !(progress_update || done == total))
+		return;
+	progress_update = 0;
+	fprintf(stderr, "%s: %3u%% (%u/%u)%s", what,
+		total ? done * 100 / total : 100, done, total,
+		done == total ? ", done.\n" : "\r");
+}
 
 static void *delta_against(void *buf, unsigned long size, struct object_entry *entry)
 {
@@ -142,8 +178,10 @@ static void write_pack_file(void)
 	hdr.hdr_entries = htonl(nr_objects);
 	sha1write(f, &hdr, sizeof(hdr));
 	offset = sizeof(hdr);
-	for (i = 0; i < nr_objects; i++)
+	for (i = 0; i < nr_objects; i++) {
 		offset = write_one(f, objects + i, offset);
+		show_progress("Writing objects", i + 1, nr_objects);
+	}
 
 	sha1close(f, pack_file_sha1, 1);
 	mb = offset >> 20;
@@ -393,6 +431,7 @@ static void find_deltas(struct object_entry **list, int window, int depth)
 		idx++;
 		if (idx >= window)
 			idx = 0;
+		show_progress("Deltifying objects", nr_objects - i, nr_objects);
 	}
 
 	for (i = 0; i < window; ++i)
@@ -509,6 +548,10 @@ int main(int argc, char **argv)
 				pack_to_stdout = 1;
 				continue;
 			}
+			if (!strcmp("--progress", arg)) {
+				progress = 1;
+				continue;
+			}
 			usage(pack_usage);
 		}
 		if (base_name)
@@ -519,6 +562,8 @@ int main(int argc, char **argv)
 	if (pack_to_stdout != !base_name)
 		usage(pack_usage);
 
+	if (progress)
+		setup_progress_signal();
 	prepare_packed_git();
 	while (fgets(line, sizeof(line), stdin) != NULL) {
 		unsigned int hash;
@@ -536,6 +581,10 @@ int main(int argc, char **argv)
 			hash = hash * 11 + c;
 		}
 		add_object_entry(sha1, hash);
+		if (progress && progress_update) {
+			fprintf(stderr, "Counting objects: %d\r", nr_objects);
+			progress_update = 0;
+		}
 	}
 	if (non_empty && !nr_objects)
 		return 0;
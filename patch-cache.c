@@ -0,0 +1,238 @@
+/*
+ * Cache of patch text for blob pairs, in $GIT_DIR/patch-cache.
+ *
+ * An entry holds the hunks between two blobs, as the built-in diff
+ * shows them with a given set of options, in a file named after the
+ * SHA1 of both blob names and the options, fanned out the same way
+ * loose objects are.  Reading an entry touches it.
+ *
+ * The total size of the entries is kept in patch-cache/size.  A
+ * process that added entries adds their size to it at exit; only when
+ * that goes over diff.patchcachesize bytes (or the file is missing) are
+ * the entries looked at, and the least recently used ones removed
+ * until the whole cache fits.  The file is updated under
+ * patch-cache/size.lock; a process that finds it locked does not
+ * wait, and what it added is only counted by the next such scan.
+ *
+ * With GIT_PATCH_CACHE_DEBUG in the environment, the counters are
+ * shown on the standard error at exit.
+ */
+#include <dirent.h>
+#include <utime.h>
+#include "cache.h"
+#include "diff.h"
+#include "diffcore.h"
+
+unsigned long patch_cache_size;
+
+static int hits, misses, added, evicted, scanned;
+static unsigned long added_bytes, evicted_bytes;
+static int atexit_asked;
+
+static char *entry_path(const unsigned char *one, const unsigned char *two,
+			const char *opts)
+{
+	unsigned char sha1[20];
+	const char *hex;
+	SHA_CTX c;
+
+	SHA1_Init(&c);
+	SHA1_Update(&c, one, 20);
+	SHA1_Update(&c, two, 20);
+	SHA1_Update(&c, opts, strlen(opts) + 1);
+	SHA1_Final(sha1, &c);
+	hex = sha1_to_hex(sha1);
+	return git_path("patch-cache/%.2s/%s", hex, hex + 2);
+}
+
+struct lru_entry {
+	char *path;
+	time_t mtime;
+	unsigned long size;
+};
+
+static int lru_compare(const void *a_, const void *b_)
+{
+	const struct lru_entry *a = a_, *b = b_;
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/* Returns the size of what is left in the cache */
+static unsigned long evict_entries(void)
+{
+	struct lru_entry *entry = NULL;
+	int i, nr = 0, alloc = 0;
+	unsigned long total = 0;
+	char *base = strdup(git_path("patch-cache"));
+
+	for (i = 0; i < 256; i++) {
+		char dirname[PATH_MAX];
+		struct dirent *de;
+		DIR *dir;
+
+		snprintf(dirname, sizeof(dirname), "%s/%02x", base, i);
+		dir = opendir(dirname);
+		if (!dir)
+			continue;
+		while ((de = readdir(dir)) != NULL) {
+			char path[PATH_MAX + 40];
+			struct stat st;
+
+			if (strlen(de->d_name) != 38)
+				continue; /* ".", "..", or being written */
+			snprintf(path, sizeof(path), "%s/%s", dirname, de->d_name);
+			if (stat(path, &st))
+				continue;
+			if (nr == alloc) {
+				alloc = alloc_nr(alloc);
+				entry = xrealloc(entry, alloc * sizeof(*entry));
+			}
+			entry[nr].path = strdup(path);
+			entry[nr].mtime = st.st_mtime;
+			entry[nr].size = st.st_size;
+			total += st.st_size;
+			nr++;
+			scanned++;
+		}
+		closedir(dir);
+	}
+
+	qsort(entry, nr, sizeof(*entry), lru_compare);
+	for (i = 0; i < nr; i++) {
+		if (patch_cache_size < total && !unlink(entry[i].path)) {
+			total -= entry[i].size;
+			evicted++;
+			evicted_bytes += entry[i].size;
+		}
+		free(entry[i].path);
+	}
+	free(entry);
+	free(base);
+	return total;
+}
+
+static void update_cache_total(void)
+{
+	char path[PATH_MAX], lock[PATH_MAX + 5], buf[30], *end;
+	unsigned long total = 0;
+	int fd, in, len = 0, known = 0;
+
+	if (strlen(git_path("patch-cache/size")) >= sizeof(path))
+		return;
+	strcpy(path, git_path("patch-cache/size"));
+	sprintf(lock, "%s.lock", path);
+	fd = open(lock, O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (fd < 0)
+		return;
+
+	in = open(path, O_RDONLY);
+	if (0 <= in) {
+		len = xread(in, buf, sizeof(buf) - 1);
+		close(in);
+	}
+	if (0 < len) {
+		buf[len] = 0;
+		total = strtoul(buf, &end, 10);
+		known = end != buf && *end == '\n';
+	}
+	total += added_bytes;
+	if (!known || patch_cache_size < total)
+		total = evict_entries();
+
+	len = sprintf(buf, "%lu\n", total);
+	if (xwrite(fd, buf, len) != len || close(fd) || rename(lock, path))
+		unlink(lock);
+}
+
+static void patch_cache_atexit(void)
+{
+	if (added)
+		update_cache_total();
+	if (getenv("GIT_PATCH_CACHE_DEBUG"))
+		fprintf(stderr, "patch cache: %d hits, %d misses, "
+			"%d added, %d evicted (%lu bytes), %d scanned\n",
+			hits, misses, added, evicted, evicted_bytes, scanned);
+}
+
+static void ask_atexit(void)
+{
+	if (!atexit_asked) {
+		atexit_asked = 1;
+		atexit(patch_cache_atexit);
+	}
+}
+
+/*
+ * Return the cached hunks between blobs one and two, shown with opts,
+ * in a buffer the caller should free, or NULL if there are none.
+ */
+char *read_patch_cache(const unsigned char *one, const unsigned char *two,
+		       const char *opts, unsigned long *size)
+{
+	char *path = entry_path(one, two, opts);
+	struct stat st;
+	char *buf;
+	ssize_t n;
+	int fd;
+
+	ask_atexit();
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+		if (0 <= fd)
+			close(fd);
+		misses++;
+		return NULL;
+	}
+	buf = xmalloc(st.st_size);
+	for (*size = 0; *size < st.st_size; *size += n) {
+		n = xread(fd, buf + *size, st.st_size - *size);
+		if (n <= 0)
+			break;
+	}
+	close(fd);
+	if (*size != st.st_size) {
+		free(buf);
+		misses++;
+		return NULL;
+	}
+	utime(path, NULL);	/* most recently used */
+	hits++;
+	return buf;
+}
+
+void write_patch_cache(const unsigned char *one, const unsigned char *two,
+		       const char *opts, const char *buf, unsigned long size)
+{
+	char *path = entry_path(one, two, opts);
+	char tmp[PATH_MAX];
+	unsigned long done;
+	ssize_t n;
+	int fd;
+
+	if (!size || patch_cache_size < size)
+		return;
+	ask_atexit();
+	/* a sibling of path that evict_entries() does not look at */
+	if (strlen(path) + 8 > sizeof(tmp))
+		return;
+	strcpy(tmp, path);
+	strcpy(strrchr(tmp, '/') + 1, "tmp-XXXXXX");
+	if (safe_create_leading_directories(tmp))
+		return;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+	for (done = 0; done < size; done += n) {
+		n = xwrite(fd, buf + done, size - done);
+		if (n <= 0)
+			break;
+	}
+	if (close(fd) || done != size || rename(tmp, path)) {
+		unlink(tmp);
+		return;
+	}
+	added++;
+	added_bytes += size;
+}
@@ -0,0 +1,222 @@
+/*
+ * Changed-path filters; see path-filter.h for the file format.
+ */
+#include "cache.h"
+#include "commit.h"
+#include "path-filter.h"
+
+static const unsigned char *filter_map;
+static unsigned int filter_nr;
+static const unsigned char *filter_data;
+static int filter_state;	/* 0: not read yet, 1: usable, -1: none */
+
+#define ENTRY_SIZE (20 + 20 + 4)
+
+static unsigned int path_hash(const char *path, int len, unsigned int h)
+{
+	/* FNV-1a, followed by a final mix so that all bits avalanche */
+	while (len--)
+		h = (h ^ (unsigned char)*path++) * 0x01000193;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static void path_hashes(const char *path, int len, unsigned int *h1, unsigned int *h2)
+{
+	*h1 = path_hash(path, len, 0x811c9dc5);
+	*h2 = path_hash(path, len, 0x2d358dcc) | 1;
+}
+
+void path_filter_add(unsigned char *bits, unsigned long size,
+		     const char *path, int len)
+{
+	unsigned long nbits = size * 8;
+	unsigned int h1, h2;
+	int i;
+
+	path_hashes(path, len, &h1, &h2);
+	for (i = 0; i < PATH_FILTER_HASHES; i++) {
+		unsigned long bit = (h1 + i * h2) % nbits;
+		bits[bit >> 3] |= 1 << (bit & 7);
+	}
+}
+
+static int filter_maybe(const struct path_filter *filter,
+			unsigned int h1, unsigned int h2)
+{
+	unsigned long nbits = filter->size * 8;
+	int i;
+
+	if (!nbits)
+		return 1;
+	for (i = 0; i < PATH_FILTER_HASHES; i++) {
+		unsigned long bit = (h1 + i * h2) % nbits;
+		if (!(filter->bits[bit >> 3] & (1 << (bit & 7))))
+			return 0;
+	}
+	return 1;
+}
+
+int path_filter_maybe(const struct path_filter *filter,
+		      const char *path, int len)
+{
+	unsigned int h1, h2;
+
+	path_hashes(path, len, &h1, &h2);
+	return filter_maybe(filter, h1, h2);
+}
+
+static unsigned int get_be32(const unsigned char *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+int read_path_filters(void)
+{
+	const char *path;
+	const unsigned char *map;
+	unsigned long size, data_size;
+	unsigned int nr;
+	unsigned char sha1[20];
+	SHA_CTX ctx;
+	struct stat st;
+	int fd;
+
+	if (filter_state)
+		return filter_state < 0 ? -1 : 0;
+	filter_state = -1;
+
+	path = mkpath("%s/info/path-filters", get_object_directory());
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	size = st.st_size;
+	if (size < 12 + 20) {
+		close(fd);
+		return error("%s: too small", path);
+	}
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	nr = get_be32(map + 8);
+	if (get_be32(map) != PATH_FILTER_SIGNATURE ||
+	    get_be32(map + 4) != PATH_FILTER_VERSION ||
+	    (size - 12 - 20) / ENTRY_SIZE < nr) {
+		munmap((void *)map, size);
+		return error("%s: not a usable path filter file", path);
+	}
+	data_size = nr ? get_be32(map + 12 + nr * ENTRY_SIZE - 4) : 0;
+	if (12 + nr * ENTRY_SIZE + data_size + 20 != size) {
+		munmap((void *)map, size);
+		return error("%s: wrong file size", path);
+	}
+	SHA1_Init(&ctx);
+	SHA1_Update(&ctx, map, size - 20);
+	SHA1_Final(sha1, &ctx);
+	if (memcmp(sha1, map + size - 20, 20)) {
+		munmap((void *)map, size);
+		return error("%s: checksum mismatch", path);
+	}
+
+	filter_map = map;
+	filter_nr = nr;
+	filter_data = map + 12 + nr * ENTRY_SIZE;
+	filter_state = 1;
+	return 0;
+}
+
+int find_path_filter(const unsigned char *commit_sha1,
+		     const unsigned char *parent_sha1,
+		     struct path_filter *filter)
+{
+	static const unsigned char null_sha1[20];
+	const unsigned char *table;
+	int lo, hi;
+
+	if (read_path_filters())
+		return 0;
+	if (!parent_sha1)
+		parent_sha1 = null_sha1;
+
+	table = filter_map + 12;
+	lo = 0;
+	hi = filter_nr;
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		const unsigned char *entry = table + mi * ENTRY_SIZE;
+		int cmp = memcmp(entry, commit_sha1, 20);
+		if (!cmp) {
+			unsigned long begin, end;
+
+			/* made against another parent (grafts)? */
+			if (memcmp(entry + 20, parent_sha1, 20))
+				return 0;
+			begin = mi ? get_be32(entry - 4) : 0;
+			end = get_be32(entry + 40);
+			if (end < begin)
+				return 0;
+			filter->bits = filter_data + begin;
+			filter->size = end - begin;
+			return 1;
+		}
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return 0;
+}
+
+static int nr_paths = -1;
+static unsigned int (*path_hash_pairs)[2];
+
+void setup_path_filters(const char **paths)
+{
+	int i, nr;
+
+	nr_paths = -1;
+	if (!paths || read_path_filters())
+		return;
+	for (nr = 0; paths[nr]; nr++)
+		;
+	path_hash_pairs = xrealloc(path_hash_pairs, nr * sizeof(*path_hash_pairs));
+	for (i = 0; i < nr; i++) {
+		int len = strlen(paths[i]);
+
+		/* "dir/" means the same as "dir" */
+		while (len && paths[i][len - 1] == '/')
+			len--;
+		if (!len)
+			return;	/* everything is interesting */
+		path_hashes(paths[i], len,
+			    &path_hash_pairs[i][0], &path_hash_pairs[i][1]);
+	}
+	nr_paths = nr;
+}
+
+int path_filter_untouched(struct commit *commit, struct commit *parent)
+{
+	struct path_filter filter;
+	int i;
+
+	if (nr_paths < 0)
+		return 0;
+	if (!find_path_filter(commit->object.sha1,
+			      parent ? parent->object.sha1 : NULL, &filter))
+		return 0;
+	for (i = 0; i < nr_paths; i++)
+		if (filter_maybe(&filter, path_hash_pairs[i][0],
+				 path_hash_pairs[i][1]))
+			return 0;
+	return 1;
+}
@@ -0,0 +1,61 @@
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#include "commit.h"
+
+/*
+ * Changed-path filters, kept in $GIT_OBJECT_DIRECTORY/info/path-filters.
+ *
+ * For each commit there is a Bloom filter of the paths, and of all
+ * their leading directories, that differ between the commit and its
+ * first parent (or the empty tree, for a root commit).  It can only
+ * ever say "this commit did not touch these paths" for sure; when it
+ * does, the trees do not have to be read to find that out.
+ *
+ * The file is laid out as follows (numbers in network byte order):
+ *
+ *  - "PFLT" signature, version, number of commits
+ *  - per commit, sorted by commit SHA1: 20-byte commit SHA1,
+ *    20-byte first parent SHA1 (all zero for a root), and the 4-byte
+ *    offset of the end of its filter in the filter data
+ *  - filter data; an empty filter means "too many paths to say"
+ *  - 20-byte SHA1 checksum of all of the above
+ */
+#define PATH_FILTER_SIGNATURE 0x50464c54	/* "PFLT" */
+#define PATH_FILTER_VERSION 1
+
+/* Commits touching more paths than this get an empty filter */
+#define PATH_FILTER_MAX_PATHS 512
+#define PATH_FILTER_BITS_PER_PATH 10
+#define PATH_FILTER_HASHES 7
+
+struct path_filter {
+	const unsigned char *bits;
+	unsigned long size;
+};
+
+/* Map the filter file, if there is one; returns 0 on success */
+extern int read_path_filters(void);
+
+/*
+ * Find the filter for the commit, as long as it was made against
+ * the given parent (NULL for "against the empty tree").
+ */
+extern int find_path_filter(const unsigned char *commit_sha1,
+			    const unsigned char *parent_sha1,
+			    struct path_filter *filter);
+
+extern void path_filter_add(unsigned char *bits, unsigned long size,
+			    const char *path, int len);
+extern int path_filter_maybe(const struct path_filter *filter,
+			     const char *path, int len);
+
+/*
+ * Set up the paths a walk is limited to.  Afterwards, a non-zero
+ * return from path_filter_untouched() means that the commit is known
+ * not to change any of them relative to parent.
+ */
+extern void setup_path_filters(const char **paths);
+extern int path_filter_untouched(struct commit *commit, struct commit *parent);
+
+#endif /* PATH_FILTER_H */
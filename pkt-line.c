@@ -1,5 +1,6 @@
 #include "cache.h"
 #include "pkt-line.h"
+#include <sys/socket.h>
 
 /*
  * Write a packetized stream, where each line is preceded by
@@ -13,9 +14,25 @@
  * into what might be the pack data (which should go to another
  * process entirely).
  *
- * The writing side could use stdio, but since the reading
- * side can't, we stay with pure read/write interfaces.
+ * Lines written with packet_write() are collected in a buffer, and
+ * go out in one write() when it fills up, at packet_flush(), at
+ * packet_send(), or before we wait for the other end to say something
+ * in packet_read_line().  The buffer holds lines for one fd at a time.
+ * Whoever writes lines and then does something the other end has to
+ * see without reading from it first (exec, fork, writing raw pack
+ * data) must call packet_send() before doing so.
+ *
+ * The reading side cannot simply read ahead, as whatever follows the
+ * lines may belong to somebody else.  When the fd is a socket, we
+ * peek at what has arrived and take only the complete packets in it,
+ * never going past a flush packet, which is where the protocol hands
+ * the stream to another process (or expects us to answer first).
+ * Anything else is read one packet at a time as before.
  */
+static char write_buffer[16384];
+static unsigned write_len;
+static int write_fd = -1;
+
 static void safe_write(int fd, const void *buf, unsigned n)
 {
 	while (n) {
@@ -31,34 +48,57 @@ static void safe_write(int fd, const void *buf, unsigned n)
 	}
 }
 
-/*
- * If we buffered things up above (we don't, but we should),
- * we'd flush it here
- */
+static void send_buffered(void)
+{
+	unsigned n = write_len;
+
+	if (n) {
+		write_len = 0;
+		safe_write(write_fd, write_buffer, n);
+	}
+}
+
+void packet_send(int fd)
+{
+	if (fd == write_fd)
+		send_buffered();
+}
+
 void packet_flush(int fd)
 {
-	safe_write(fd, "0000", 4);
+	if (fd != write_fd || sizeof(write_buffer) - write_len < 4)
+		send_buffered();
+	write_fd = fd;
+	memcpy(write_buffer + write_len, "0000", 4);
+	write_len += 4;
+	send_buffered();
 }
 
 #define hex(a) (hexchar[(a) & 15])
 void packet_write(int fd, const char *fmt, ...)
 {
-	static char buffer[1000];
 	static char hexchar[] = "0123456789abcdef";
 	va_list args;
+	char *buffer;
 	unsigned n;
 
+	/* Room for the longest line we allow, which is 1000 bytes */
+	if (fd != write_fd || sizeof(write_buffer) - write_len < 1000)
+		send_buffered();
+	write_fd = fd;
+	buffer = write_buffer + write_len;
+
 	va_start(args, fmt);
-	n = vsnprintf(buffer + 4, sizeof(buffer) - 4, fmt, args);
+	n = vsnprintf(buffer + 4, 1000 - 4, fmt, args);
 	va_end(args);
-	if (n >= sizeof(buffer)-4)
+	if (n >= 1000-4)
 		die("protocol error: impossibly long line");
 	n += 4;
 	buffer[0] = hex(n >> 12);
 	buffer[1] = hex(n >> 8);
 	buffer[2] = hex(n >> 4);
 	buffer[3] = hex(n);
-	safe_write(fd, buffer, n);
+	write_len += n;
 }
 
 static void safe_read(int fd, void *buffer, unsigned size)
@@ -75,15 +115,11 @@ static void safe_read(int fd, void *buffer, unsigned size)
 	}
 }
 
-int packet_read_line(int fd, char *buffer, unsigned size)
+static int packet_length(const char *linelen)
 {
 	int n;
-	unsigned len;
-	char linelen[4];
-
-	safe_read(fd, linelen, 4);
+	int len = 0;
 
-	len = 0;
 	for (n = 0; n < 4; n++) {
 		unsigned char c = linelen[n];
 		len <<= 4;
@@ -99,14 +135,95 @@ int packet_read_line(int fd, char *buffer, unsigned size)
 			len += c - 'A' + 10;
 			continue;
 		}
-		die("protocol error: bad line length character");
+		return -1;
+	}
+	return len;
+}
+
+static char read_buffer[16384];
+static unsigned read_pos, read_len;
+static int read_fd = -1, read_peek;
+
+/*
+ * Take the complete packets that have already arrived on a socket,
+ * up to and including the first flush packet.  Returns 0 when that
+ * is not possible, and the caller has to read the next packet by
+ * itself.
+ */
+static int fill_read_buffer(int fd)
+{
+	int n, pos, len;
+
+	if (fd != read_fd) {
+		read_fd = fd;
+		read_peek = 1;
+	}
+	if (!read_peek)
+		return 0;
+	do {
+		n = recv(fd, read_buffer, sizeof(read_buffer), MSG_PEEK);
+	} while (n < 0 && (errno == EINTR || errno == EAGAIN));
+	if (n < 0) {
+		/* Not a socket; do not bother trying again */
+		read_peek = 0;
+		return 0;
+	}
+
+	pos = 0;
+	while (pos + 4 <= n) {
+		len = packet_length(read_buffer + pos);
+		if (!len) {
+			pos += 4;
+			break;
+		}
+		if (len < 4 || n < pos + len)
+			break;
+		pos += len;
 	}
-	if (!len)
+	if (!pos)
 		return 0;
+	safe_read(fd, read_buffer, pos);
+	read_pos = 0;
+	read_len = pos;
+	return 1;
+}
+
+int packet_read_line(int fd, char *buffer, unsigned size)
+{
+	int len;
+	char linelen[4];
+
+	/* The other end may be waiting for what we have to say */
+	send_buffered();
+
+	if (read_pos < read_len && fd != read_fd)
+		die("protocol error: reading from two streams at once");
+	if (read_pos == read_len && !fill_read_buffer(fd)) {
+		safe_read(fd, linelen, 4);
+		len = packet_length(linelen);
+		if (len < 0)
+			die("protocol error: bad line length character");
+		if (!len)
+			return 0;
+		len -= 4;
+		if (len < 0 || len >= size)
+			die("protocol error: bad line length %d", len);
+		safe_read(fd, buffer, len);
+		buffer[len] = 0;
+		return len;
+	}
+
+	/* fill_read_buffer() has checked the lengths for us */
+	len = packet_length(read_buffer + read_pos);
+	if (!len) {
+		read_pos += 4;
+		return 0;
+	}
 	len -= 4;
 	if (len >= size)
 		die("protocol error: bad line length %d", len);
-	safe_read(fd, buffer, len);
+	memcpy(buffer, read_buffer + read_pos + 4, len);
 	buffer[len] = 0;
+	read_pos += len + 4;
 	return len;
 }
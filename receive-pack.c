@@ -2,12 +2,28 @@
 #include "refs.h"
 #include "pkt-line.h"
 #include "run-command.h"
+#include "pack.h"
 #include <sys/wait.h>
 
 static const char receive_pack_usage[] = "git-receive-pack <git-dir>";
 
 static const char unpacker[] = "git-unpack-objects";
 
+/*
+ * A push of fewer objects than this is exploded into loose objects;
+ * a bigger one is kept as the pack it came in.
+ */
+static int unpack_limit = 100;
+
+static int receive_pack_config(const char *var, const char *value)
+{
+	if (!strcmp(var, "receive.unpacklimit")) {
+		unpack_limit = git_config_int(var, value);
+		return 0;
+	}
+	return git_default_config(var, value);
+}
+
 static int show_ref(const char *path, const unsigned char *sha1)
 {
 	packet_write(1, "%s %s\n", sha1_to_hex(sha1), path);
@@ -222,9 +238,126 @@ static void read_head_info(void)
 	}
 }
 
+static const char **rev_list_argv;
+static int rev_list_argc, rev_list_alloc;
+
+static void push_rev_list_arg(const char *arg)
+{
+	if (rev_list_argc >= rev_list_alloc) {
+		rev_list_alloc = alloc_nr(rev_list_alloc);
+		rev_list_argv = xrealloc(rev_list_argv,
+					 rev_list_alloc * sizeof(*rev_list_argv));
+	}
+	rev_list_argv[rev_list_argc++] = arg;
+}
+
+static int add_ref_arg(const char *path, const unsigned char *sha1)
+{
+	char *arg = xmalloc(42);
+
+	arg[0] = '^';
+	strcpy(arg + 1, sha1_to_hex(sha1));
+	push_rev_list_arg(arg);
+	return 0;
+}
+
+/*
+ * git-index-pack has made sure a pack we keep as it came is well
+ * formed, but not that it brings everything the new refs need on
+ * top of what our refs already reach.  Walk from the new tips down
+ * to our refs and make sure every object on the way is there.
+ */
+static int check_connectivity(void)
+{
+	struct command *cmd;
+	int pipe_fd[2], status, missing = 0;
+	char line[100];
+	pid_t pid;
+	FILE *in;
+
+	rev_list_argc = 0;
+	push_rev_list_arg("git-rev-list");
+	push_rev_list_arg("--objects");
+	for (cmd = commands; cmd; cmd = cmd->next)
+		push_rev_list_arg(strdup(sha1_to_hex(cmd->new_sha1)));
+	for_each_ref(add_ref_arg);
+	push_rev_list_arg(NULL);
+
+	if (pipe(pipe_fd) < 0)
+		return error("unable to set up pipe");
+	pid = fork();
+	if (pid < 0)
+		return error("unable to fork off git-rev-list");
+	if (!pid) {
+		close(0);
+		dup2(pipe_fd[1], 1);
+		close(pipe_fd[0]);
+		close(pipe_fd[1]);
+		execvp("git-rev-list", (char **) rev_list_argv);
+		die("unable to exec git-rev-list");
+	}
+	close(pipe_fd[1]);
+	in = fdopen(pipe_fd[0], "r");
+	while (fgets(line, sizeof(line), in)) {
+		unsigned char sha1[20];
+		if (get_sha1_hex(line, sha1))
+			continue;
+		if (!has_sha1_file(sha1)) {
+			error("pushed objects are incomplete: missing %s",
+			      sha1_to_hex(sha1));
+			missing = 1;
+			break;
+		}
+	}
+	fclose(in);
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return error("waitpid failed");
+	}
+	if (missing)
+		return -1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return error("pushed objects are incomplete");
+	return 0;
+}
+
 static void unpack(void)
 {
-	int code = run_command(unpacker, NULL);
+	struct pack_header hdr;
+	char hdr_arg[40];
+	unsigned nr_objects;
+	int code, got = 0;
+
+	/*
+	 * Look at the pack header to see how many objects are coming,
+	 * and hand what we have read of it to whoever takes the rest.
+	 */
+	while (got < sizeof(hdr)) {
+		int ret = xread(0, (char *) &hdr + got, sizeof(hdr) - got);
+		if (ret <= 0)
+			die("protocol error: %s reading pack header",
+			    ret ? strerror(errno) : "early EOF");
+		got += ret;
+	}
+	if (ntohl(hdr.hdr_signature) != PACK_SIGNATURE)
+		die("protocol error: bad pack header");
+	if (ntohl(hdr.hdr_version) != PACK_VERSION)
+		die("protocol error: unable to handle pack version %u",
+		    ntohl(hdr.hdr_version));
+	nr_objects = ntohl(hdr.hdr_entries);
+
+	if (unpack_limit <= 0 || nr_objects >= unpack_limit) {
+		if (store_pack(0, &hdr, sizeof(hdr), "git-receive-pack"))
+			die("unable to store the pack");
+		reprepare_packed_git();
+		if (check_connectivity())
+			die("refusing to update refs");
+		return;
+	}
+
+	snprintf(hdr_arg, sizeof(hdr_arg), "--pack_header=%u,%u",
+		 ntohl(hdr.hdr_version), nr_objects);
+	code = run_command(unpacker, hdr_arg, NULL);
 	switch (code) {
 	case 0:
 		return;
@@ -268,6 +401,8 @@ int main(int argc, char **argv)
 	if(!enter_repo(dir, 0))
 		die("'%s': unable to chdir or not a git archive", dir);
 
+	git_config(receive_pack_config);
+
 	write_head_info();
 
 	/* EOF */
@@ -6,6 +6,7 @@
 #include "blob.h"
 #include "epoch.h"
 #include "diff.h"
+#include "path-filter.h"
 
 #define SEEN		(1u << 0)
 #define INTERESTING	(1u << 1)
@@ -492,7 +493,8 @@ static struct commit *try_to_simplify_merge(struct commit *commit, struct commit
 		parse_commit(p);
 		if (!p->tree)
 			continue;
-		if (same_tree(commit->tree, p->tree))
+		if (path_filter_untouched(commit, p) ||
+		    same_tree(commit->tree, p->tree))
 			return p;
 	}
 	return NULL;
@@ -566,7 +568,8 @@ static void compress_list(struct commit_list *list)
 		list = list->next;
 
 		if (!parent) {
-			if (!same_tree_as_empty(commit->tree))
+			if (!path_filter_untouched(commit, NULL) &&
+			    !same_tree_as_empty(commit->tree))
 				commit->object.flags |= TREECHANGE;
 			continue;
 		}
@@ -578,7 +581,9 @@ static void compress_list(struct commit_list *list)
 		if (!parent->next) {
 			struct tree *t1 = commit->tree;
 			struct tree *t2 = parent->item->tree;
-			if (!t1 || !t2 || same_tree(t1, t2))
+			if (!t1 || !t2 ||
+			    path_filter_untouched(commit, parent->item) ||
+			    same_tree(t1, t2))
 				continue;
 		}
 		commit->object.flags |= TREECHANGE;
@@ -858,6 +863,7 @@ int main(int argc, const char **argv)
 	if (paths) {
 		limited = 1;
 		diff_tree_setup_paths(paths);
+		setup_path_filters(paths);
 	}
 
 	save_commit_buffer = verbose_header;
@@ -876,13 +882,9 @@ int main(int argc, const char **argv)
 			sort_in_topological_order(&list);
 		show_commit_list(list);
 	} else {
-#ifndef NO_OPENSSL
 		if (sort_list_in_merge_order(list, &process_commit)) {
 			die("merge order sort failed\n");
 		}
-#else
-		die("merge order sort unsupported, OpenSSL not linked");
-#endif
 	}
 
 	return 0;
@@ -21,11 +21,115 @@ static int add_info_ref(const char *path, const unsigned char *sha1)
 	return 0;
 }
 
-static int update_info_refs(int force)
+static int compare_ref_name(const void *a_, const void *b_)
+{
+	const char * const *a = a_;
+	const char * const *b = b_;
+	return strcmp(*a, *b);
+}
+
+/* Where name[0..len) is in the sorted refs[], or -1 */
+static int find_ref_name(const char **refs, int nr, const char *name, int len)
+{
+	int lo = 0, hi = nr;
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		int cmp = strncmp(refs[mi], name, len);
+		if (!cmp && refs[mi][len])
+			cmp = 1;
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+
+static int add_named_ref(const char *path)
+{
+	unsigned char sha1[20];
+
+	/* a ref that is gone is simply not written */
+	if (strncmp(path, "refs/", 5) || get_ref_sha1(path + 5, sha1))
+		return 0;
+	return add_info_ref(path, sha1);
+}
+
+/*
+ * Copy the old info/refs to info_ref_fp as it is, except for the
+ * entries of the refs named, which are written afresh where they
+ * were (or dropped, if the ref is gone); the new ones go at the
+ * end.  Returns non-zero when the old file cannot be used.
+ */
+static int patch_info_refs(const char *path, const char **names)
+{
+	const char **refs;
+	char *done, *map, *cp, *end;
+	struct stat st;
+	int fd, nr, i;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	for (nr = 0; names[nr]; nr++)
+		;
+	refs = xmalloc(nr * sizeof(*refs));
+	memcpy(refs, names, nr * sizeof(*refs));
+	qsort(refs, nr, sizeof(*refs), compare_ref_name);
+	done = xcalloc(nr, 1);
+
+	for (cp = map, end = map + st.st_size; cp < end; ) {
+		char *eol = memchr(cp, '\n', end - cp);
+		char *name = cp + 41;
+		int len;
+
+		if (!eol || eol - cp < 42 || cp[40] != '\t')
+			goto stale;
+		len = eol - name;
+		if (len > 3 && !memcmp(eol - 3, "^{}", 3))
+			len -= 3;
+		i = find_ref_name(refs, nr, name, len);
+		if (i < 0)
+			fwrite(cp, 1, eol + 1 - cp, info_ref_fp);
+		else if (!done[i]) {
+			done[i] = 1;
+			add_named_ref(refs[i]);
+		}
+		cp = eol + 1;
+	}
+	for (i = 0; i < nr; i++)
+		if (!done[i])
+			add_named_ref(refs[i]);
+
+	munmap(map, st.st_size);
+	free(refs);
+	free(done);
+	return 0;
+
+ stale:
+	munmap(map, st.st_size);
+	free(refs);
+	free(done);
+	return -1;
+}
+
+static int update_info_refs(int force, const char **refs)
 {
 	char *path0 = strdup(git_path("info/refs"));
 	int len = strlen(path0);
 	char *path1 = xmalloc(len + 2);
+	int err;
 
 	strcpy(path1, path0);
 	strcpy(path1 + len, "+");
@@ -34,12 +138,19 @@ static int update_info_refs(int force)
 	info_ref_fp = fopen(path1, "w");
 	if (!info_ref_fp)
 		return error("unable to update %s", path0);
-	for_each_ref(add_info_ref);
-	fclose(info_ref_fp);
-	rename(path1, path0);
+	if (force || !refs || patch_info_refs(path0, refs)) {
+		rewind(info_ref_fp);
+		ftruncate(fileno(info_ref_fp), 0);
+		for_each_ref(add_info_ref);
+	}
+	err = ferror(info_ref_fp);
+	if (fclose(info_ref_fp) || err || rename(path1, path0)) {
+		unlink(path1);
+		err = error("unable to update %s", path0);
+	}
 	free(path0);
 	free(path1);
-	return 0;
+	return err;
 }
 
 /* packs */
@@ -202,6 +313,22 @@ static void write_pack_info_file(FILE *fp)
 		fprintf(fp, "P %s\n", info[i]->p->pack_name + objdirlen + 6);
 }
 
+/*
+ * Packs come and go by being created in and removed from
+ * objects/pack, so info/packs written after the directory last
+ * changed is still good.
+ */
+static int pack_info_fresh(const char *infofile)
+{
+	struct stat info_st, pack_st;
+	char packdir[PATH_MAX];
+
+	snprintf(packdir, sizeof(packdir), "%s/pack", get_object_directory());
+	if (stat(infofile, &info_st) || stat(packdir, &pack_st))
+		return 0;
+	return pack_st.st_mtime < info_st.st_mtime;
+}
+
 static int update_info_packs(int force)
 {
 	char infofile[PATH_MAX];
@@ -213,6 +340,9 @@ static int update_info_packs(int force)
 	strcpy(name, infofile);
 	strcpy(name + namelen, "+");
 
+	if (!force && pack_info_fresh(infofile))
+		return 0;
+
 	init_pack_info(infofile, force);
 
 	safe_create_leading_directories(name);
@@ -226,7 +356,7 @@ static int update_info_packs(int force)
 }
 
 /* public */
-int update_server_info(int force)
+int update_server_info(int force, const char **refs)
 {
 	/* We would add more dumb-server support files later,
 	 * including index of available pack files and their
@@ -234,7 +364,7 @@ int update_server_info(int force)
 	 */
 	int errs = 0;
 
-	errs = errs | update_info_refs(force);
+	errs = errs | update_info_refs(force, refs);
 	errs = errs | update_info_packs(force);
 
 	/* remove leftover rev-cache file if there is any */
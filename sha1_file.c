@@ -528,6 +528,12 @@ static void prepare_packed_git_one(char *objdir, int local)
 
 		/* we have .idx.  Is it a file we can map? */
 		strcpy(path + len, de->d_name);
+		for (p = packed_git; p; p = p->next)
+			if (!strncmp(p->pack_name, path, len + namelen - 4) &&
+			    !strcmp(p->pack_name + len + namelen - 4, ".pack"))
+				break;
+		if (p)
+			continue; /* already have it */
 		p = add_packed_git(path, len + namelen, local);
 		if (!p)
 			continue;
@@ -554,6 +560,15 @@ void prepare_packed_git(void)
 	run_once = 1;
 }
 
+/*
+ * Pick up the packs that appeared in our object directory since we
+ * last looked, e.g. one we have just received.
+ */
+void reprepare_packed_git(void)
+{
+	prepare_packed_git_one(get_object_directory(), 1);
+}
+
 int check_sha1_signature(const unsigned char *sha1, void *map, unsigned long size, const char *type)
 {
 	char header[100];
@@ -703,6 +718,42 @@ void * unpack_sha1_file(void *map, unsigned long mapsize, char *type, unsigned l
 static int packed_object_info(struct pack_entry *entry,
 			      char *type, unsigned long *sizep);
 
+/*
+ * The size of the object a delta produces is recorded near its
+ * beginning; inflate just enough of it to read that.
+ */
+static unsigned long delta_result_size(const unsigned char *delta,
+				       unsigned long left)
+{
+	const unsigned char *data;
+	unsigned char delta_head[64];
+	z_stream stream;
+	int st;
+
+	memset(&stream, 0, sizeof(stream));
+
+	stream.next_in = (unsigned char *)delta;
+	stream.avail_in = left;
+	stream.next_out = delta_head;
+	stream.avail_out = sizeof(delta_head);
+
+	inflateInit(&stream);
+	st = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	if ((st != Z_STREAM_END) &&
+	    stream.total_out != sizeof(delta_head))
+		die("delta data unpack-initial failed");
+
+	/* Examine the initial part of the delta to figure out
+	 * the result size.
+	 */
+	data = delta_head;
+	get_delta_hdr_size(&data); /* ignore base size */
+
+	/* Read the result size */
+	return get_delta_hdr_size(&data);
+}
+
 static int packed_delta_info(unsigned char *base_sha1,
 			     unsigned long delta_size,
 			     unsigned long left,
@@ -729,37 +780,8 @@ static int packed_delta_info(unsigned char *base_sha1,
 	if (packed_object_info(&base_ent, type, NULL))
 		die("cannot get info for delta-pack base");
 
-	if (sizep) {
-		const unsigned char *data;
-		unsigned char delta_head[64];
-		unsigned long result_size;
-		z_stream stream;
-		int st;
-
-		memset(&stream, 0, sizeof(stream));
-
-		data = stream.next_in = base_sha1 + 20;
-		stream.avail_in = left - 20;
-		stream.next_out = delta_head;
-		stream.avail_out = sizeof(delta_head);
-
-		inflateInit(&stream);
-		st = inflate(&stream, Z_FINISH);
-		inflateEnd(&stream);
-		if ((st != Z_STREAM_END) &&
-		    stream.total_out != sizeof(delta_head))
-			die("delta data unpack-initial failed");
-
-		/* Examine the initial part of the delta to figure out
-		 * the result size.
-		 */
-		data = delta_head;
-		get_delta_hdr_size(&data); /* ignore base size */
-
-		/* Read the result size */
-		result_size = get_delta_hdr_size(&data);
-		*sizep = result_size;
-	}
+	if (sizep)
+		*sizep = delta_result_size(base_sha1 + 20, left - 20);
 	return 0;
 }
 
@@ -1117,6 +1139,38 @@ int sha1_object_info(const unsigned char *sha1, char *type, unsigned long *sizep
 	return status;
 }
 
+/*
+ * Like sha1_object_info(), for callers that know what type the object
+ * is and only want its size: a delta in a pack is not followed to its
+ * base, and packs are looked at before loose objects, like
+ * read_sha1_file() does.
+ */
+int sha1_object_size(const unsigned char *sha1, unsigned long *sizep)
+{
+	struct pack_entry e;
+	char type[20];
+
+	if (find_pack_entry(sha1, &e)) {
+		struct packed_git *p = e.p;
+		enum object_type kind;
+		unsigned long offset, size;
+
+		if (use_packed_git(p))
+			die("cannot map packed file");
+		offset = unpack_object_header(p, e.offset, &kind, &size);
+		if (kind == OBJ_DELTA) {
+			if (p->pack_size - offset < 20)
+				die("truncated pack file");
+			size = delta_result_size(p->pack_base + offset + 20,
+						 p->pack_size - offset - 20);
+		}
+		unuse_packed_git(p);
+		*sizep = size;
+		return 0;
+	}
+	return sha1_object_info(sha1, type, sizep);
+}
+
 static void *read_packed_sha1(const unsigned char *sha1, char *type, unsigned long *size)
 {
 	struct pack_entry e;
@@ -8,9 +8,103 @@ static const char show_branch_usage[] =
 "git-show-branch [--all] [--heads] [--tags] [--topo-order] [--more=count | --list | --independent | --merge-base ] [<refs>...]";
 
 #define UNINTERESTING	01
+#define SEEN		02
+
+/*
+ * Which of the revs can reach a commit is kept in a bitset per
+ * commit, with one bit for every rev, so that there is no limit
+ * on the number of revs.  object.util is taken by the names (and
+ * by sort_in_topological_order), so the bitsets are found through
+ * a hash table of their own.
+ */
+static int rev_words;
+static unsigned int *all_revs;
+
+static struct commit **bits_commit;
+static unsigned int **bits_data;
+static int bits_nr, bits_alloc;
+
+static unsigned int bits_hash(struct commit *commit)
+{
+	unsigned int hash;
+	memcpy(&hash, commit->object.sha1, sizeof(hash));
+	return hash;
+}
 
-#define REV_SHIFT	 2
-#define MAX_REVS	29 /* should not exceed bits_per_int - REV_SHIFT */
+static void insert_bits(struct commit *commit, unsigned int *bits)
+{
+	unsigned int i = bits_hash(commit) % bits_alloc;
+
+	while (bits_commit[i])
+		if (++i == bits_alloc)
+			i = 0;
+	bits_commit[i] = commit;
+	bits_data[i] = bits;
+}
+
+static void grow_bits_table(void)
+{
+	struct commit **old_commit = bits_commit;
+	unsigned int **old_data = bits_data;
+	int i, old_alloc = bits_alloc;
+
+	bits_alloc = alloc_nr(bits_alloc) * 2;
+	bits_commit = xcalloc(bits_alloc, sizeof(*bits_commit));
+	bits_data = xcalloc(bits_alloc, sizeof(*bits_data));
+	for (i = 0; i < old_alloc; i++)
+		if (old_commit[i])
+			insert_bits(old_commit[i], old_data[i]);
+	free(old_commit);
+	free(old_data);
+}
+
+static unsigned int *rev_bits(struct commit *commit)
+{
+	unsigned int i, *bits;
+
+	if (bits_alloc) {
+		i = bits_hash(commit) % bits_alloc;
+		while (bits_commit[i]) {
+			if (bits_commit[i] == commit)
+				return bits_data[i];
+			if (++i == bits_alloc)
+				i = 0;
+		}
+	}
+	if (bits_alloc <= bits_nr * 2)
+		grow_bits_table();
+	bits = xcalloc(rev_words, sizeof(unsigned int));
+	insert_bits(commit, bits);
+	bits_nr++;
+	return bits;
+}
+
+static int has_rev(const unsigned int *bits, int rev)
+{
+	return !!(bits[rev / 32] & (1u << (rev % 32)));
+}
+
+static void set_rev(unsigned int *bits, int rev)
+{
+	bits[rev / 32] |= 1u << (rev % 32);
+}
+
+/* does "bits" have all the revs "want" has? */
+static int has_all_revs(const unsigned int *bits, const unsigned int *want)
+{
+	int i;
+	for (i = 0; i < rev_words; i++)
+		if ((bits[i] & want[i]) != want[i])
+			return 0;
+	return 1;
+}
+
+static void add_revs(unsigned int *bits, const unsigned int *add)
+{
+	int i;
+	for (i = 0; i < rev_words; i++)
+		bits[i] |= add[i];
+}
 
 static struct commit *interesting(struct commit_list *list)
 {
@@ -166,7 +260,8 @@ static void name_commits(struct commit_list *list,
 
 static int mark_seen(struct commit *commit, struct commit_list **seen_p)
 {
-	if (!commit->object.flags) {
+	if (!(commit->object.flags & SEEN)) {
+		commit->object.flags |= SEEN;
 		insert_by_date(commit, seen_p);
 		return 1;
 	}
@@ -175,36 +270,36 @@ static int mark_seen(struct commit *commit, struct commit_list **seen_p)
 
 static void join_revs(struct commit_list **list_p,
 		      struct commit_list **seen_p,
-		      int num_rev, int extra)
+		      int extra)
 {
-	int all_mask = ((1u << (REV_SHIFT + num_rev)) - 1);
-	int all_revs = all_mask & ~((1u << REV_SHIFT) - 1);
-
 	while (*list_p) {
 		struct commit_list *parents;
 		int still_interesting = !!interesting(*list_p);
 		struct commit *commit = pop_one_commit(list_p);
-		int flags = commit->object.flags & all_mask;
+		unsigned int *revs = rev_bits(commit);
+		int flags = commit->object.flags & UNINTERESTING;
 
 		if (!still_interesting && extra <= 0)
 			break;
 
 		mark_seen(commit, seen_p);
-		if ((flags & all_revs) == all_revs)
+		if (has_all_revs(revs, all_revs))
 			flags |= UNINTERESTING;
 		parents = commit->parents;
 
 		while (parents) {
 			struct commit *p = parents->item;
-			int this_flag = p->object.flags;
+			unsigned int *p_revs = rev_bits(p);
 			parents = parents->next;
-			if ((this_flag & flags) == flags)
+			if ((p->object.flags & flags) == flags &&
+			    has_all_revs(p_revs, revs))
 				continue;
 			if (!p->object.parsed)
 				parse_commit(p);
 			if (mark_seen(p, seen_p) && !still_interesting)
 				extra--;
 			p->object.flags |= flags;
+			add_revs(p_revs, revs);
 			insert_by_date(p, list_p);
 		}
 	}
@@ -224,8 +319,8 @@ static void join_revs(struct commit_list **list_p,
 			struct commit *c = s->item;
 			struct commit_list *parents;
 
-			if (((c->object.flags & all_revs) != all_revs) &&
-			    !(c->object.flags & UNINTERESTING))
+			if (!(c->object.flags & UNINTERESTING) &&
+			    !has_all_revs(rev_bits(c), all_revs))
 				continue;
 
 			/* The current commit is either a merge base or
@@ -281,8 +376,8 @@ static void show_one_commit(struct commit *commit, int no_name)
 	puts(cp);
 }
 
-static char *ref_name[MAX_REVS + 1];
-static int ref_name_cnt;
+static char **ref_name;
+static int ref_name_cnt, ref_name_alloc;
 
 static int compare_ref_name(const void *a_, const void *b_)
 {
@@ -301,11 +396,10 @@ static int append_ref(const char *refname, const unsigned char *sha1)
 	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
 	if (!commit)
 		return 0;
-	if (MAX_REVS <= ref_name_cnt) {
-		fprintf(stderr, "warning: ignoring %s; "
-			"cannot handle more than %d refs",
-			refname, MAX_REVS);
-		return 0;
+	if (ref_name_alloc <= ref_name_cnt + 1) {
+		ref_name_alloc = alloc_nr(ref_name_alloc);
+		ref_name = xrealloc(ref_name,
+				    ref_name_alloc * sizeof(*ref_name));
 	}
 	ref_name[ref_name_cnt++] = strdup(refname);
 	ref_name[ref_name_cnt] = NULL;
@@ -397,17 +491,14 @@ static int rev_is_head(char *head_path, int headlen,
 	return 0;
 }
 
-static int show_merge_base(struct commit_list *seen, int num_rev)
+static int show_merge_base(struct commit_list *seen)
 {
-	int all_mask = ((1u << (REV_SHIFT + num_rev)) - 1);
-	int all_revs = all_mask & ~((1u << REV_SHIFT) - 1);
 	int exit_status = 1;
 
 	while (seen) {
 		struct commit *commit = pop_one_commit(&seen);
-		int flags = commit->object.flags & all_mask;
-		if (!(flags & UNINTERESTING) &&
-		    ((flags & all_revs) == all_revs)) {
+		if (!(commit->object.flags & UNINTERESTING) &&
+		    has_all_revs(rev_bits(commit), all_revs)) {
 			puts(sha1_to_hex(commit->object.sha1));
 			exit_status = 0;
 			commit->object.flags |= UNINTERESTING;
@@ -419,15 +510,16 @@ static int show_merge_base(struct commit_list *seen, int num_rev)
 static int show_independent(struct commit **rev,
 			    int num_rev,
 			    char **ref_name,
-			    unsigned int *rev_mask)
+			    unsigned int **rev_mask)
 {
 	int i;
 
 	for (i = 0; i < num_rev; i++) {
 		struct commit *commit = rev[i];
-		unsigned int flag = rev_mask[i];
 
-		if (commit->object.flags == flag)
+		if (!(commit->object.flags & UNINTERESTING) &&
+		    !memcmp(rev_bits(commit), rev_mask[i],
+			    rev_words * sizeof(unsigned int)))
 			puts(sha1_to_hex(commit->object.sha1));
 		commit->object.flags |= UNINTERESTING;
 	}
@@ -447,8 +539,7 @@ static void append_one_rev(const char *av)
 		match_ref_pattern = av;
 		match_ref_slash = count_slash(av);
 		for_each_ref(append_matching_ref);
-		if (saved_matches == ref_name_cnt &&
-		    ref_name_cnt < MAX_REVS)
+		if (saved_matches == ref_name_cnt)
 			error("no matching refs with %s", av);
 		if (saved_matches + 1 < ref_name_cnt)
 			sort_ref_range(saved_matches, ref_name_cnt);
@@ -459,12 +550,11 @@ static void append_one_rev(const char *av)
 
 int main(int ac, char **av)
 {
-	struct commit *rev[MAX_REVS], *commit;
+	struct commit **rev, *commit;
 	struct commit_list *list = NULL, *seen = NULL;
-	unsigned int rev_mask[MAX_REVS];
+	unsigned int **rev_mask;
 	int num_rev, i, extra = 0;
 	int all_heads = 0, all_tags = 0;
-	int all_mask, all_revs;
 	char head_path[128];
 	const char *head_path_p;
 	int head_path_len;
@@ -530,12 +620,14 @@ int main(int ac, char **av)
 		exit(0);
 	}
 
+	rev = xmalloc(ref_name_cnt * sizeof(*rev));
+	rev_mask = xmalloc(ref_name_cnt * sizeof(*rev_mask));
+	rev_words = (ref_name_cnt + 31) / 32;
+	all_revs = xcalloc(rev_words, sizeof(unsigned int));
+
 	for (num_rev = 0; ref_name[num_rev]; num_rev++) {
 		unsigned char revkey[20];
-		unsigned int flag = 1u << (num_rev + REV_SHIFT);
 
-		if (MAX_REVS <= num_rev)
-			die("cannot handle more than %d revs.", MAX_REVS);
 		if (get_sha1(ref_name[num_rev], revkey))
 			die("'%s' is not a valid ref.\n", ref_name[num_rev]);
 		commit = lookup_commit_reference(revkey);
@@ -543,22 +635,22 @@ int main(int ac, char **av)
 			die("cannot find commit %s (%s)",
 			    ref_name[num_rev], revkey);
 		parse_commit(commit);
-		mark_seen(commit, &seen);
-
-		/* rev#0 uses bit REV_SHIFT, rev#1 uses bit REV_SHIFT+1,
-		 * and so on.  REV_SHIFT bits from bit 0 are used for
-		 * internal bookkeeping.
-		 */
-		commit->object.flags |= flag;
-		if (commit->object.flags == flag)
+		if (mark_seen(commit, &seen))
 			insert_by_date(commit, &list);
+
+		/* rev#0 uses bit 0, rev#1 uses bit 1, and so on. */
+		set_rev(rev_bits(commit), num_rev);
+		set_rev(all_revs, num_rev);
 		rev[num_rev] = commit;
 	}
-	for (i = 0; i < num_rev; i++)
-		rev_mask[i] = rev[i]->object.flags;
+	for (i = 0; i < num_rev; i++) {
+		rev_mask[i] = xmalloc(rev_words * sizeof(unsigned int));
+		memcpy(rev_mask[i], rev_bits(rev[i]),
+		       rev_words * sizeof(unsigned int));
+	}
 
 	if (0 <= extra)
-		join_revs(&list, &seen, num_rev, extra);
+		join_revs(&list, &seen, extra);
 
 	head_path_p = resolve_ref(git_path("HEAD"), head_sha1, 1);
 	if (head_path_p) {
@@ -571,7 +663,7 @@ int main(int ac, char **av)
 	}
 
 	if (merge_base)
-		return show_merge_base(seen, num_rev);
+		return show_merge_base(seen);
 
 	if (independent)
 		return show_independent(rev, num_rev, ref_name, rev_mask);
@@ -614,19 +706,15 @@ int main(int ac, char **av)
 	if (!sha1_name && !no_name)
 		name_commits(seen, rev, ref_name, num_rev);
 
-	all_mask = ((1u << (REV_SHIFT + num_rev)) - 1);
-	all_revs = all_mask & ~((1u << REV_SHIFT) - 1);
-
 	while (seen) {
 		struct commit *commit = pop_one_commit(&seen);
-		int this_flag = commit->object.flags;
+		unsigned int *this_revs = rev_bits(commit);
 
-		shown_merge_point |= ((this_flag & all_revs) == all_revs);
+		shown_merge_point |= has_all_revs(this_revs, all_revs);
 
 		if (1 < num_rev) {
 			for (i = 0; i < num_rev; i++)
-				putchar((this_flag & (1u << (i + REV_SHIFT)))
-					? '+' : ' ');
+				putchar(has_rev(this_revs, i) ? '+' : ' ');
 			putchar(' ');
 		}
 		show_one_commit(commit, no_name);
@@ -0,0 +1,97 @@
+#include "cache.h"
+#include "pkt-line.h"
+#include "sideband.h"
+
+/*
+ * Read a multiplexed pack stream from in_stream until the flush
+ * packet that ends it, writing the pack data to "out", and the
+ * messages from the other end to "err" with "remote: " in front of
+ * each line (or nowhere, if "err" is negative).  Returns 0 when the
+ * stream ended normally, and -1 when the other end reported an error
+ * or sent garbage.
+ */
+int recv_sideband(const char *me, int in_stream, int out, int err)
+{
+	static char buf[LARGE_PACKET_MAX + 1];
+	int at_line_start = 1;
+
+	for (;;) {
+		int len = packet_read_line(in_stream, buf, sizeof(buf));
+		char *data = buf + 1;
+
+		if (!len)
+			return 0;
+		len--;
+		switch (buf[0]) {
+		case SIDEBAND_DATA:
+			while (len) {
+				int ret = xwrite(out, data, len);
+				if (ret <= 0)
+					return error("%s: unable to write pack data (%s)",
+						     me, ret ? strerror(errno) : "disk full?");
+				data += ret;
+				len -= ret;
+			}
+			continue;
+		case SIDEBAND_PROGRESS:
+			if (err < 0)
+				continue;
+			while (len) {
+				int n = 0;
+
+				while (n < len && data[n] != '\n' && data[n] != '\r')
+					n++;
+				if (n < len)
+					n++;
+				if (at_line_start)
+					write(err, "remote: ", 8);
+				write(err, data, n);
+				at_line_start = (data[n-1] == '\n' || data[n-1] == '\r');
+				data += n;
+				len -= n;
+			}
+			continue;
+		case SIDEBAND_ERROR:
+			if (!at_line_start && 0 <= err)
+				write(err, "\n", 1);
+			return error("%s: remote error: %.*s", me,
+				     len && data[len-1] == '\n' ? len - 1 : len,
+				     data);
+		default:
+			return error("%s: protocol error: bad band #%d",
+				     me, buf[0] & 0xff);
+		}
+	}
+}
+
+/*
+ * Send "data" in "band", in packets as large as the protocol allows.
+ * Whatever packet_write() has buffered for fd must have been sent
+ * with packet_send() first.
+ */
+void send_sideband(int fd, int band, const char *data, unsigned sz)
+{
+	static char buf[LARGE_PACKET_MAX];
+
+	while (sz) {
+		unsigned n = sz, len;
+		char *p = buf;
+
+		if (LARGE_PACKET_MAX - 5 < n)
+			n = LARGE_PACKET_MAX - 5;
+		sprintf(buf, "%04x", n + 5);
+		buf[4] = band;
+		memcpy(buf + 5, data, n);
+		len = n + 5;
+		while (len) {
+			int ret = xwrite(fd, p, len);
+			if (ret <= 0)
+				die("write error (%s)",
+				    ret ? strerror(errno) : "disk full?");
+			p += ret;
+			len -= ret;
+		}
+		data += n;
+		sz -= n;
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef SIDEBAND_H
+#define SIDEBAND_H
+
+/*
+ * The pack stream multiplexed into pkt-lines: the first byte of each
+ * line says which band it belongs to.
+ */
+#define SIDEBAND_DATA		1	/* the pack data itself */
+#define SIDEBAND_PROGRESS	2	/* messages for the user */
+#define SIDEBAND_ERROR		3	/* the other end gave up */
+
+#define LARGE_PACKET_MAX	65520
+
+int recv_sideband(const char *me, int in_stream, int out, int err);
+void send_sideband(int fd, int band, const char *data, unsigned sz);
+
+#endif
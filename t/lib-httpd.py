@@ -0,0 +1,239 @@
+#!/usr/bin/env python
+#
+# A static HTTP server for the tests of the dumb HTTP transport.
+#
+#   lib-httpd.py <port> <root> <log> [--no-range] [--dav] [--refuse=<path>]
+#
+# It serves the files under <root>, honours a single "Range: bytes="
+# (unless --no-range) and writes "<path> <range or ->" to <log> for
+# every request, so that a test can see what was asked for.
+#
+# With --dav it also takes the few WebDAV requests git-http-push
+# makes (PROPFIND, LOCK, UNLOCK, MKCOL, PUT, MOVE), logged as
+# "<path> <method>".  A PUT or MOVE to a path under a --refuse=
+# prefix is answered with 403.
+
+import os, re, sys, threading, uuid
+
+try:
+	from http.server import HTTPServer, BaseHTTPRequestHandler
+	from socketserver import ThreadingMixIn
+except ImportError:
+	from BaseHTTPServer import HTTPServer, BaseHTTPRequestHandler
+	from SocketServer import ThreadingMixIn
+
+port, root, log = int(sys.argv[1]), sys.argv[2], sys.argv[3]
+use_range = '--no-range' not in sys.argv[4:]
+use_dav = '--dav' in sys.argv[4:]
+refuse = [a[9:] for a in sys.argv[4:] if a.startswith('--refuse=')]
+log_lock = threading.Lock()
+locks = {}	# path -> token
+
+PROPFIND_RESPONSE = '''<?xml version="1.0" encoding="utf-8"?>
+<D:multistatus xmlns:D="DAV:"><D:response><D:href>%s</D:href>
+<D:propstat><D:prop><D:supportedlock><D:lockentry>
+<D:lockscope><D:exclusive/></D:lockscope><D:locktype><D:write/></D:locktype>
+</D:lockentry></D:supportedlock></D:prop>
+<D:status>HTTP/1.1 200 OK</D:status></D:propstat></D:response>
+</D:multistatus>
+'''
+
+LOCK_RESPONSE = '''<?xml version="1.0" encoding="utf-8"?>
+<D:prop xmlns:D="DAV:"><D:lockdiscovery><D:activelock>
+<D:locktype><D:write/></D:locktype><D:lockscope><D:exclusive/></D:lockscope>
+<D:depth>0</D:depth><D:owner><D:href>%s</D:href></D:owner>
+<D:timeout>Second-600</D:timeout>
+<D:locktoken><D:href>opaquelocktoken:%s</D:href></D:locktoken>
+</D:activelock></D:lockdiscovery></D:prop>
+'''
+
+def log_request(path, what):
+	log_lock.acquire()
+	f = open(log, 'a')
+	f.write('%s %s\n' % (path, what))
+	f.close()
+	log_lock.release()
+
+class Handler(BaseHTTPRequestHandler):
+	protocol_version = 'HTTP/1.1'
+	disable_nagle_algorithm = True
+
+	def log_message(self, *args):
+		pass
+
+	def reply(self, code, body=b'', type=None):
+		self.send_response(code)
+		if type:
+			self.send_header('Content-Type', type)
+		self.send_header('Content-Length', str(len(body)))
+		self.end_headers()
+		if body and self.command != 'HEAD':
+			self.wfile.write(body)
+
+	def file_name(self, path):
+		if '..' in path.split('/'):
+			return None
+		return os.path.join(root, path.lstrip('/'))
+
+	def body(self):
+		if self.headers.get('Transfer-Encoding', '') == 'chunked':
+			data = b''
+			while True:
+				size = int(self.rfile.readline().split(b';')[0], 16)
+				if not size:
+					self.rfile.readline()
+					return data
+				data += self.rfile.read(size)
+				self.rfile.readline()
+		return self.rfile.read(int(self.headers.get('Content-Length', 0)))
+
+	def locked(self, path):
+		token = locks.get(path)
+		return token and token not in self.headers.get('If', '')
+
+	def do_GET(self):
+		path = self.path.split('?')[0]
+		range = self.headers.get('Range')
+		log_request(path, range or '-')
+
+		name = self.file_name(path)
+		if not name or not os.path.isfile(name):
+			self.reply(404)
+			return
+		data = open(name, 'rb').read()
+		m = use_range and range and \
+			re.match(r'bytes=(\d+)-(\d*)$', range)
+		if m:
+			start = int(m.group(1))
+			end = m.group(2) and int(m.group(2)) or len(data) - 1
+			end = min(end, len(data) - 1)
+			if start >= len(data):
+				self.reply(416)
+				return
+			self.send_response(206)
+			self.send_header('Content-Range', 'bytes %d-%d/%d' %
+					 (start, end, len(data)))
+			data = data[start:end + 1]
+		else:
+			self.send_response(200)
+		self.send_header('Content-Length', str(len(data)))
+		self.end_headers()
+		self.wfile.write(data)
+
+	def do_HEAD(self):
+		path = self.path.split('?')[0]
+		log_request(path, 'HEAD')
+		name = self.file_name(path)
+		if not name or not os.path.isfile(name):
+			self.reply(404)
+			return
+		self.send_response(200)
+		self.send_header('Content-Length', str(os.path.getsize(name)))
+		self.end_headers()
+
+	def do_PROPFIND(self):
+		path = self.path.split('?')[0]
+		log_request(path, 'PROPFIND')
+		self.body()
+		if not use_dav:
+			self.reply(405)
+			return
+		self.reply(207, (PROPFIND_RESPONSE % path).encode(),
+			   'text/xml; charset="utf-8"')
+
+	def do_LOCK(self):
+		path = self.path.split('?')[0]
+		log_request(path, 'LOCK')
+		body = self.body().decode()
+		if not use_dav:
+			self.reply(405)
+			return
+		if path in locks:
+			if self.locked(path):
+				self.reply(423)
+				return
+			token = locks[path]	# a refresh
+		else:
+			token = str(uuid.uuid4())
+			locks[path] = token
+		m = re.search(r'<D:href>([^<]*)</D:href>', body)
+		owner = m and m.group(1) or ''
+		self.reply(200, (LOCK_RESPONSE % (owner, token)).encode(),
+			   'text/xml; charset="utf-8"')
+
+	def do_UNLOCK(self):
+		path = self.path.split('?')[0]
+		log_request(path, 'UNLOCK')
+		token = locks.get(path)
+		if not use_dav or not token or \
+		   token not in self.headers.get('Lock-Token', ''):
+			self.reply(409)
+			return
+		del locks[path]
+		self.reply(204)
+
+	def do_MKCOL(self):
+		path = self.path.split('?')[0]
+		log_request(path, 'MKCOL')
+		name = self.file_name(path)
+		if not use_dav or not name or os.path.exists(name):
+			self.reply(405)
+			return
+		if not os.path.isdir(os.path.dirname(name.rstrip('/'))):
+			self.reply(409)
+			return
+		os.mkdir(name)
+		self.reply(201)
+
+	def do_PUT(self):
+		path = self.path.split('?')[0]
+		log_request(path, 'PUT')
+		data = self.body()
+		name = self.file_name(path)
+		if not use_dav or not name:
+			self.reply(405)
+			return
+		if [p for p in refuse if path.startswith(p)]:
+			self.reply(403)
+			return
+		if self.locked(path):
+			self.reply(423)
+			return
+		if not os.path.isdir(os.path.dirname(name)):
+			self.reply(409)
+			return
+		f = open(name, 'wb')
+		f.write(data)
+		f.close()
+		self.reply(201)
+
+	def do_MOVE(self):
+		path = self.path.split('?')[0]
+		log_request(path, 'MOVE')
+		dest = re.sub(r'^[a-z]+://[^/]*', '',
+			      self.headers.get('Destination', ''))
+		name, dest_name = self.file_name(path), self.file_name(dest)
+		if not use_dav or not name or not dest_name:
+			self.reply(405)
+			return
+		if [p for p in refuse if dest.startswith(p)]:
+			self.reply(403)
+			return
+		if not os.path.isfile(name):
+			self.reply(404)
+			return
+		if self.locked(dest):
+			self.reply(423)
+			return
+		os.rename(name, dest_name)
+		self.reply(201)
+
+class Server(ThreadingMixIn, HTTPServer):
+	daemon_threads = True
+
+	# A client that stops reading a response it does not want
+	# is not an error worth a traceback.
+	def handle_error(self, request, client_address):
+		pass
+
+Server(('127.0.0.1', port), Handler).serve_forever()
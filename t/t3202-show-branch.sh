@@ -0,0 +1,49 @@
+#!/bin/sh
+
+test_description='git-show-branch with many branches
+
+There used to be a limit of 29 refs; make sure more than that
+are shown, and that merge bases are still found.
+'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	echo base >file &&
+	git-update-index --add file &&
+	tree=$(git-write-tree) &&
+	base=$(echo base | git-commit-tree $tree) &&
+	echo $base >.git/refs/heads/master &&
+	i=0 &&
+	while test $i -lt 40
+	do
+		i=$(($i+1)) &&
+		echo $i >file &&
+		git-update-index file &&
+		tree=$(git-write-tree) &&
+		c=$(echo $i | git-commit-tree $tree -p $base) &&
+		echo $c >.git/refs/heads/b$i
+	done &&
+	test $i = 40
+'
+
+test_expect_success 'all branches are listed' '
+	test $(git-show-branch --list | wc -l) = 41
+'
+
+test_expect_success 'common commit is marked in every column' '
+	git-show-branch >out 2>err &&
+	! test -s err &&
+	test "$(sed -n -e "s/^\([+ ]*\) \[master\] base$/\1/p" out)" = \
+		"+++++++++++++++++++++++++++++++++++++++++"
+'
+
+test_expect_success 'merge base of all of them' '
+	test "$(git-show-branch --merge-base)" = "$base"
+'
+
+test_expect_success 'independent branches' '
+	test $(git-show-branch --independent | wc -l) = 40 &&
+	! git-show-branch --independent | grep $base
+'
+
+test_done
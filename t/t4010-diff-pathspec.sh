@@ -62,4 +62,30 @@ test_expect_success \
     'git-diff-index --cached $tree file0/ >current &&
      compare_diff_raw current expected'
 
+test_expect_success \
+    'diff-tree limited to path1 and file0/' \
+    'tree2=`git-write-tree` &&
+     git-diff-tree -r $tree $tree2 path1 file0/ >current &&
+     echo ":100644 100644 766498d93a4b06057a8e49d23f4068f1170ff38f 0a41e115ab61be0328a19b29f18cdcb49338d516 M	path1/file1" >expected &&
+     compare_diff_raw current expected'
+
+test_expect_success \
+    'diff-tree limited to path shows nothing' \
+    'git-diff-tree -r $tree $tree2 path >current &&
+     test ! -s current'
+
+test_expect_success \
+    'diff-tree skips an unchanged subtree' \
+    'mkdir path2 &&
+     echo xyzzy >path2/file2 &&
+     git-update-index --add path2/file2 &&
+     tree3=`git-write-tree` &&
+     echo gnusto >file0 &&
+     git-update-index file0 &&
+     tree4=`git-write-tree` &&
+     git-diff-tree -r $tree3 $tree4 >current &&
+     git-diff-tree -r $tree3 $tree4 path1 path2 >current2 &&
+     test `wc -l <current` = 1 &&
+     test ! -s current2'
+
 test_done
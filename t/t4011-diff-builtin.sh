@@ -0,0 +1,100 @@
+#!/bin/sh
+
+test_description='built-in diff output engine.
+
+Patches are produced in-core unless GIT_DIFF_OPTS asks for something
+the built-in engine does not do, in which case "diff" is run.  "-a"
+is a no-op for text files but makes us run "diff", so the two can
+be compared.
+'
+. ./test-lib.sh
+
+cat >file <<\EOF
+#include <stdio.h>
+
+static int one(void)
+{
+	return 1;
+}
+
+static int two(void)
+{
+	int x = 1;
+
+	x++;
+	return x;
+}
+
+int main(void)
+{
+	printf("%d\n", one());
+
+	printf("%d\n", two());
+	return 0;
+}
+EOF
+printf 'one\ntwo\nthree' >nonl
+printf 'a\0b\n' >binary
+for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+do
+	echo "line $i"
+done >long
+
+test_expect_success setup '
+	git-update-index --add file nonl binary long &&
+	tree=$(git-write-tree) &&
+	sed -e "s/return 1/return 0/" -e "/x++/d" -e "s/two()/two() + 1/" \
+		<file >file.new && mv file.new file &&
+	printf "one\ntwo\nthree\n" >nonl &&
+	printf "a\0c\n" >binary &&
+	sed -e "s/^line 3$/third/" -e "/^line 18$/d" <long >long.new &&
+	echo "line 21" >>long.new && mv long.new long
+'
+
+for opts in "" "-pu" "-U0" "-U1 -p" "--unified=5" "-U 2 --show-c-function"
+do
+	test_expect_success "GIT_DIFF_OPTS=\"$opts\"" "
+		GIT_DIFF_OPTS='$opts' git-diff-files -p file nonl long >builtin &&
+		GIT_DIFF_OPTS='-a $opts' git-diff-files -p file nonl long >external &&
+		cmp builtin external
+	"
+done
+
+test_expect_success 'function name in hunk header' '
+	GIT_DIFF_OPTS=-pu git-diff-files -p file >actual &&
+	grep "^@@ .* @@ int main(void)$" actual
+'
+
+test_expect_success 'incomplete line' '
+	git-diff-files -p nonl >actual &&
+	grep "^\\\\ No newline at end of file$" actual
+'
+
+test_expect_success 'binary files' '
+	git-diff-files -p binary >actual &&
+	grep "^Binary files a/binary and b/binary differ$" actual
+'
+
+test_expect_success 'creation and deletion' '
+	rm -f nonl &&
+	git-update-index --remove nonl &&
+	echo new >newfile &&
+	git-update-index --add newfile &&
+	git-diff-index -p --cached $tree nonl newfile >builtin &&
+	GIT_DIFF_OPTS="-a -u" \
+	git-diff-index -p --cached $tree nonl newfile >external &&
+	cmp builtin external &&
+	grep "^+++ /dev/null" builtin &&
+	grep "^--- /dev/null" builtin
+'
+
+test_expect_success 'a blob that cannot be read is an error' '
+	echo gone >gone &&
+	git-update-index --add gone &&
+	blob=$(git-ls-files -s gone | cut -d" " -f2) &&
+	rm -f gone .git/objects/$(echo $blob | sed -e "s|^..|&/|") &&
+	! git-diff-index -p --cached $tree gone >actual &&
+	! test -s actual
+'
+
+test_done
@@ -0,0 +1,80 @@
+#!/bin/sh
+
+test_description='Rename detection with many candidate sources.
+
+Only the sources that look most alike are compared with a delta when
+there are many of them; make sure the right ones are still found.
+'
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir src &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+	do
+		sed -e "s/Free Software Foundation/FSF $i/" \
+			<../../COPYING >src/file$i || break
+	done &&
+	sed -e "s/GNU/Gnu/g" <../../COPYING >src/exact &&
+	git-update-index --add src/* &&
+	tree=$(git-write-tree) &&
+	mkdir dst &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+	do
+		sed -e "s/HOWEVER/However, $i/" <src/file$i >dst/file$i &&
+		rm -f src/file$i || break
+	done &&
+	mv src/exact dst/exact &&
+	git-update-index --add --remove src/* dst/*
+'
+
+test_expect_success 'edited files are renamed from the right source' '
+	git-diff-index -M $tree >current &&
+	sed -n -e "s/^.* R[0-9]*	\(src\/file.*\)	\(.*\)$/\1 \2/p" \
+		<current | sort >renamed &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+	do
+		echo "src/file$i dst/file$i"
+	done | sort >expected &&
+	cmp renamed expected
+'
+
+test_expect_success 'exact renames' '
+	grep " R100	src/exact	dst/exact\$" current
+'
+
+test_expect_success 'exact copies' '
+	git-diff-index -C --find-copies-harder $tree >current &&
+	grep " R100	src/exact	dst/exact\$" current &&
+	cp dst/exact dst/copy &&
+	git-update-index --add dst/copy &&
+	git-diff-index -C --find-copies-harder $tree >current &&
+	grep " C100	src/exact	dst/copy\$" current
+'
+
+test_expect_success 'sources the signatures cannot tell apart are all tried' '
+	mkdir perm &&
+	for m in 2 3 4 5 6 7 8 9 10 11 12 13
+	do
+		awk -v m=$m "BEGIN { for (k = 1; k < 211; k++) print \"line \" k * m % 211 }" \
+			>perm/$m || break
+	done &&
+	git-update-index --add perm/* &&
+	ptree=$(git-write-tree) &&
+	sed -e "s/^line 7\$/line seven/" <perm/9 >perm/copy &&
+	git-update-index --add perm/copy &&
+	git-diff-index -C --find-copies-harder $ptree >current &&
+	grep " C[0-9]*	perm/9	perm/copy\$" current
+'
+
+test_expect_success 'result does not depend on the number of threads' '
+	for t in 1 2 5
+	do
+		git-repo-config diff.threads $t &&
+		git-diff-index -B -C --find-copies-harder $tree >current.$t ||
+		break
+	done &&
+	cmp current.1 current.2 &&
+	cmp current.1 current.5
+'
+
+test_done
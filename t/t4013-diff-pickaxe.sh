@@ -0,0 +1,59 @@
+#!/bin/sh
+
+test_description='Pickaxe (-S) with fixed strings and regexps.
+
+'
+. ./test-lib.sh
+
+test_expect_success setup '
+	printf "aaa\nfoo(1)\nbar\n" >one &&
+	printf "xyzzy frotz\n" >two &&
+	git-update-index --add one two &&
+	tree=$(git-write-tree) &&
+	printf "aaaa\nfoo(2)\nbar\n" >one &&
+	printf "xyzzy frotz nitfol\n" >two &&
+	git-update-index one two
+'
+
+test_expect_success 'occurrences are counted without overlap' '
+	git-diff-index -Saa --name-only $tree >current &&
+	echo one >expected &&
+	cmp current expected &&
+	git-diff-index -Saaa --name-only $tree >current &&
+	cmp current /dev/null
+'
+
+test_expect_success 'long needle' '
+	git-diff-index -S"frotz nitfol" --name-only $tree >current &&
+	echo two >expected &&
+	cmp current expected &&
+	git-diff-index -S"xyzzy frotz" --name-only $tree >current &&
+	cmp current /dev/null
+'
+
+test_expect_success 'without --pickaxe-regex the string is literal' '
+	git-diff-index -S"foo(" --name-only $tree >current &&
+	cmp current /dev/null
+'
+
+test_expect_success '--pickaxe-regex' '
+	git-diff-index --pickaxe-regex -S"z+ .*l$" --name-only $tree >current &&
+	echo two >expected &&
+	cmp current expected &&
+	git-diff-index --pickaxe-regex -S"^a{4}$" --name-only $tree >current &&
+	echo one >expected &&
+	cmp current expected
+'
+
+test_expect_success '--pickaxe-regex with --pickaxe-all' '
+	git-diff-index --pickaxe-regex --pickaxe-all -S"^a{4}$" \
+		--name-only $tree >current &&
+	printf "one\ntwo\n" >expected &&
+	cmp current expected
+'
+
+test_expect_failure 'invalid regex' '
+	git-diff-index --pickaxe-regex -S"(" $tree
+'
+
+test_done
@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='Patch cache.
+
+With diff.patchcachesize set, patches between two blobs are kept in
+$GIT_DIR/patch-cache and shown from there the next time.
+'
+. ./test-lib.sh
+
+test_expect_success setup '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo "line $i" >>file
+	done &&
+	cp file other &&
+	git-update-index --add file other &&
+	tree0=$(git-write-tree) &&
+	sed -e "s/line 5/line five/" <file >file.new &&
+	mv file.new file &&
+	cp file other &&
+	echo "line 11" >>other &&
+	git-update-index file other &&
+	tree1=$(git-write-tree) &&
+	git-diff-tree -p $tree0 $tree1 >expected
+'
+
+test_expect_success 'patches are cached' '
+	git-repo-config diff.patchcachesize 1m &&
+	GIT_PATCH_CACHE_DEBUG=1 git-diff-tree -p $tree0 $tree1 \
+		>current 2>stats &&
+	cmp expected current &&
+	grep "0 hits, 2 misses, 2 added" stats &&
+	GIT_PATCH_CACHE_DEBUG=1 git-diff-tree -p $tree0 $tree1 \
+		>current 2>stats &&
+	cmp expected current &&
+	grep "2 hits, 0 misses, 0 added" stats
+'
+
+test_expect_success 'options are part of the key' '
+	GIT_DIFF_OPTS=-U1 git-diff-tree -p $tree0 $tree1 >expected.1 &&
+	GIT_DIFF_OPTS=-U1 GIT_PATCH_CACHE_DEBUG=1 \
+		git-diff-tree -p $tree0 $tree1 >current 2>stats &&
+	cmp expected.1 current &&
+	grep "2 hits, 0 misses, 0 added" stats &&
+	! cmp expected current
+'
+
+test_expect_success 'names come from the filepair, not the cache' '
+	git-diff-tree -p -M $tree0 $tree1 >current &&
+	cmp expected current &&
+	git-update-index --remove other &&
+	rm -f other &&
+	echo "line 0" | cat - file >renamed &&
+	git-update-index --add renamed &&
+	git-diff-index --cached -p -M $tree0 >current &&
+	grep "^+++ b/renamed" current
+'
+
+test_expect_success 'the cache is only scanned when it gets too big' '
+	git-repo-config diff.patchcachesize 1m &&
+	rm -fr .git/patch-cache &&
+	GIT_PATCH_CACHE_DEBUG=1 git-diff-tree -p $tree0 $tree1 \
+		>current 2>stats &&
+	grep "2 added, 0 evicted (0 bytes), 2 scanned" stats &&
+	GIT_DIFF_OPTS=-U1 GIT_PATCH_CACHE_DEBUG=1 \
+		git-diff-tree -p $tree0 $tree1 >current 2>stats &&
+	grep "2 added, 0 evicted (0 bytes), 0 scanned" stats &&
+	test $(cat .git/patch-cache/size) = $(cat .git/patch-cache/??/* | wc -c)
+'
+
+test_expect_success 'least recently used entries are evicted' '
+	git-repo-config diff.patchcachesize 150 &&
+	rm -fr .git/patch-cache &&
+	GIT_PATCH_CACHE_DEBUG=1 git-diff-tree -p $tree0 $tree1 \
+		>current 2>stats &&
+	cmp expected current &&
+	grep "2 added, 1 evicted" stats &&
+	test $(find .git/patch-cache/?? -type f | wc -l) = 1 &&
+	test $(cat .git/patch-cache/size) = $(cat .git/patch-cache/??/* | wc -c)
+'
+
+test_done
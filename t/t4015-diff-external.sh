@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='GIT_EXTERNAL_DIFF gets the contents of both sides.
+
+'
+. ./test-lib.sh
+
+cat >external <<\EOF
+#!/bin/sh
+echo "$1 $4 $7" &&
+cat "$2" &&
+cat "$5"
+EOF
+chmod +x external
+
+test_expect_success setup '
+	echo frotz >file &&
+	ln -s xyzzy link &&
+	git-update-index --add file link &&
+	tree=$(git-write-tree) &&
+	echo nitfol >file &&
+	rm -f link &&
+	ln -s rezrov link &&
+	git-update-index file link
+'
+
+# symbolic links do not end with a newline
+printf "file 100644 100644\nfrotz\nnitfol\nlink 120000 120000\nxyzzyrezrov" \
+	>expected
+
+test_expect_success 'blobs and the work tree' '
+	GIT_EXTERNAL_DIFF=./external git-diff-index -p --cached $tree >current &&
+	cmp expected current
+'
+
+test_expect_success 'two trees' '
+	tree2=$(git-write-tree) &&
+	GIT_EXTERNAL_DIFF=./external git-diff-tree -p $tree $tree2 >current &&
+	cmp expected current
+'
+
+# Where the blobs are handed over, and how much is in $TMPDIR meanwhile
+cat >where <<\EOF
+#!/bin/sh
+name=$1
+for f in "$2" "$5"
+do
+	case "$f" in
+	/dev/fd/[0-9]*)	echo "$name in core" ;;
+	"$TMPDIR"/.diff_*) echo "$name temporary file" ;;
+	*)		echo "$name $f" ;;
+	esac
+done
+set -- $(ls -A "$TMPDIR")
+echo "$# in TMPDIR"
+EOF
+chmod +x where
+
+# The Makefile sets USE_MEMFD on Linux
+if test "$(uname -s)" = Linux
+then
+	printf "%s in core\n%s in core\n0 in TMPDIR\n" file file link link
+else
+	printf "%s temporary file\n%s temporary file\n2 in TMPDIR\n" \
+		file file link link
+fi >expected
+
+test_expect_success 'where the blobs are handed over' '
+	mkdir tmp &&
+	TMPDIR="$(pwd)/tmp" GIT_EXTERNAL_DIFF=./where \
+		git-diff-tree -p $tree $tree2 >current &&
+	cmp expected current &&
+	test -z "$(ls -A tmp)"
+'
+
+test_expect_success 'diff is run with GIT_DIFF_OPTS it does not know' '
+	GIT_DIFF_OPTS="-a -u" git-diff-tree -p $tree $tree2 >current &&
+	grep "^-frotz$" current &&
+	grep "^+nitfol$" current
+'
+
+test_done
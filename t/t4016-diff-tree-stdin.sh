@@ -0,0 +1,72 @@
+#!/bin/sh
+
+test_description='diff-tree --stdin over a history.
+
+Feeding a list of commits to "git-diff-tree --stdin" gives the same
+output as running it on each of them, whichever order they come in.
+'
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir dir dir/sub &&
+	for i in 1 2 3
+	do
+		echo $i >file$i &&
+		echo $i >dir/file$i &&
+		echo $i >dir/sub/file$i
+	done &&
+	git-update-index --add file? dir/file? dir/sub/file? &&
+	commit=$(echo initial | git-commit-tree $(git-write-tree)) &&
+	for i in 1 2 3 4 5 6
+	do
+		echo $i >>dir/sub/file$(( $i % 3 + 1 )) &&
+		echo $i >>file$(( $i % 2 + 1 )) &&
+		git-update-index dir/sub/file? file? &&
+		commit=$(echo $i | git-commit-tree $(git-write-tree) -p $commit)
+	done &&
+	echo $commit >.git/HEAD &&
+	git-rev-list HEAD >revs &&
+	test $(wc -l <revs) = 7
+'
+
+for args in "-r:" "-r --root:" "-p:dir/sub" "-t -r:dir file2"
+do
+	opts=${args%:*} paths=${args#*:}
+	test_expect_success "git-diff-tree --stdin $opts $paths" "
+		git-diff-tree --stdin $opts $paths <revs >batch &&
+		for c in \$(cat revs)
+		do
+			git-diff-tree $opts \$c $paths
+		done >single &&
+		cmp single batch &&
+		sort revs | git-diff-tree --stdin $opts $paths >batch &&
+		for c in \$(sort revs)
+		do
+			git-diff-tree $opts \$c $paths
+		done >single &&
+		cmp single batch
+	"
+done
+
+test_expect_success 'renames are found with the size cache' '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		echo "line $i of a file to be renamed"
+	done >old &&
+	git-update-index --add old &&
+	commit=$(echo old | git-commit-tree $(git-write-tree) -p $commit) &&
+	sed -e "s/line 7 /line seven /" <old >new &&
+	rm -f old &&
+	git-update-index --add --remove old new &&
+	commit=$(echo new | git-commit-tree $(git-write-tree) -p $commit) &&
+	echo $commit >.git/HEAD &&
+	git-rev-list HEAD >revs &&
+	rm -f .git/size-cache &&
+	git-diff-tree --stdin -r -M <revs >first &&
+	grep "	old	new\$" first &&
+	test -f .git/size-cache &&
+	git-diff-tree --stdin -r -M <revs >second &&
+	cmp first second
+'
+
+test_done
@@ -0,0 +1,64 @@
+#!/bin/sh
+
+test_description='diff-index --cached matches the tree and the index up.
+
+The tree is walked alongside the index, so paths that sort between
+the entries of the other side, directories replaced by files, and
+unmerged entries all have to come out in the right order.
+'
+. ./test-lib.sh
+
+test_expect_success setup '
+	mkdir a a/b c &&
+	for f in a/x a/b/y a.c a-b c/z top dirfile
+	do
+		echo $f >$f
+	done &&
+	git-update-index --add a/x a/b/y a.c a-b c/z top dirfile &&
+	tree=$(git-write-tree) &&
+	echo modified >>a/x &&
+	echo new >a/new &&
+	rm -f c/z dirfile &&
+	mkdir dirfile &&
+	echo file >dirfile/f &&
+	git-update-index --add --remove a/x a/new c/z dirfile dirfile/f &&
+	blob=$(echo base | git-hash-object -w --stdin) &&
+	git-update-index --force-remove a-b top &&
+	printf "100644 $blob 1\ta-b\n100644 $blob 3\ta-b\n100644 $blob 2\tzz\n" |
+	git-update-index --index-info
+'
+
+cat >expected <<\EOF
+U	a-b
+A	a/new
+M	a/x
+D	c/z
+D	dirfile
+A	dirfile/f
+D	top
+U	zz
+EOF
+test_expect_success 'whole tree' '
+	git-diff-index --cached --name-status $tree >current &&
+	cmp expected current
+'
+
+cat >expected <<\EOF
+U	a-b
+A	a/new
+M	a/x
+EOF
+test_expect_success 'limited to paths' '
+	git-diff-index --cached --name-status $tree a a-b >current &&
+	cmp expected current
+'
+
+cat >expected <<\EOF
+A	dirfile/f
+EOF
+test_expect_success 'limited to a directory that replaced a file' '
+	git-diff-index --cached --name-status $tree dirfile/ >current &&
+	cmp expected current
+'
+
+test_done
@@ -0,0 +1,96 @@
+#!/bin/sh
+
+test_description='git-update-server-info.
+
+Given the refs that changed, only their entries in info/refs are
+rewritten; objects/info/packs is left alone while objects/pack
+does not change.
+'
+. ./test-lib.sh
+
+tag () {
+	printf "object %s\ntype commit\ntag %s\ntagger %s\n\n%s\n" \
+		$2 $1 "$(git-var GIT_COMMITTER_IDENT)" "tag $1" >tag.tmp &&
+	tag=$(git-mktag <tag.tmp) &&
+	echo $tag >.git/refs/tags/$1
+}
+
+# what a run from scratch makes, in the order of the entries
+check_refs () {
+	git-update-server-info --force &&
+	sort .git/info/refs >expect &&
+	sort "${1-.git/info/refs}" >actual &&
+	diff expect actual
+}
+
+test_expect_success setup '
+	echo one >file1 &&
+	git-update-index --add file1 &&
+	tree=$(git-write-tree) &&
+	one=$(echo one | git-commit-tree $tree) &&
+	git-update-ref HEAD $one &&
+	git-branch side &&
+	tag v1 $one &&
+	git-repack -a -d >/dev/null 2>&1 &&
+	git-update-server-info &&
+	grep "	refs/tags/v1^{}$" .git/info/refs &&
+	test -f .git/objects/info/packs &&
+	check_refs
+'
+
+test_expect_success 'a named ref is rewritten, the others are kept' '
+	echo two >>file1 &&
+	git-update-index file1 &&
+	tree=$(git-write-tree) &&
+	commit=$(echo two | git-commit-tree $tree -p $one) &&
+	git-update-ref HEAD $commit &&
+	echo "0000000000000000000000000000000000000000	refs/heads/side" \
+		>>.git/info/refs &&
+	git-update-server-info refs/heads/master &&
+	grep "^$commit	refs/heads/master$" .git/info/refs &&
+	test $(grep -c "refs/heads/side$" .git/info/refs) = 2
+'
+
+test_expect_success 'a named ref that is gone is dropped' '
+	rm .git/refs/heads/side &&
+	git-update-server-info refs/heads/side &&
+	! grep "refs/heads/side$" .git/info/refs &&
+	check_refs
+'
+
+test_expect_success 'a named ref that is new is added' '
+	tag v2 $one &&
+	git-update-server-info refs/tags/v2 refs/heads/master &&
+	grep "^$one	refs/tags/v2^{}$" .git/info/refs &&
+	check_refs
+'
+
+test_expect_success 'a tag moved to a commit loses its peeled entry' '
+	echo $one >.git/refs/tags/v1 &&
+	git-update-server-info refs/tags/v1 &&
+	! grep "refs/tags/v1^{}$" .git/info/refs &&
+	check_refs
+'
+
+test_expect_success 'without a usable info/refs all refs are listed' '
+	echo garbage >.git/info/refs &&
+	git-update-server-info refs/heads/master &&
+	check_refs
+'
+
+test_expect_success 'objects/info/packs is kept while packs do not change' '
+	touch -t 200001010000 .git/objects/pack &&
+	before=$(ls -i .git/objects/info/packs) &&
+	git-update-server-info &&
+	test "$(ls -i .git/objects/info/packs)" = "$before"
+'
+
+test_expect_success 'objects/info/packs is rewritten after a repack' '
+	git-repack -a -d >/dev/null 2>&1 &&
+	git-update-server-info &&
+	test "$(ls -i .git/objects/info/packs)" != "$before" &&
+	pack=$(cd .git/objects/pack && echo pack-*.pack) &&
+	test "$(cat .git/objects/info/packs)" = "P $pack"
+'
+
+test_done
@@ -8,9 +8,6 @@ test_description='See why rewinding head breaks send-pack
 '
 . ./test-lib.sh
 
-touch cpio-test
-test_expect_success 'working cpio' 'echo cpio-test | cpio -o > /dev/null'
-
 cnt='1'
 test_expect_success setup '
 	tree=$(git-write-tree) &&
@@ -64,4 +61,43 @@ test_expect_success \
 	cmp victim/.git/refs/heads/master .git/refs/heads/master
 '
 
+test_expect_success 'a big enough push is kept as a pack' '
+	mkdir keeper &&
+	(cd keeper && git-init-db) &&
+	echo "[receive]
+	unpacklimit = 3" >>keeper/.git/config &&
+	git-send-pack ./keeper/.git/ master &&
+	for i in 1 2 3
+	do
+		echo "kept $i" >kept$i &&
+		git-update-index --add kept$i || return 1
+	done &&
+	old=$(cat .git/refs/heads/master) &&
+	kept=$(echo kept | git-commit-tree $(git-write-tree) -p $old) &&
+	git-update-ref HEAD $kept &&
+	git-send-pack ./keeper/.git/ master &&
+	cmp keeper/.git/refs/heads/master .git/refs/heads/master &&
+	test $(ls keeper/.git/objects/pack/pack-*.pack | wc -l) = 2 &&
+	! test -f keeper/.git/objects/$(expr "$kept" : "\(..\)")/$(expr "$kept" : "..\(.*\)") &&
+	(cd keeper && git-fsck-objects --full)
+'
+
+test_expect_success 'an incomplete pack is refused' '
+	echo broken >broken &&
+	git-update-index --add broken &&
+	broken=$(echo broken | git-commit-tree $(git-write-tree) -p $kept) &&
+	line="$kept $broken refs/heads/master" &&
+	printf "%04x%s\n0000" $((${#line} + 5)) "$line" >input &&
+	git-rev-list --objects $broken ^$kept |
+		grep -v " broken\$" |
+		git-pack-objects --stdout >>input &&
+	echo "	unpacklimit = 0" >>keeper/.git/config &&
+	if (cd keeper && git-receive-pack .) <input >/dev/null
+	then
+		false
+	else
+		test $(cat keeper/.git/refs/heads/master) = $kept
+	fi
+'
+
 test_done
@@ -133,4 +133,28 @@ pull_to_client 2nd "B" $((64*3))
 
 pull_to_client 3rd "A" $((1*3)) # old fails
 
+# The client builds C1 - .. - C100 on top of B65 and forgets about B,
+# so that walking down from C100 skips past B65 and has to come back.
+
+cd client
+add C1 $B65
+prev=1; cur=2; while [ $cur -le 100 ]; do
+	add C$cur $(eval echo \$C$prev)
+	prev=$cur
+	cur=$(($cur+1))
+done
+rm .git/refs/heads/B
+git-symbolic-ref HEAD refs/heads/C
+cd ..
+
+(cd client; test_repack client)
+
+prev=65; cur=66; while [ $cur -le 70 ]; do
+	add B$cur $(eval echo \$B$prev)
+	prev=$cur
+	cur=$(($cur+1))
+done
+
+pull_to_client 4th "B" $((5*3))
+
 test_done
@@ -0,0 +1,109 @@
+#!/bin/sh
+
+test_description='fetching with the pack sent in a side-band.
+
+When both ends speak "side-band", git-upload-pack sends the messages
+from git-pack-objects along with the pack, and tells the client when
+it cannot produce the pack, both over a pipe and over git-daemon.
+'
+. ./test-lib.sh
+
+test_expect_success setup '
+	for i in 1 2 3 4 5
+	do
+		echo $i >file$i &&
+		git-update-index --add file$i &&
+		commit=$(echo $i | git-commit-tree $(git-write-tree) ${commit:+-p $commit}) ||
+		return 1
+	done &&
+	echo $commit >.git/refs/heads/master &&
+	mkdir client &&
+	(cd client && git-init-db) 2>/dev/null
+'
+
+test_expect_success 'fetch over a pipe' '
+	cd client &&
+	git-fetch-pack .. master >../fetched 2>../stderr &&
+	cd .. &&
+	grep "^remote: Packing 15 objects" stderr &&
+	grep "^remote: Writing objects: 100% (15/15), done." stderr &&
+	test "$(cat fetched)" = "$commit refs/heads/master" &&
+	(cd client && git-cat-file commit $commit >/dev/null)
+'
+
+test_expect_success 'fetch -q keeps the remote quiet' '
+	cd client &&
+	git-fetch-pack -q .. master >/dev/null 2>../stderr &&
+	cd .. &&
+	! grep "^remote:" stderr
+'
+
+test_expect_success 'clone over a pipe' '
+	mkdir clone &&
+	cd clone &&
+	git-init-db 2>/dev/null &&
+	git-clone-pack .. 2>../stderr &&
+	cd .. &&
+	grep "^remote: Packing 15 objects" stderr &&
+	test "$(cat clone/.git/refs/heads/master)" = $commit
+'
+
+blob=$(git-ls-tree $commit file3 | sed -e "s/^.* blob \([0-9a-f]*\).*/\1/")
+blob_file=.git/objects/$(expr "$blob" : "\(..\)")/$(expr "$blob" : "..\(.*\)")
+
+test_expect_success 'the client hears why the pack could not be made' '
+	mv $blob_file broken &&
+	mkdir client2 &&
+	cd client2 &&
+	git-init-db 2>/dev/null &&
+	if git-fetch-pack .. master 2>../stderr
+	then
+		cd .. && mv broken $blob_file && false
+	else
+		cd .. && mv broken $blob_file &&
+		grep "remote error: git-upload-pack: git-pack-objects died with error" stderr
+	fi
+'
+
+tree=$(git-cat-file commit $commit | sed -n -e "s/^tree //p")
+tree_file=.git/objects/$(expr "$tree" : "\(..\)")/$(expr "$tree" : "..\(.*\)")
+
+test_expect_success 'a remote error fails the fetch even when the pack is good' '
+	mv $tree_file broken &&
+	mkdir client4 &&
+	cd client4 &&
+	git-init-db 2>/dev/null &&
+	if git-fetch-pack .. master >../fetched 2>../stderr
+	then
+		cd .. && mv broken $tree_file && false
+	else
+		cd .. && mv broken $tree_file &&
+		grep "remote error: git-upload-pack: git-rev-list died with error" stderr &&
+		! test -s fetched
+	fi
+'
+
+port=${GIT_TEST_DAEMON_PORT:-$((19000 + $$ % 1000))}
+git-daemon --port=$port --export-all "$(pwd)" 2>/dev/null &
+daemon=$!
+for i in 1 2 3 4 5 6 7 8 9 10
+do
+	git-peek-remote git://127.0.0.1:$port"$(pwd)" >/dev/null 2>&1 && break
+	sleep 1
+done
+
+test_expect_success 'fetch over git-daemon' '
+	mkdir client3 &&
+	cd client3 &&
+	git-init-db 2>/dev/null &&
+	git-fetch-pack git://127.0.0.1:$port"$(dirname "$(pwd)")" master \
+		>../fetched 2>../stderr &&
+	cd .. &&
+	grep "^remote: Packing 15 objects" stderr &&
+	test "$(cat fetched)" = "$commit refs/heads/master" &&
+	(cd client3 && git-cat-file commit $commit >/dev/null)
+'
+
+kill $daemon
+
+test_done
@@ -0,0 +1,131 @@
+#!/bin/sh
+
+test_description='fetching over dumb HTTP.
+
+git-http-fetch asks for the indices of the remote packs together,
+and when it wants only a few objects out of a big pack, it gets them
+by their byte ranges instead of getting the whole pack, unless the
+server does not honour ranges.  GIT_HTTP_STATS makes it say what the
+requests cost.
+'
+. ./test-lib.sh
+
+if ! "$PYTHON" -c 'import socket' 2>/dev/null
+then
+	say "no python to serve HTTP with, skipping"
+	test_done
+fi
+
+port=${GIT_TEST_HTTPD_PORT:-$((20000 + $$ % 1000))}
+url=http://127.0.0.1:$port/srv/.git/
+
+start_httpd () {
+	"$PYTHON" ../lib-httpd.py $port "$(pwd)" "$(pwd)/log" "$@" &
+	httpd=$!
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		"$PYTHON" -c "import socket
+socket.socket().connect(('127.0.0.1', $port))" 2>/dev/null && break
+		sleep 1
+	done
+}
+
+stop_httpd () {
+	kill $httpd
+	wait $httpd 2>/dev/null
+}
+
+commit_all () {
+	git-update-index --add file* &&
+	tree=$(git-write-tree) &&
+	commit=$(echo "$1" | git-commit-tree $tree ${commit:+-p $commit}) &&
+	echo $commit >.git/refs/heads/master &&
+	git-repack -a -d >/dev/null 2>&1 &&
+	git-prune-packed &&
+	git-update-server-info
+}
+
+test_expect_success setup '
+	mkdir srv &&
+	cd srv &&
+	git-init-db 2>/dev/null &&
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3
+		do
+			awk "BEGIN { srand($i$j); for (i = 0; i < 2000; i++)
+				printf \"%08x\\n\", rand() * 2147483647 }" \
+				>file$i$j || return 1
+		done
+	done &&
+	commit_all one &&
+	cd .. &&
+	mkdir client &&
+	(cd client && git-init-db 2>/dev/null)
+'
+
+start_httpd
+
+test_expect_success 'clone gets the whole pack' '
+	cd client &&
+	git-http-fetch -a -w heads/master heads/master $url &&
+	cd .. &&
+	test "$(cat client/.git/refs/heads/master)" = "$(cat srv/.git/refs/heads/master)" &&
+	grep "^/srv/.git//objects/pack/pack-.*\.pack -$" log &&
+	(cd client && git-fsck-objects --full)
+'
+
+test_expect_success 'a small fetch takes its objects out of the pack' '
+	cd srv &&
+	echo changed >>file30 &&
+	commit_all two &&
+	cd .. &&
+	: >log &&
+	cd client &&
+	git-http-fetch -a -w heads/master heads/master $url &&
+	cd .. &&
+	test "$(cat client/.git/refs/heads/master)" = "$(cat srv/.git/refs/heads/master)" &&
+	grep "^/srv/.git//objects/pack/pack-.*\.idx -$" log &&
+	grep "^/srv/.git//objects/pack/pack-.*\.pack bytes=" log &&
+	! grep "^/srv/.git//objects/pack/pack-.*\.pack -$" log &&
+	test $(ls client/.git/objects/pack/*.pack | wc -l) = 1 &&
+	(cd client && git-fsck-objects --full)
+'
+
+stop_httpd
+start_httpd --no-range
+
+test_expect_success 'without ranges it gets the whole pack' '
+	cd srv &&
+	echo changed again >>file50 &&
+	commit_all three &&
+	cd .. &&
+	: >log &&
+	cd client &&
+	git-http-fetch -a -w heads/master heads/master $url &&
+	cd .. &&
+	test "$(cat client/.git/refs/heads/master)" = "$(cat srv/.git/refs/heads/master)" &&
+	grep "^/srv/.git//objects/pack/pack-.*\.pack -$" log &&
+	test $(ls client/.git/objects/pack/*.pack | wc -l) = 2 &&
+	(cd client && git-fsck-objects --full)
+'
+
+test_expect_success 'GIT_HTTP_STATS counts what was asked for' '
+	cd srv &&
+	echo changed once more >>file70 &&
+	commit_all four &&
+	cd .. &&
+	: >log &&
+	cd client &&
+	GIT_HTTP_STATS=1 GIT_HTTP_MAX_HOST_CONNECTIONS=1 \
+		git-http-fetch -a -w heads/master heads/master $url 2>../stats &&
+	cd .. &&
+	test "$(cat client/.git/refs/heads/master)" = "$(cat srv/.git/refs/heads/master)" &&
+	requests=$(sed -n "s/^http: \([0-9]*\) requests, .*/\1/p" stats) &&
+	test "$requests" = $(wc -l <log) &&
+	grep "^http: [0-9]* bytes received" stats
+'
+
+stop_httpd
+
+test_done
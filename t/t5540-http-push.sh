@@ -0,0 +1,117 @@
+#!/bin/sh
+
+test_description='pushing over HTTP/DAV.
+
+git-http-push sends what the remote lacks as one pack and its index
+when there is enough of it, and one object at a time otherwise or
+when the pack cannot be put there.
+'
+. ./test-lib.sh
+
+if ! "$PYTHON" -c 'import socket' 2>/dev/null
+then
+	say "no python to serve HTTP with, skipping"
+	test_done
+fi
+if ! type git-http-push >/dev/null 2>&1
+then
+	say "git-http-push not built, skipping"
+	test_done
+fi
+
+port=${GIT_TEST_HTTPD_PORT:-$((21000 + $$ % 1000))}
+url=http://127.0.0.1:$port/bare.git/
+
+start_httpd () {
+	"$PYTHON" ../lib-httpd.py $port "$(pwd)" "$(pwd)/log" --dav "$@" &
+	httpd=$!
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		"$PYTHON" -c "import socket
+socket.socket().connect(('127.0.0.1', $port))" 2>/dev/null && break
+		sleep 1
+	done
+}
+
+stop_httpd () {
+	kill $httpd
+	wait $httpd 2>/dev/null
+}
+
+commit_all () {
+	git-update-index --add file* &&
+	tree=$(git-write-tree) &&
+	commit=$(echo "$1" | git-commit-tree $tree ${commit:+-p $commit}) &&
+	git-update-ref HEAD $commit
+}
+
+loose_objects () {
+	find bare.git/objects/?? -type f 2>/dev/null | wc -l
+}
+
+test_expect_success setup '
+	for i in 0 1 2 3 4 5 6 7 8 9 a b
+	do
+		echo "file $i" >file$i || return 1
+	done &&
+	commit_all one &&
+	mkdir bare.git &&
+	(cd bare.git && GIT_DIR=. git-init-db 2>/dev/null)
+'
+
+start_httpd
+
+test_expect_success 'a big push goes up as a pack' '
+	: >log &&
+	git-http-push $url master &&
+	test "$(cat bare.git/refs/heads/master)" = $commit &&
+	test $(ls bare.git/objects/pack/*.pack | wc -l) = 1 &&
+	test $(loose_objects) = 0 &&
+	grep "^P pack-.*\.pack$" bare.git/objects/info/packs &&
+	grep "^/bare.git/objects/pack/pack-.*\.idx PUT$" log &&
+	! grep " MOVE$" log &&
+	GIT_DIR=bare.git git-fsck-objects --full
+'
+
+test_expect_success 'a small push goes up loose' '
+	echo more >>file1 &&
+	commit_all two &&
+	: >log &&
+	git-http-push $url master &&
+	test "$(cat bare.git/refs/heads/master)" = $commit &&
+	test $(ls bare.git/objects/pack/*.pack | wc -l) = 1 &&
+	test $(loose_objects) = 3 &&
+	grep " MOVE$" log &&
+	GIT_DIR=bare.git git-fsck-objects --full
+'
+
+stop_httpd
+start_httpd --refuse=/bare.git/objects/pack/
+
+test_expect_success 'a pack the server refuses is sent loose instead' '
+	for i in 0 1 2 3 4 5 6 7 8 9 a b
+	do
+		echo "again" >>file$i || return 1
+	done &&
+	commit_all three &&
+	: >log &&
+	git-http-push $url master &&
+	test "$(cat bare.git/refs/heads/master)" = $commit &&
+	test $(ls bare.git/objects/pack/*.pack | wc -l) = 1 &&
+	test $(loose_objects) = 17 &&
+	GIT_DIR=bare.git git-fsck-objects --full
+'
+
+test_expect_success 'a dumb fetch finds the pushed pack' '
+	mkdir client &&
+	cd client &&
+	git-init-db 2>/dev/null &&
+	git-http-fetch -a -w heads/master heads/master $url &&
+	cd .. &&
+	test "$(cat client/.git/refs/heads/master)" = $commit &&
+	(cd client && git-fsck-objects --full)
+'
+
+stop_httpd
+
+test_done
@@ -0,0 +1,58 @@
+#!/bin/sh
+
+test_description='local clone.
+
+git-clone -l hardlinks the packs and loose objects of the original
+(through git-local-fetch --all-objects), and what cannot be linked
+is copied.
+'
+. ./test-lib.sh
+
+commit_all () {
+	git-update-index --add file* &&
+	tree=$(git-write-tree) &&
+	commit=$(echo "$1" | git-commit-tree $tree ${commit:+-p $commit}) &&
+	git-update-ref HEAD $commit
+}
+
+inode () {
+	ls -i "$1" | sed -e 's/^ *\([0-9]*\) .*/\1/'
+}
+
+test_expect_success setup '
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		echo "file $i" >file$i || return 1
+	done &&
+	commit_all one &&
+	git-repack -a -d >/dev/null 2>&1 &&
+	git-prune-packed &&
+	echo more >>file1 &&
+	commit_all two &&
+	pack=$(cd .git/objects/pack && echo pack-*.pack) &&
+	loose=$(cd .git/objects && ls ??/* | sed -e 1q)
+'
+
+test_expect_success 'clone -l links the packs and the loose objects' '
+	git-clone -l -n . linked &&
+	test "$(cat linked/.git/refs/heads/master)" = $commit &&
+	test $(inode .git/objects/pack/$pack) = \
+		$(inode linked/.git/objects/pack/$pack) &&
+	test $(inode .git/objects/$loose) = \
+		$(inode linked/.git/objects/$loose) &&
+	(cd linked && git-fsck-objects --full)
+'
+
+test_expect_success 'without -l, local-fetch --all-objects copies' '
+	mkdir copied &&
+	(cd copied && git-init-db 2>/dev/null) &&
+	GIT_DIR=copied/.git git-local-fetch --all-objects .git &&
+	cmp .git/objects/pack/$pack copied/.git/objects/pack/$pack &&
+	cmp .git/objects/$loose copied/.git/objects/$loose &&
+	test $(inode .git/objects/pack/$pack) != \
+		$(inode copied/.git/objects/pack/$pack) &&
+	echo $commit >copied/.git/refs/heads/master &&
+	(cd copied && git-fsck-objects --full)
+'
+
+test_done
@@ -77,6 +77,13 @@ save_tag h2 unique_commit g4 tree -p g2
 save_tag g3 unique_commit g5 tree -p g2
 save_tag g4 unique_commit g6 tree -p g3 -p h2
 
+# x1 is dated before its parent x0
+on_committer_date "1971-08-16 00:00:50" save_tag s0 unique_commit s0 tree
+on_committer_date "1971-08-16 00:00:55" save_tag s1 unique_commit s1 tree -p s0
+on_committer_date "1971-08-16 00:01:00" save_tag x0 unique_commit x0 tree -p s0
+on_committer_date "1971-08-16 00:00:10" save_tag x1 unique_commit x1 tree -p x0
+on_committer_date "1971-08-16 00:01:10" save_tag s2 unique_commit s2 tree -p x1 -p s1
+
 git-update-ref HEAD $(tag l5)
 
 test_expect_success 'rev-list has correct number of entries' 'git-rev-list HEAD | wc -l | tr -s " "' <<EOF
@@ -402,6 +409,14 @@ l0
 root
 EOF
 
+test_output_expect_success "--topo-order does not trust commit dates" "git-rev-list --topo-order s2" <<EOF
+s2
+s1
+x1
+x0
+s0
+EOF
+
 #
 #
 
@@ -0,0 +1,95 @@
+#!/bin/sh
+
+test_description='git-rev-list with changed-path filters
+
+This checks that path limited rev-list gives the same answer with
+and without the filters written by git-update-path-filter.
+'
+
+. ./test-lib.sh
+
+commit () {
+	git-update-index --add "$@" &&
+	tree=$(git-write-tree) &&
+	c=$(echo "$tree" | git-commit-tree $tree ${head:+-p $head}) &&
+	head=$c &&
+	echo $c >.git/refs/heads/master
+}
+
+test_expect_success 'setup' '
+	mkdir dir dir/sub &&
+	echo a >a && commit a &&
+	echo b >b && commit b &&
+	echo 1 >dir/file && commit dir/file &&
+	echo 2 >dir/sub/file && commit dir/sub/file &&
+	echo a2 >a && commit a &&
+	echo 3 >dir/file && commit dir/file &&
+	side=$head &&
+	echo b2 >b && commit b &&
+	main=$head &&
+	tree=$(git-write-tree) &&
+	m=$(echo merge | git-commit-tree $tree -p $main -p $side) &&
+	echo $m >.git/refs/heads/master &&
+	for p in a b dir dir/ dir/sub dir/sub/file nothing
+	do
+		git-rev-list HEAD -- $p >expect.$(echo $p | tr / _) || exit
+	done &&
+	git-rev-list --sparse HEAD -- dir >expect.sparse
+'
+
+test_expect_success 'write filters' '
+	git-update-path-filter &&
+	test -f .git/objects/info/path-filters
+'
+
+for p in a b dir dir/ dir/sub dir/sub/file nothing
+do
+	test_expect_success "rev-list -- $p" "
+		git-rev-list HEAD -- $p >actual &&
+		cmp expect.$(echo $p | tr / _) actual
+	"
+done
+
+test_expect_success 'rev-list --sparse' '
+	git-rev-list --sparse HEAD -- dir >actual &&
+	cmp expect.sparse actual
+'
+
+test_expect_success 'commits made after the filters' '
+	echo a3 >a && head=$(cat .git/refs/heads/master) && commit a &&
+	test "$(git-rev-list HEAD -- a | head -n 1)" = "$head"
+'
+
+test_expect_success 'filters are reused' '
+	git-update-path-filter -v 2>err &&
+	grep "8 filters reused" err
+'
+
+test_expect_success 'filters with a damaged byte are not trusted' '
+	f=.git/objects/info/path-filters &&
+	cp $f saved &&
+	nr=$(od -An -j8 -N4 -tu1 $f |
+		awk "{ print ((\$1 * 256 + \$2) * 256 + \$3) * 256 + \$4 }") &&
+	off=$((12 + $nr * 44)) &&
+	end=$(($(wc -c <saved) - 20)) &&
+	while test $off -lt $end
+	do
+		cp saved $f &&
+		dd if=/dev/zero of=$f bs=1 count=1 seek=$off conv=notrunc 2>/dev/null &&
+		git-rev-list HEAD -- b >actual 2>/dev/null &&
+		cmp expect.b actual &&
+		git-rev-list HEAD -- dir >actual 2>/dev/null &&
+		cmp expect.dir actual || break
+		off=$(($off + 1))
+	done &&
+	cp saved $f &&
+	test $off = $end
+'
+
+test_expect_success 'corrupt filter file is ignored' '
+	echo garbage >.git/objects/info/path-filters &&
+	git-rev-list HEAD -- b >actual &&
+	cmp expect.b actual
+'
+
+test_done
@@ -0,0 +1,52 @@
+#!/bin/sh
+
+test_description='git-name-rev
+
+This names commits relative to tips, across merges, and checks
+that a long first-parent chain does not eat up the stack.
+'
+
+. ./test-lib.sh
+
+date >path0
+git-update-index --add path0
+tree=$(git-write-tree)
+
+test_expect_success 'setup' '
+	A=$(echo A | git-commit-tree $tree) &&
+	B=$(echo B | git-commit-tree $tree -p $A) &&
+	C=$(echo C | git-commit-tree $tree) &&
+	D=$(echo D | git-commit-tree $tree -p $C) &&
+	M=$(echo M | git-commit-tree $tree -p $B -p $D) &&
+	N=$(echo N | git-commit-tree $tree -p $M) &&
+	echo $N >.git/refs/heads/master &&
+	mkdir -p .git/refs/tags &&
+	echo $B >.git/refs/tags/b'
+
+test_expect_success 'first parent' \
+	'test "$(git-name-rev $A)" = "$A b~1"'
+
+test_expect_success 'merge parent' \
+	'test "$(git-name-rev $C)" = "$C master~1^2~1"'
+
+test_expect_success 'tags only' \
+	'test "$(git-name-rev --tags $D)" = "$D undefined"'
+
+test_expect_success '--stdin' \
+	'echo "see $D here" | git-name-rev --stdin >actual &&
+	 test "$(cat actual)" = "see $D (master~1^2) here"'
+
+test_expect_success 'long chain' '
+	root=$(echo root | git-commit-tree $tree) &&
+	c=$root i=0 &&
+	while test $i -lt 3000 &&
+		c=$(echo $i | git-commit-tree $tree -p $c)
+	do
+		i=$(($i + 1))
+	done &&
+	test $i = 3000 &&
+	echo $c >.git/refs/heads/long &&
+	(ulimit -s 64 && git-name-rev --all) >actual &&
+	grep "^$root long~3000$" actual'
+
+test_done
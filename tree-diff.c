@@ -9,37 +9,127 @@ static int nr_paths = 0;
 static const char **paths = NULL;
 static int *pathlens = NULL;
 
-static void update_tree_entry(struct tree_desc *desc)
+/* One tree entry, parsed once */
+struct tree_entry {
+	const char *path;	/* NUL terminated in the tree buffer */
+	int pathlen;
+	unsigned mode;
+	const unsigned char *sha1;
+	unsigned long len;	/* of the whole entry in the tree */
+};
+
+static void decode_entry(struct tree_desc *desc, struct tree_entry *e)
 {
-	void *buf = desc->buf;
-	unsigned long size = desc->size;
-	int len = strlen(buf) + 1 + 20;
+	const char *buf = desc->buf, *end = buf + desc->size, *nul;
+	unsigned mode = 0;
 
-	if (size < len)
+	while (buf < end && '0' <= *buf && *buf <= '7')
+		mode = (mode << 3) + (*buf++ - '0');
+	if (buf == desc->buf || end <= buf || *buf++ != ' ')
 		die("corrupt tree file");
-	desc->buf = buf + len;
-	desc->size = size - len;
+	nul = memchr(buf, 0, end - buf);
+	if (!nul || end - nul < 21)
+		die("corrupt tree file");
+	e->path = buf;
+	e->pathlen = nul - buf;
+	e->mode = DIFF_FILE_CANON_MODE(mode);
+	e->sha1 = (const unsigned char *)nul + 1;
+	e->len = nul + 21 - (const char *)desc->buf;
 }
 
-static const unsigned char *extract(struct tree_desc *desc, const char **pathp, unsigned int *modep)
+static void skip_entry(struct tree_desc *desc, const struct tree_entry *e)
 {
-	void *tree = desc->buf;
-	unsigned long size = desc->size;
-	int len = strlen(tree)+1;
-	const unsigned char *sha1 = tree + len;
-	const char *path = strchr(tree, ' ');
-	unsigned int mode;
-
-	if (!path || size < len + 20 || sscanf(tree, "%o", &mode) != 1)
-		die("corrupt tree file");
-	*pathp = path+1;
-	*modep = DIFF_FILE_CANON_MODE(mode);
-	return sha1;
+	desc->buf = (char *)desc->buf + e->len;
+	desc->size -= e->len;
 }
 
-static char *malloc_base(const char *base, const char *path, int pathlen)
+/*
+ * The paths we are interested in, as seen from inside one directory:
+ * either everything there is (the directory is inside one of them),
+ * or what is left of those that go deeper than the directory after
+ * taking it off their front.  This is worked out once per directory,
+ * not for each entry in it.
+ */
+struct path_matcher {
+	int all;
+	int nr;
+	const char **rest;
+	int *restlen;
+};
+
+/* Returns 0 if nothing in base can be interesting */
+static int prepare_matcher(struct path_matcher *m, const char *base, int baselen)
+{
+	int i;
+
+	m->all = !nr_paths;
+	m->nr = 0;
+	m->rest = NULL;
+	m->restlen = NULL;
+	if (m->all)
+		return 1;
+	for (i = 0; i < nr_paths; i++) {
+		const char *match = paths[i];
+		int matchlen = pathlens[i];
+
+		if (baselen >= matchlen) {
+			/* The base is a subdirectory of a path which was specified. */
+			if (!strncmp(base, match, matchlen)) {
+				free(m->rest);
+				free(m->restlen);
+				m->all = 1;
+				m->nr = 0;
+				return 1;
+			}
+			continue;
+		}
+		/* Does the base match? */
+		if (strncmp(base, match, baselen))
+			continue;
+		if (!m->rest) {
+			m->rest = xmalloc(nr_paths * sizeof(*m->rest));
+			m->restlen = xmalloc(nr_paths * sizeof(*m->restlen));
+		}
+		m->rest[m->nr] = match + baselen;
+		m->restlen[m->nr] = matchlen - baselen;
+		m->nr++;
+	}
+	return m->nr;
+}
+
+static void free_matcher(struct path_matcher *m)
+{
+	free(m->rest);
+	free(m->restlen);
+}
+
+static int interesting(const struct path_matcher *m, const struct tree_entry *e)
+{
+	int i;
+
+	if (m->all)
+		return 1;
+	for (i = 0; i < m->nr; i++) {
+		const char *match = m->rest[i];
+		int matchlen = m->restlen[i];
+
+		if (e->pathlen > matchlen)
+			continue;
+		if (matchlen > e->pathlen) {
+			if (match[e->pathlen] != '/')
+				continue;
+			if (!S_ISDIR(e->mode))
+				continue;
+		}
+		if (strncmp(e->path, match, e->pathlen))
+			continue;
+		return 1;
+	}
+	return 0; /* No matches */
+}
+
+static char *malloc_base(const char *base, int baselen, const char *path, int pathlen)
 {
-	int baselen = strlen(base);
 	char *newbase = xmalloc(baselen + pathlen + 2);
 	memcpy(newbase, base, baselen);
 	memcpy(newbase + baselen, path, pathlen);
@@ -47,184 +137,269 @@ static char *malloc_base(const char *base, const char *path, int pathlen)
 	return newbase;
 }
 
-static int show_entry(struct diff_options *opt, const char *prefix, struct tree_desc *desc, const char *base);
+/*
+ * The last few trees we read.  Walking history newest first, the tree
+ * a commit is compared with (and the subtrees that changed in it) is
+ * read again right away as the next commit's own tree.  Entries in
+ * use by a walk that is still going on are not evicted.
+ */
+#define TREE_CACHE_SIZE 64
+
+static struct cached_tree {
+	unsigned char sha1[20];
+	void *buf;
+	unsigned long size;
+	unsigned long used;
+	int users;
+} tree_cache[TREE_CACHE_SIZE];
+static unsigned long tree_cache_clock;
+
+static struct cached_tree *lookup_cached_tree(const unsigned char *sha1)
+{
+	int i;
+
+	for (i = 0; i < TREE_CACHE_SIZE; i++) {
+		struct cached_tree *c = &tree_cache[i];
+		if (c->buf && !memcmp(c->sha1, sha1, 20)) {
+			c->used = ++tree_cache_clock;
+			c->users++;
+			return c;
+		}
+	}
+	return NULL;
+}
+
+static void *cache_tree(const unsigned char *sha1, void *buf, unsigned long size)
+{
+	struct cached_tree *victim = NULL;
+	int i;
+
+	for (i = 0; i < TREE_CACHE_SIZE; i++) {
+		struct cached_tree *c = &tree_cache[i];
+		if (c->users)
+			continue;
+		if (!victim || c->used < victim->used)
+			victim = c;
+	}
+	if (!victim)
+		return buf;	/* all in use; the caller gets to free it */
+	free(victim->buf);
+	memcpy(victim->sha1, sha1, 20);
+	victim->buf = buf;
+	victim->size = size;
+	victim->used = ++tree_cache_clock;
+	victim->users = 1;
+	return buf;
+}
 
-static int compare_tree_entry(struct tree_desc *t1, struct tree_desc *t2, const char *base, struct diff_options *opt)
+static void release_tree(void *buf)
 {
-	unsigned mode1, mode2;
-	const char *path1, *path2;
-	const unsigned char *sha1, *sha2;
-	int cmp, pathlen1, pathlen2;
+	int i;
+
+	for (i = 0; i < TREE_CACHE_SIZE; i++) {
+		if (tree_cache[i].buf == buf) {
+			tree_cache[i].users--;
+			return;
+		}
+	}
+	free(buf);
+}
 
-	sha1 = extract(t1, &path1, &mode1);
-	sha2 = extract(t2, &path2, &mode2);
+static void *read_subtree(const unsigned char *sha1, unsigned long *size)
+{
+	struct cached_tree *c = lookup_cached_tree(sha1);
+	char type[20];
+	void *tree;
 
-	pathlen1 = strlen(path1);
-	pathlen2 = strlen(path2);
-	cmp = base_name_compare(path1, pathlen1, mode1, path2, pathlen2, mode2);
+	if (c) {
+		*size = c->size;
+		return c->buf;
+	}
+	tree = read_sha1_file(sha1, type, size);
+	if (!tree || strcmp(type, "tree"))
+		die("corrupt tree sha %s", sha1_to_hex(sha1));
+	return cache_tree(sha1, tree, *size);
+}
+
+/* Like read_subtree(), but sha1 can name a commit or a tag as well */
+static void *read_tree_reference(const unsigned char *sha1, unsigned long *size)
+{
+	struct cached_tree *c = lookup_cached_tree(sha1);
+	unsigned char tree_sha1[20];
+	void *tree;
+
+	if (c) {
+		*size = c->size;
+		return c->buf;
+	}
+	tree = read_object_with_reference(sha1, "tree", size, tree_sha1);
+	if (!tree)
+		return NULL;
+	c = lookup_cached_tree(tree_sha1);
+	if (c) {
+		free(tree);
+		*size = c->size;
+		return c->buf;
+	}
+	return cache_tree(tree_sha1, tree, *size);
+}
+
+static void show_entry(struct diff_options *opt, const char *prefix,
+		       const struct tree_entry *e, const char *base, int baselen);
+
+static int compare_tree_entry(const struct tree_entry *e1, const struct tree_entry *e2,
+			      const char *base, int baselen, struct diff_options *opt)
+{
+	int cmp;
+
+	cmp = base_name_compare(e1->path, e1->pathlen, e1->mode,
+				e2->path, e2->pathlen, e2->mode);
 	if (cmp < 0) {
-		show_entry(opt, "-", t1, base);
+		show_entry(opt, "-", e1, base, baselen);
 		return -1;
 	}
 	if (cmp > 0) {
-		show_entry(opt, "+", t2, base);
+		show_entry(opt, "+", e2, base, baselen);
 		return 1;
 	}
+	/* Identical subtrees are skipped before anything is read */
 	if (!opt->find_copies_harder &&
-	    !memcmp(sha1, sha2, 20) && mode1 == mode2)
+	    !memcmp(e1->sha1, e2->sha1, 20) && e1->mode == e2->mode)
 		return 0;
 
 	/*
 	 * If the filemode has changed to/from a directory from/to a regular
 	 * file, we need to consider it a remove and an add.
 	 */
-	if (S_ISDIR(mode1) != S_ISDIR(mode2)) {
-		show_entry(opt, "-", t1, base);
-		show_entry(opt, "+", t2, base);
+	if (S_ISDIR(e1->mode) != S_ISDIR(e2->mode)) {
+		show_entry(opt, "-", e1, base, baselen);
+		show_entry(opt, "+", e2, base, baselen);
 		return 0;
 	}
 
-	if (opt->recursive && S_ISDIR(mode1)) {
+	if (opt->recursive && S_ISDIR(e1->mode)) {
+		struct tree_desc t1, t2;
+		void *tree1, *tree2;
+		char *newbase;
 		int retval;
-		char *newbase = malloc_base(base, path1, pathlen1);
+
 		if (opt->tree_in_recursive)
-			opt->change(opt, mode1, mode2,
-				    sha1, sha2, base, path1);
-		retval = diff_tree_sha1(sha1, sha2, newbase, opt);
+			opt->change(opt, e1->mode, e2->mode,
+				    e1->sha1, e2->sha1, base, e1->path);
+		newbase = malloc_base(base, baselen, e1->path, e1->pathlen);
+		tree1 = read_subtree(e1->sha1, &t1.size);
+		tree2 = read_subtree(e2->sha1, &t2.size);
+		t1.buf = tree1;
+		t2.buf = tree2;
+		retval = diff_tree(&t1, &t2, newbase, opt);
+		release_tree(tree1);
+		release_tree(tree2);
 		free(newbase);
 		return retval;
 	}
 
-	opt->change(opt, mode1, mode2, sha1, sha2, base, path1);
+	opt->change(opt, e1->mode, e2->mode, e1->sha1, e2->sha1, base, e1->path);
 	return 0;
 }
 
-static int interesting(struct tree_desc *desc, const char *base)
-{
-	const char *path;
-	unsigned mode;
-	int i;
-	int baselen, pathlen;
-
-	if (!nr_paths)
-		return 1;
-
-	(void)extract(desc, &path, &mode);
-
-	pathlen = strlen(path);
-	baselen = strlen(base);
-
-	for (i=0; i < nr_paths; i++) {
-		const char *match = paths[i];
-		int matchlen = pathlens[i];
-
-		if (baselen >= matchlen) {
-			/* If it doesn't match, move along... */
-			if (strncmp(base, match, matchlen))
-				continue;
-
-			/* The base is a subdirectory of a path which was specified. */
-			return 1;
-		}
-
-		/* Does the base match? */
-		if (strncmp(base, match, baselen))
-			continue;
-
-		match += baselen;
-		matchlen -= baselen;
-
-		if (pathlen > matchlen)
-			continue;
-
-		if (matchlen > pathlen) {
-			if (match[pathlen] != '/')
-				continue;
-			if (!S_ISDIR(mode))
-				continue;
-		}
-
-		if (strncmp(path, match, pathlen))
-			continue;
-
-		return 1;
-	}
-	return 0; /* No matches */
-}
-
 /* A whole sub-tree went away or appeared */
-static void show_tree(struct diff_options *opt, const char *prefix, struct tree_desc *desc, const char *base)
+static void show_tree(struct diff_options *opt, const char *prefix,
+		      struct tree_desc *desc, const char *base, int baselen)
 {
+	struct path_matcher m;
+
+	if (!prepare_matcher(&m, base, baselen))
+		return;
 	while (desc->size) {
-		if (interesting(desc, base))
-			show_entry(opt, prefix, desc, base);
-		update_tree_entry(desc);
+		struct tree_entry e;
+
+		decode_entry(desc, &e);
+		if (interesting(&m, &e))
+			show_entry(opt, prefix, &e, base, baselen);
+		skip_entry(desc, &e);
 	}
+	free_matcher(&m);
 }
 
 /* A file entry went away or appeared */
-static int show_entry(struct diff_options *opt, const char *prefix, struct tree_desc *desc, const char *base)
+static void show_entry(struct diff_options *opt, const char *prefix,
+		       const struct tree_entry *e, const char *base, int baselen)
 {
-	unsigned mode;
-	const char *path;
-	const unsigned char *sha1 = extract(desc, &path, &mode);
-
-	if (opt->recursive && S_ISDIR(mode)) {
-		char type[20];
-		char *newbase = malloc_base(base, path, strlen(path));
+	if (opt->recursive && S_ISDIR(e->mode)) {
+		char *newbase = malloc_base(base, baselen, e->path, e->pathlen);
 		struct tree_desc inner;
 		void *tree;
 
-		tree = read_sha1_file(sha1, type, &inner.size);
-		if (!tree || strcmp(type, "tree"))
-			die("corrupt tree sha %s", sha1_to_hex(sha1));
-
+		tree = read_subtree(e->sha1, &inner.size);
 		inner.buf = tree;
-		show_tree(opt, prefix, &inner, newbase);
+		show_tree(opt, prefix, &inner, newbase,
+			  baselen + e->pathlen + 1);
 
-		free(tree);
+		release_tree(tree);
 		free(newbase);
-		return 0;
+		return;
 	}
 
-	opt->add_remove(opt, prefix[0], mode, sha1, base, path);
-	return 0;
+	opt->add_remove(opt, prefix[0], e->mode, e->sha1, base, e->path);
 }
 
 int diff_tree(struct tree_desc *t1, struct tree_desc *t2, const char *base, struct diff_options *opt)
 {
+	int baselen = strlen(base);
+	struct path_matcher m;
+	struct tree_entry e1, e2;
+	int have1 = 0, have2 = 0;
+
+	if (!prepare_matcher(&m, base, baselen))
+		return 0;
 	while (t1->size | t2->size) {
-		if (nr_paths && t1->size && !interesting(t1, base)) {
-			update_tree_entry(t1);
+		if (t1->size && !have1) {
+			decode_entry(t1, &e1);
+			have1 = 1;
+		}
+		if (t2->size && !have2) {
+			decode_entry(t2, &e2);
+			have2 = 1;
+		}
+		if (t1->size && !interesting(&m, &e1)) {
+			skip_entry(t1, &e1);
+			have1 = 0;
 			continue;
 		}
-		if (nr_paths && t2->size && !interesting(t2, base)) {
-			update_tree_entry(t2);
+		if (t2->size && !interesting(&m, &e2)) {
+			skip_entry(t2, &e2);
+			have2 = 0;
 			continue;
 		}
 		if (!t1->size) {
-			show_entry(opt, "+", t2, base);
-			update_tree_entry(t2);
+			show_entry(opt, "+", &e2, base, baselen);
+			skip_entry(t2, &e2);
+			have2 = 0;
 			continue;
 		}
 		if (!t2->size) {
-			show_entry(opt, "-", t1, base);
-			update_tree_entry(t1);
+			show_entry(opt, "-", &e1, base, baselen);
+			skip_entry(t1, &e1);
+			have1 = 0;
 			continue;
 		}
-		switch (compare_tree_entry(t1, t2, base, opt)) {
+		switch (compare_tree_entry(&e1, &e2, base, baselen, opt)) {
 		case -1:
-			update_tree_entry(t1);
+			skip_entry(t1, &e1);
+			have1 = 0;
 			continue;
 		case 0:
-			update_tree_entry(t1);
+			skip_entry(t1, &e1);
+			have1 = 0;
 			/* Fallthrough */
 		case 1:
-			update_tree_entry(t2);
+			skip_entry(t2, &e2);
+			have2 = 0;
 			continue;
 		}
 		die("git-diff-tree: internal error");
 	}
+	free_matcher(&m);
 	return 0;
 }
 
@@ -234,17 +409,19 @@ int diff_tree_sha1(const unsigned char *old, const unsigned char *new, const cha
 	struct tree_desc t1, t2;
 	int retval;
 
-	tree1 = read_object_with_reference(old, "tree", &t1.size, NULL);
+	if (!opt->find_copies_harder && !memcmp(old, new, 20))
+		return 0;
+	tree1 = read_tree_reference(old, &t1.size);
 	if (!tree1)
 		die("unable to read source tree (%s)", sha1_to_hex(old));
-	tree2 = read_object_with_reference(new, "tree", &t2.size, NULL);
+	tree2 = read_tree_reference(new, &t2.size);
 	if (!tree2)
 		die("unable to read destination tree (%s)", sha1_to_hex(new));
 	t1.buf = tree1;
 	t2.buf = tree2;
 	retval = diff_tree(&t1, &t2, base, opt);
-	free(tree1);
-	free(tree2);
+	release_tree(tree1);
+	release_tree(tree2);
 	return retval;
 }
 
@@ -11,6 +11,7 @@ static const char unpack_usage[] = "git-unpack-objects [-n] [-q] < pack-file";
 /* We always read in 4kB chunks. */
 static unsigned char buffer[4096];
 static unsigned long offset, len, eof;
+static unsigned long consumed_bytes;
 static SHA_CTX ctx;
 
 /*
@@ -48,6 +49,7 @@ static void use(int bytes)
 		die("used more bytes than were available");
 	len -= bytes;
 	offset += bytes;
+	consumed_bytes += bytes;
 }
 
 static void *get_data(unsigned long size)
@@ -189,6 +191,42 @@ static int unpack_delta_entry(unsigned long delta_size)
 	return result;
 }
 
+/*
+ * The rates are over the last second or so, so that they show how
+ * the transfer is going now, not how it went on average; there is
+ * nothing to show before the first second is over.
+ */
+static struct timeval last_time;
+
+static void show_progress(unsigned nr, unsigned total)
+{
+	static unsigned last_percent, last_nr, object_rate;
+	static unsigned long last_bytes, byte_rate;
+	unsigned percentage = (nr * 100) / total;
+	struct timeval now;
+	long ms;
+
+	gettimeofday(&now, NULL);
+	ms = (now.tv_sec - last_time.tv_sec) * 1000 +
+		(now.tv_usec - last_time.tv_usec) / 1000;
+	if (percentage == last_percent && ms < 1000)
+		return;
+	if (ms >= 1000) {
+		object_rate = (nr - last_nr) * 1000UL / ms;
+		byte_rate = (consumed_bytes - last_bytes) / 1024 * 1000 / ms;
+		last_time = now;
+		last_nr = nr;
+		last_bytes = consumed_bytes;
+	}
+	last_percent = percentage;
+	if (!last_nr)
+		fprintf(stderr, "%4u%% (%u/%u) done\r", percentage, nr, total);
+	else
+		fprintf(stderr, "%4u%% (%u/%u) done, %lu KiB, %lu KiB/s, "
+			"%u objects/s  \r", percentage, nr, total,
+			consumed_bytes / 1024, byte_rate, object_rate);
+}
+
 static void unpack_one(unsigned nr, unsigned total)
 {
 	unsigned shift;
@@ -209,19 +247,8 @@ static void unpack_one(unsigned nr, unsigned total)
 		size += (c & 0x7f) << shift;
 		shift += 7;
 	}
-	if (!quiet) {
-		static unsigned long last_sec;
-		static unsigned last_percent;
-		struct timeval now;
-		unsigned percentage = (nr * 100) / total;
-
-		gettimeofday(&now, NULL);
-		if (percentage != last_percent || now.tv_sec != last_sec) {
-			last_sec = now.tv_sec;
-			last_percent = percentage;
-			fprintf(stderr, "%4u%% (%u/%u) done\r", percentage, nr, total);
-		}
-	}
+	if (!quiet)
+		show_progress(nr, total);
 	switch (type) {
 	case OBJ_COMMIT:
 	case OBJ_TREE:
@@ -254,6 +281,7 @@ static void unpack_all(void)
 	if (version != PACK_VERSION)
 		die("unable to handle pack file version %d", version);
 	fprintf(stderr, "Unpacking %d objects\n", nr_objects);
+	gettimeofday(&last_time, NULL);
 
 	use(sizeof(struct pack_header));
 	for (i = 0; i < nr_objects; i++)
@@ -281,6 +309,27 @@ int main(int argc, char **argv)
 				quiet = 1;
 				continue;
 			}
+			if (!strncmp(arg, "--pack_header=", 14)) {
+				/*
+				 * Whoever ran us has already read the
+				 * header off our standard input to decide
+				 * what to do with the pack; take it from
+				 * the command line instead.
+				 */
+				struct pack_header *hdr;
+				char *c;
+
+				hdr = (struct pack_header *)buffer;
+				hdr->hdr_signature = htonl(PACK_SIGNATURE);
+				hdr->hdr_version = htonl(strtoul(arg + 14, &c, 10));
+				if (*c != ',')
+					die("bad %s", arg);
+				hdr->hdr_entries = htonl(strtoul(c + 1, &c, 10));
+				if (*c)
+					die("bad %s", arg);
+				len = sizeof(*hdr);
+				continue;
+			}
 			usage(unpack_usage);
 		}
 
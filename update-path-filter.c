@@ -0,0 +1,260 @@
+/*
+ * Write $GIT_OBJECT_DIRECTORY/info/path-filters for all commits
+ * reachable from the refs.
+ */
+#include "cache.h"
+#include "refs.h"
+#include "commit.h"
+#include "tag.h"
+#include "diff.h"
+#include "csum-file.h"
+#include "path-filter.h"
+
+static const char update_path_filter_usage[] =
+"git-update-path-filter [--force] [-v]";
+
+#define SEEN (1u << 0)
+
+struct filter_entry {
+	unsigned char commit[20];
+	unsigned char parent[20];
+	unsigned char *bits;
+	unsigned long size;
+};
+
+static struct filter_entry *entries;
+static int nr_entries, alloc_entries;
+
+static struct commit_list *walk;
+
+static char **changed;
+static int nr_changed, alloc_changed;
+
+static void add_changed(const char *base, const char *path)
+{
+	int baselen = strlen(base), len = strlen(path);
+	char *full = xmalloc(baselen + len + 1);
+
+	memcpy(full, base, baselen);
+	memcpy(full + baselen, path, len + 1);
+	if (nr_changed == alloc_changed) {
+		alloc_changed = alloc_nr(alloc_changed);
+		changed = xrealloc(changed, alloc_changed * sizeof(*changed));
+	}
+	changed[nr_changed++] = full;
+}
+
+static void file_add_remove(struct diff_options *options,
+			    int addremove, unsigned mode,
+			    const unsigned char *sha1,
+			    const char *base, const char *path)
+{
+	add_changed(base, path);
+}
+
+static void file_change(struct diff_options *options,
+			unsigned old_mode, unsigned new_mode,
+			const unsigned char *old_sha1,
+			const unsigned char *new_sha1,
+			const char *base, const char *path)
+{
+	add_changed(base, path);
+}
+
+static struct diff_options diff_opt = {
+	.recursive = 1,
+	.add_remove = file_add_remove,
+	.change = file_change,
+};
+
+static int compare_paths(const void *a_, const void *b_)
+{
+	return strcmp(*(char **)a_, *(char **)b_);
+}
+
+/*
+ * Add the leading directories of the changed paths, so that
+ * limiting to "dir" finds a change to "dir/file".
+ */
+static void add_leading_directories(void)
+{
+	int i, nr = nr_changed;
+
+	for (i = 0; i < nr; i++) {
+		const char *slash = changed[i];
+		while ((slash = strchr(slash, '/')) != NULL) {
+			char *dir = xmalloc(slash - changed[i] + 1);
+			memcpy(dir, changed[i], slash - changed[i]);
+			dir[slash - changed[i]] = 0;
+			add_changed("", dir);
+			free(dir);
+			slash++;
+		}
+	}
+}
+
+static void make_filter(struct commit *commit, struct commit *parent,
+			struct filter_entry *entry)
+{
+	int i, nr;
+
+	nr_changed = 0;
+	if (parent) {
+		parse_commit(parent);
+		if (diff_tree_sha1(parent->tree->object.sha1,
+				   commit->tree->object.sha1, "", &diff_opt) < 0)
+			die("unable to diff %s", sha1_to_hex(commit->object.sha1));
+	} else {
+		struct tree_desc empty, real;
+		void *tree;
+
+		tree = read_object_with_reference(commit->tree->object.sha1,
+						  "tree", &real.size, NULL);
+		if (!tree)
+			die("unable to read tree of %s",
+			    sha1_to_hex(commit->object.sha1));
+		real.buf = tree;
+		empty.buf = "";
+		empty.size = 0;
+		diff_tree(&empty, &real, "", &diff_opt);
+		free(tree);
+	}
+	add_leading_directories();
+
+	qsort(changed, nr_changed, sizeof(*changed), compare_paths);
+	for (i = nr = 0; i < nr_changed; i++) {
+		if (nr && !strcmp(changed[nr - 1], changed[i])) {
+			free(changed[i]);
+			continue;
+		}
+		changed[nr++] = changed[i];
+	}
+
+	entry->bits = NULL;
+	entry->size = 0;
+	if (nr <= PATH_FILTER_MAX_PATHS) {
+		entry->size = (nr * PATH_FILTER_BITS_PER_PATH + 7) / 8;
+		if (entry->size < 8)
+			entry->size = 8;
+		entry->bits = xcalloc(1, entry->size);
+		for (i = 0; i < nr; i++)
+			path_filter_add(entry->bits, entry->size,
+					changed[i], strlen(changed[i]));
+	}
+	for (i = 0; i < nr; i++)
+		free(changed[i]);
+}
+
+static int add_one_ref(const char *path, const unsigned char *sha1)
+{
+	struct object *o = deref_tag(parse_object(sha1), path, 0);
+
+	if (o && o->type == commit_type && !(o->flags & SEEN)) {
+		o->flags |= SEEN;
+		insert_by_date((struct commit *)o, &walk);
+	}
+	return 0;
+}
+
+static int compare_entries(const void *a_, const void *b_)
+{
+	const struct filter_entry *a = a_, *b = b_;
+	return memcmp(a->commit, b->commit, 20);
+}
+
+static void put_be32(unsigned char *p, unsigned int n)
+{
+	p[0] = n >> 24;
+	p[1] = n >> 16;
+	p[2] = n >> 8;
+	p[3] = n;
+}
+
+static void write_filters(const char *path)
+{
+	struct sha1file *f;
+	unsigned char hdr[12], tail[4];
+	unsigned long offset = 0;
+	char *lock = xmalloc(strlen(path) + 6);
+	int i;
+
+	sprintf(lock, "%s.lock", path);
+	f = sha1create("%s", lock);
+	put_be32(hdr, PATH_FILTER_SIGNATURE);
+	put_be32(hdr + 4, PATH_FILTER_VERSION);
+	put_be32(hdr + 8, nr_entries);
+	sha1write(f, hdr, 12);
+	for (i = 0; i < nr_entries; i++) {
+		offset += entries[i].size;
+		sha1write(f, entries[i].commit, 20);
+		sha1write(f, entries[i].parent, 20);
+		put_be32(tail, offset);
+		sha1write(f, tail, 4);
+	}
+	for (i = 0; i < nr_entries; i++)
+		sha1write(f, entries[i].bits, entries[i].size);
+	sha1close(f, NULL, 1);
+	if (rename(lock, path))
+		die("unable to rename %s: %s", lock, strerror(errno));
+	free(lock);
+}
+
+int main(int argc, char **argv)
+{
+	int i, force = 0, verbose = 0, reused = 0;
+	char *path;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp("--force", argv[i]) || !strcmp("-f", argv[i]))
+			force = 1;
+		else if (!strcmp("-v", argv[i]))
+			verbose = 1;
+		else
+			usage(update_path_filter_usage);
+	}
+
+	setup_git_directory();
+	save_commit_buffer = 0;
+	track_object_refs = 0;
+
+	path = xmalloc(strlen(get_object_directory()) + 20);
+	sprintf(path, "%s/info/path-filters", get_object_directory());
+
+	for_each_ref(add_one_ref);
+	while (walk) {
+		struct commit *commit = pop_most_recent_commit(&walk, SEEN);
+		struct commit *parent = commit->parents ? commit->parents->item : NULL;
+		struct filter_entry *entry;
+		struct path_filter old;
+
+		if (nr_entries == alloc_entries) {
+			alloc_entries = alloc_nr(alloc_entries);
+			entries = xrealloc(entries, alloc_entries * sizeof(*entries));
+		}
+		entry = &entries[nr_entries++];
+		memcpy(entry->commit, commit->object.sha1, 20);
+		if (parent)
+			memcpy(entry->parent, parent->object.sha1, 20);
+		else
+			memset(entry->parent, 0, 20);
+
+		if (!force &&
+		    find_path_filter(commit->object.sha1,
+				     parent ? parent->object.sha1 : NULL, &old)) {
+			entry->size = old.size;
+			entry->bits = xmalloc(old.size ? old.size : 1);
+			memcpy(entry->bits, old.bits, old.size);
+			reused++;
+			continue;
+		}
+		make_filter(commit, parent, entry);
+	}
+
+	qsort(entries, nr_entries, sizeof(*entries), compare_entries);
+	safe_create_leading_directories(path);
+	write_filters(path);
+	if (verbose)
+		fprintf(stderr, "%d commits, %d filters reused\n",
+			nr_entries, reused);
+	return 0;
+}
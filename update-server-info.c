@@ -1,25 +1,23 @@
 #include "cache.h"
 
 static const char update_server_info_usage[] =
-"git-update-server-info [--force]";
+"git-update-server-info [--force] [<ref>...]";
 
 int main(int ac, char **av)
 {
 	int i;
 	int force = 0;
 	for (i = 1; i < ac; i++) {
-		if (av[i][0] == '-') {
-			if (!strcmp("--force", av[i]) ||
-			    !strcmp("-f", av[i]))
-				force = 1;
-			else
-				usage(update_server_info_usage);
-		}
+		if (av[i][0] != '-')
+			break;
+		if (!strcmp("--force", av[i]) ||
+		    !strcmp("-f", av[i]))
+			force = 1;
+		else
+			usage(update_server_info_usage);
 	}
-	if (i != ac)
-		usage(update_server_info_usage);
 
 	setup_git_directory();
 
-	return !!update_server_info(force);
+	return !!update_server_info(force, i < ac ? (const char **)av + i : NULL);
 }
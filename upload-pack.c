@@ -4,6 +4,9 @@
 #include "tag.h"
 #include "object.h"
 #include "commit.h"
+#include "sideband.h"
+#include <sys/wait.h>
+#include <sys/poll.h>
 
 static const char upload_pack_usage[] = "git-upload-pack [--strict] [--timeout=nn] <dir>";
 
@@ -13,6 +16,7 @@ static const char upload_pack_usage[] = "git-upload-pack [--strict] [--timeout=n
 #define MAX_HAS 256
 #define MAX_NEEDS 256
 static int nr_has = 0, nr_needs = 0, multi_ack = 0, nr_our_refs = 0;
+static int use_sideband;
 static unsigned char has_sha1[MAX_HAS][20];
 static unsigned char needs_sha1[MAX_NEEDS][20];
 static unsigned int timeout = 0;
@@ -29,62 +33,167 @@ static int strip(char *line, int len)
 	return len;
 }
 
+static void exec_rev_list(void)
+{
+	int i;
+	int args;
+	char **argv;
+	char *buf;
+	char **p;
+	int create_full_pack = (nr_our_refs == nr_needs && !nr_has);
+
+	if (create_full_pack)
+		args = 10;
+	else
+		args = nr_has + nr_needs + 5;
+	argv = xmalloc(args * sizeof(char *));
+	buf = xmalloc(args * 45);
+	p = argv;
+
+	*p++ = "git-rev-list";
+	*p++ = "--objects";
+	if (create_full_pack || MAX_NEEDS <= nr_needs)
+		*p++ = "--all";
+	else {
+		for (i = 0; i < nr_needs; i++) {
+			*p++ = buf;
+			memcpy(buf, sha1_to_hex(needs_sha1[i]), 41);
+			buf += 41;
+		}
+	}
+	if (!create_full_pack)
+		for (i = 0; i < nr_has; i++) {
+			*p++ = buf;
+			*buf++ = '^';
+			memcpy(buf, sha1_to_hex(has_sha1[i]), 41);
+			buf += 41;
+		}
+	*p++ = NULL;
+	execvp("git-rev-list", argv);
+	die("git-upload-pack: unable to exec git-rev-list");
+}
+
+static int finish_child(pid_t pid, const char *name)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			return error("git-upload-pack: waiting for %s: %s",
+				     name, strerror(errno));
+	}
+	if (WIFEXITED(status) && !WEXITSTATUS(status))
+		return 0;
+	return error("git-upload-pack: %s died with error", name);
+}
+
+/*
+ * The other end asked for "side-band": run git-pack-objects with its
+ * progress meter on, and send both the pack and what the two commands
+ * say on their stderr down the connection, each in its own band.
+ * We pass on whatever arrives as soon as it arrives, so progress
+ * messages never hold up the data; git-pack-objects itself limits
+ * how often it updates the meter.
+ */
+static void pack_objects_in_band(pid_t rev_list, int in, int err[2])
+{
+	static char data[LARGE_PACKET_MAX - 5];
+	struct pollfd pfd[2];
+	int out[2], live = 2, i;
+	const char *msg = NULL;
+	pid_t pid;
+
+	if (pipe(out) < 0)
+		die("git-upload-pack: unable to create pipe");
+	pid = fork();
+	if (pid < 0)
+		die("git-upload-pack: unable to fork git-pack-objects");
+	if (!pid) {
+		dup2(in, 0);
+		dup2(out[1], 1);
+		dup2(err[1], 2);
+		close(in);
+		close(out[0]);
+		close(out[1]);
+		close(err[0]);
+		close(err[1]);
+		execlp("git-pack-objects", "git-pack-objects",
+		       "--stdout", "--progress", NULL);
+		die("git-upload-pack: unable to exec git-pack-objects");
+	}
+	close(in);
+	close(out[1]);
+	close(err[1]);
+
+	pfd[0].fd = out[0];
+	pfd[1].fd = err[0];
+	pfd[0].events = pfd[1].events = POLLIN;
+	while (live) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			msg = "poll failed";
+			break;
+		}
+		for (i = 0; i < 2; i++) {
+			int n;
+
+			if (pfd[i].fd < 0 || !pfd[i].revents)
+				continue;
+			n = xread(pfd[i].fd, data, sizeof(data));
+			if (n <= 0) {
+				close(pfd[i].fd);
+				pfd[i].fd = -1;
+				live--;
+				continue;
+			}
+			send_sideband(1, i ? SIDEBAND_PROGRESS : SIDEBAND_DATA,
+				      data, n);
+			reset_timeout();
+		}
+	}
+
+	if (finish_child(pid, "git-pack-objects"))
+		msg = "git-pack-objects died with error";
+	if (finish_child(rev_list, "git-rev-list"))
+		msg = "git-rev-list died with error";
+	if (msg) {
+		sprintf(data, "git-upload-pack: %s\n", msg);
+		send_sideband(1, SIDEBAND_ERROR, data, strlen(data));
+		exit(1);
+	}
+	packet_flush(1);
+	exit(0);
+}
+
 static void create_pack_file(void)
 {
-	int fd[2];
+	int fd[2], err[2];
 	pid_t pid;
-	int create_full_pack = (nr_our_refs == nr_needs && !nr_has);
 
-	if (pipe(fd) < 0)
+	if (pipe(fd) < 0 || (use_sideband && pipe(err) < 0))
 		die("git-upload-pack: unable to create pipe");
 	pid = fork();
 	if (pid < 0)
 		die("git-upload-pack: unable to fork git-rev-list");
 
 	if (!pid) {
-		int i;
-		int args;
-		char **argv;
-		char *buf;
-		char **p;
-
-		if (create_full_pack)
-			args = 10;
-		else
-			args = nr_has + nr_needs + 5;
-		argv = xmalloc(args * sizeof(char *));
-		buf = xmalloc(args * 45);
-		p = argv;
-
 		dup2(fd[1], 1);
+		if (use_sideband) {
+			dup2(err[1], 2);
+			close(err[0]);
+			close(err[1]);
+		}
 		close(0);
 		close(fd[0]);
 		close(fd[1]);
-		*p++ = "git-rev-list";
-		*p++ = "--objects";
-		if (create_full_pack || MAX_NEEDS <= nr_needs)
-			*p++ = "--all";
-		else {
-			for (i = 0; i < nr_needs; i++) {
-				*p++ = buf;
-				memcpy(buf, sha1_to_hex(needs_sha1[i]), 41);
-				buf += 41;
-			}
-		}
-		if (!create_full_pack)
-			for (i = 0; i < nr_has; i++) {
-				*p++ = buf;
-				*buf++ = '^';
-				memcpy(buf, sha1_to_hex(has_sha1[i]), 41);
-				buf += 41;
-			}
-		*p++ = NULL;
-		execvp("git-rev-list", argv);
-		die("git-upload-pack: unable to exec git-rev-list");
+		exec_rev_list();
 	}
+	close(fd[1]);
+	if (use_sideband)
+		pack_objects_in_band(pid, fd[0], err);
 	dup2(fd[0], 0);
 	close(fd[0]);
-	close(fd[1]);
 	execlp("git-pack-objects", "git-pack-objects", "--stdout", NULL);
 	die("git-upload-pack: unable to exec git-pack-objects");
 }
@@ -191,6 +300,8 @@ static int receive_needs(void)
 			    "expected to get sha, not '%s'", line);
 		if (strstr(line+45, "multi_ack"))
 			multi_ack = 1;
+		if (strstr(line+45, "side-band"))
+			use_sideband = 1;
 
 		/* We have sent all our refs already, and the other end
 		 * should have chosen out of them; otherwise they are
@@ -212,7 +323,7 @@ static int receive_needs(void)
 
 static int send_ref(const char *refname, const unsigned char *sha1)
 {
-	static char *capabilities = "multi_ack";
+	static char *capabilities = "multi_ack side-band";
 	struct object *o = parse_object(sha1);
 
 	if (capabilities)
@@ -242,6 +353,7 @@ static int upload_pack(void)
 	if (!nr_needs)
 		return 0;
 	get_common_commits();
+	packet_send(1);
 	create_pack_file();
 	return 0;
 }